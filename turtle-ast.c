@@ -1,4 +1,11 @@
+#include <errno.h>
+#include <unistd.h>
+
 #include "turtle-ast.h"
+#include "turtle-motion.h"
+#include "turtle-memo.h"
+#include "turtle-simplify.h"
+#include "turtle-render.h"
 
 #define PI      3.14159265358979323846
 #define SQRT2   1.41421356237309504880
@@ -211,11 +218,30 @@ void bst_destroy(struct bst_manager *const manager) {
 	}
 }
 
+// The nodes are taken from the arena of the AST, a bump allocator working by chunks.
+// A chunk is twice larger than the previous one (up to a limit), the nodes of a chunk are zeroed by calloc.
+static struct ast_node *ast_alloc_node(struct ast *const self) {
+	struct ast_chunk *chunk = self->chunks;
+	if (chunk == 0 || chunk->count == chunk->capacity) {
+		size_t capacity = chunk ? 2 * chunk->capacity : 256;
+		if (capacity > 65536)
+			capacity = 65536;
+		chunk = calloc(1, sizeof(struct ast_chunk) + capacity * sizeof(struct ast_node));
+		if (chunk == 0)
+			return 0;
+		chunk->capacity = capacity;
+		chunk->next = self->chunks;
+		self->chunks = chunk;
+	}
+	++self->node_count;
+	return chunk->nodes + chunk->count++;
+}
+
 // All makers do the same thing, one allocation followed by a configuration of the node.
 // The configuration is relative to the specification of the Turtle project.
 
-struct ast_node *make_forward(struct ast_node *const expr) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_forward(struct ast *const self, struct ast_node *const expr) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_SIMPLE;
@@ -225,8 +251,8 @@ struct ast_node *make_forward(struct ast_node *const expr) {
 	return node;
 }
 
-struct ast_node *make_backward(struct ast_node *const expr) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_backward(struct ast *const self, struct ast_node *const expr) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_SIMPLE;
@@ -236,8 +262,8 @@ struct ast_node *make_backward(struct ast_node *const expr) {
 	return node;
 }
 
-struct ast_node *make_up() {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_up(struct ast *const self) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_SIMPLE;
@@ -245,8 +271,8 @@ struct ast_node *make_up() {
 	return node;
 }
 
-struct ast_node *make_down() {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_down(struct ast *const self) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return node;
 	node->kind = KIND_CMD_SIMPLE;
@@ -254,22 +280,19 @@ struct ast_node *make_down() {
 	return node;
 }
 
-struct ast_node *make_color(unsigned long long int const number) {
+struct ast_node *make_color(struct ast *const self, unsigned long long int const number) {
 	// The hexa notation is used because it's compatible with many devices.
 	// The hexa notation is now converted into 3 double, each representing one RGB channel.
-	struct ast_node *const r = make_value((double) (number >> 32) / 65535.0);
-	struct ast_node *const g = make_value((double) (number >> 16 & 0xFFFF) / 65535.0);
-	struct ast_node *const b = make_value((double) (number & 0xFFFF) / 65535.0);
+	struct ast_node *const r = make_value(self, (double) (number >> 32) / 65535.0);
+	struct ast_node *const g = make_value(self, (double) (number >> 16 & 0xFFFF) / 65535.0);
+	struct ast_node *const b = make_value(self, (double) (number & 0xFFFF) / 65535.0);
 	if (r && g && b)
-		return make_raw_color(r, g, b);
-	if (r) free(r);
-	if (g) free(g);
-	if (b) free(b);
+		return make_raw_color(self, r, g, b);
 	return 0 ;
 }
 
-struct ast_node *make_raw_color(struct ast_node *const expr_r, struct ast_node *const expr_g, struct ast_node *const expr_b) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_raw_color(struct ast *const self, struct ast_node *const expr_r, struct ast_node *const expr_g, struct ast_node *const expr_b) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_SIMPLE;
@@ -281,8 +304,8 @@ struct ast_node *make_raw_color(struct ast_node *const expr_r, struct ast_node *
 	return node;
 }
 
-struct ast_node *make_left(struct ast_node *const expr) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_left(struct ast *const self, struct ast_node *const expr) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_SIMPLE;
@@ -292,8 +315,8 @@ struct ast_node *make_left(struct ast_node *const expr) {
 	return node;
 }
 
-struct ast_node *make_right(struct ast_node *const expr) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_right(struct ast *const self, struct ast_node *const expr) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_SIMPLE;
@@ -303,8 +326,8 @@ struct ast_node *make_right(struct ast_node *const expr) {
 	return node;
 }
 
-struct ast_node *make_heading(struct ast_node *const expr) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_heading(struct ast *const self, struct ast_node *const expr) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_SIMPLE;
@@ -314,8 +337,8 @@ struct ast_node *make_heading(struct ast_node *const expr) {
 	return node;
 }
 
-struct ast_node *make_position(struct ast_node *const expr_x, struct ast_node *const expr_y) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_position(struct ast *const self, struct ast_node *const expr_x, struct ast_node *const expr_y) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_SIMPLE;
@@ -326,8 +349,8 @@ struct ast_node *make_position(struct ast_node *const expr_x, struct ast_node *c
 	return node;
 }
 
-struct ast_node *make_home() {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_home(struct ast *const self) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_SIMPLE;
@@ -335,8 +358,8 @@ struct ast_node *make_home() {
 	return node;
 }
 
-struct ast_node *make_print(struct ast_node *const expr) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_print(struct ast *const self, struct ast_node *const expr) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_SIMPLE;
@@ -346,8 +369,8 @@ struct ast_node *make_print(struct ast_node *const expr) {
 	return node;
 }
 
-struct ast_node *make_repeat(struct ast_node *const expr_count, struct ast_node *const to_repeat) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_repeat(struct ast *const self, struct ast_node *const expr_count, struct ast_node *const to_repeat) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_REPEAT;
@@ -357,8 +380,31 @@ struct ast_node *make_repeat(struct ast_node *const expr_count, struct ast_node
 	return node;
 }
 
-struct ast_node *make_cmds_block(struct ast_node *const to_block) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_if(struct ast *const self, struct ast_node *const expr_test, struct ast_node *const if_true, struct ast_node *const if_false) {
+	struct ast_node *const node = ast_alloc_node(self);
+	if (node == 0)
+		return 0;
+	node->kind = KIND_CMD_IF;
+	node->children[0] = expr_test;
+	node->children[1] = if_true;
+	node->children[2] = if_false;
+	node->children_count = if_false ? 3 : 2;
+	return node;
+}
+
+struct ast_node *make_while(struct ast *const self, struct ast_node *const expr_test, struct ast_node *const to_repeat) {
+	struct ast_node *const node = ast_alloc_node(self);
+	if (node == 0)
+		return 0;
+	node->kind = KIND_CMD_WHILE;
+	node->children[0] = expr_test;
+	node->children[1] = to_repeat;
+	node->children_count = 2;
+	return node;
+}
+
+struct ast_node *make_cmds_block(struct ast *const self, struct ast_node *const to_block) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_BLOCK;
@@ -367,21 +413,35 @@ struct ast_node *make_cmds_block(struct ast_node *const to_block) {
 	return node;
 }
 
-struct ast_node *make_call(struct bst_entry *const entry) {
+// The arguments are counted here, the call is checked against its declaration when it's evaluated.
+struct ast_node *make_call(struct ast *const self, struct bst_entry *const entry, struct ast_node *const args) {
 	if (entry == 0)
 		return 0;
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+	size_t count = 0;
+	for (const struct ast_node *arg = args ; arg ; arg = arg->next)
+		++count;
+	if (count > UINT16_MAX) {
+		fprintf(stderr, "Procedure '%s' call failed : more than %d arguments.\n", entry->key, UINT16_MAX);
+		self->error_number = 1;
+		return 0;
+	}
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_CALL;
 	node->u.bst_entry = entry; // everything is constant here, bst already holds the string
+	node->arity = (uint16_t) count;
+	if (args) {
+		node->children[0] = args;
+		node->children_count = 1;
+	}
 	return node;
 }
 
-struct ast_node *make_set(struct bst_entry *const entry, struct ast_node *const expr) {
+struct ast_node *make_set(struct ast *const self, struct bst_entry *const entry, struct ast_node *const expr) {
 	if (entry == 0)
 		return 0;
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_SET;
@@ -391,21 +451,38 @@ struct ast_node *make_set(struct bst_entry *const entry, struct ast_node *const
 	return node;
 }
 
-struct ast_node *make_proc(struct bst_entry *const entry, struct ast_node *const root) {
+// The parameters are names linked by their next node, they are kept after the body (not counted as a child),
+// so the passes walking the commands never see them, ast_resolve binds their reads and their "set" to indexes.
+struct ast_node *make_proc(struct ast *const self, struct bst_entry *const entry, struct ast_node *const params, struct ast_node *const root) {
 	if (entry == 0)
 		return 0;
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+	size_t count = 0;
+	for (const struct ast_node *param = params ; param ; param = param->next, ++count)
+		for (const struct ast_node *other = params ; other != param ; other = other->next)
+			if (other->u.bst_entry == param->u.bst_entry) {
+				fprintf(stderr, "Procedure '%s' declaration failed : the parameter '%s' is given twice.\n", entry->key, param->u.bst_entry->key);
+				self->error_number = 1;
+				return 0;
+			}
+	if (count > UINT16_MAX) {
+		fprintf(stderr, "Procedure '%s' declaration failed : more than %d parameters.\n", entry->key, UINT16_MAX);
+		self->error_number = 1;
+		return 0;
+	}
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_CMD_PROC;
 	node->u.bst_entry = entry;
+	node->arity = (uint16_t) count;
 	node->children[0] = root;
+	node->children[1] = params;
 	node->children_count = 1;
 	return node;
 }
 
-struct ast_node *make_value(double const value) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_value(struct ast *const self, double const value) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_EXPR_VALUE;
@@ -413,10 +490,10 @@ struct ast_node *make_value(double const value) {
 	return node;
 }
 
-struct ast_node *make_name(struct bst_entry *const entry) {
+struct ast_node *make_name(struct ast *const self, struct bst_entry *const entry) {
 	if (entry == 0)
 		return 0;
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_EXPR_NAME;
@@ -424,8 +501,18 @@ struct ast_node *make_name(struct bst_entry *const entry) {
 	return node;
 }
 
-struct ast_node *make_math_func(enum ast_func const func, struct ast_node *const expr) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_arg(struct ast *const self, struct ast_node *const expr) {
+	struct ast_node *const node = ast_alloc_node(self);
+	if (node == 0)
+		return 0;
+	node->kind = KIND_ARG;
+	node->children[0] = expr;
+	node->children_count = 1;
+	return node;
+}
+
+struct ast_node *make_math_func(struct ast *const self, enum ast_func const func, struct ast_node *const expr) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_EXPR_FUNC;
@@ -435,8 +522,8 @@ struct ast_node *make_math_func(enum ast_func const func, struct ast_node *const
 	return node;
 }
 
-struct ast_node *make_random(struct ast_node *const expr_low, struct ast_node *const expr_high) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_random(struct ast *const self, struct ast_node *const expr_low, struct ast_node *const expr_high) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_EXPR_FUNC;
@@ -447,8 +534,8 @@ struct ast_node *make_random(struct ast_node *const expr_low, struct ast_node *c
 	return node;
 }
 
-struct ast_node *make_expr_block(struct ast_node *const to_block) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_expr_block(struct ast *const self, struct ast_node *const to_block) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_EXPR_BLOCK;
@@ -457,8 +544,8 @@ struct ast_node *make_expr_block(struct ast_node *const to_block) {
 	return node;
 }
 
-struct ast_node *make_binop(char const op, struct ast_node *const lhs, struct ast_node *const rhs) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_binop(struct ast *const self, char const op, struct ast_node *const lhs, struct ast_node *const rhs) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_EXPR_BINOP;
@@ -469,8 +556,8 @@ struct ast_node *make_binop(char const op, struct ast_node *const lhs, struct as
 	return node;
 }
 
-struct ast_node *make_unop(char const op, struct ast_node *const expr) {
-	struct ast_node *const node = calloc(1, sizeof(struct ast_node));
+struct ast_node *make_unop(struct ast *const self, char const op, struct ast_node *const expr) {
+	struct ast_node *const node = ast_alloc_node(self);
 	if (node == 0)
 		return 0;
 	node->kind = KIND_EXPR_UNOP;
@@ -480,118 +567,545 @@ struct ast_node *make_unop(char const op, struct ast_node *const expr) {
 	return node;
 }
 
-// Destroying the AST tree using recursion.
-void destroy_node(struct ast_node *const node) {
-	struct ast_node *next = node->next;
-	for (int i = 0 ; i < node->children_count ; ++i)
-		destroy_node(node->children[i]);
-	free(node);
-	if (next)
-		destroy_node(next);
+struct ast_node *make_test(struct ast *const self, enum ast_test const test, struct ast_node *const lhs, struct ast_node *const rhs) {
+	struct ast_node *const node = ast_alloc_node(self);
+	if (node == 0)
+		return 0;
+	node->kind = KIND_EXPR_TEST;
+	node->u.test = test;
+	node->children[0] = lhs;
+	node->children[1] = rhs;
+	node->children_count = rhs ? 2 : 1;
+	return node;
+}
+
+// This node is not produced by the parser, the optimizer wraps a loop invariant expression into it.
+struct ast_node *make_hoisted(struct ast *const self, uint32_t const slot, struct ast_node *const expr) {
+	struct ast_node *const node = ast_alloc_node(self);
+	if (node == 0)
+		return 0;
+	node->kind = KIND_EXPR_HOISTED;
+	node->slot = slot;
+	node->children[0] = expr;
+	node->children_count = 1;
+	return node;
 }
 
-// Initiate the AST (abstract syntax tree) destruction.
+// Initiate the AST (abstract syntax tree) destruction, the nodes are released chunk by chunk.
 void ast_destroy(struct ast *const self) {
 	if (self) {
-		if (self->unit)
-			destroy_node(self->unit);
+		for (struct ast_chunk *chunk = self->chunks, *next ; chunk ; chunk = next) {
+			next = chunk->next;
+			free(chunk);
+		}
+		self->chunks = 0;
+		self->unit = 0;
+		self->node_count = 0;
 		bst_destroy(&self->parsing);
 	}
 }
 
+// Give a slot to the variable name held by the entry, if it doesn't already have one.
+static void resolve_name(struct ast *const self, struct bst_entry *const entry) {
+	if (entry->value.parsing.is_var_name)
+		return;
+	entry->value.parsing.is_var_name = true;
+	entry->value.parsing.slot = self->slot_count++;
+}
+
+// Return the index of a name in the parameters of a procedure, or -1 if it's not one of them.
+static long resolve_param(const struct ast_node *params, const struct bst_entry *const entry) {
+	for (long index = 0 ; params ; params = params->next, ++index)
+		if (params->u.bst_entry == entry)
+			return index;
+	return -1;
+}
+
+// Walk the nodes, so every variable read or written by the program receives its slot, procedures too.
+// Within a procedure, the names of its parameters are locals, they are read and written by their index instead.
+static void resolve_node(struct ast *const self, struct ast_node *node, const struct ast_node *const params) {
+	for (; node; node = node->next) {
+		long index;
+		switch (node->kind) {
+			case KIND_EXPR_NAME :
+			case KIND_CMD_SET :
+				if ((index = resolve_param(params, node->u.bst_entry)) >= 0) {
+					node->kind = node->kind == KIND_CMD_SET ? KIND_CMD_SET_LOCAL : KIND_EXPR_LOCAL;
+					node->slot = (uint32_t) index;
+					break;
+				}
+				resolve_name(self, node->u.bst_entry);
+				node->slot = (uint32_t) node->u.bst_entry->value.parsing.slot;
+				break;
+			case KIND_CMD_CALL :
+			case KIND_CMD_PROC :
+				if (!node->u.bst_entry->value.parsing.is_proc_name) {
+					node->u.bst_entry->value.parsing.is_proc_name = true;
+					node->u.bst_entry->value.parsing.proc_slot = self->proc_count++;
+				}
+				break;
+			default: break;
+		}
+		// a declaration only sees its own parameters (a nested one fails at runtime anyway).
+		for (size_t i = 0 ; i < node->children_count ; ++i)
+			resolve_node(self, node->children[i], node->kind == KIND_CMD_PROC ? node->children[1] : params);
+	}
+}
+
+// The lexer interned every identifier into the "parsing" BST, this pass turns the variable names into dense indexes.
+// The predefined variables PI, SQRT2 and SQRT3 are receiving the slots 0, 1 and 2 (see enum ast_slot).
+void ast_resolve(struct ast *const self) {
+	static const char *const predefined[] = {"PI", "SQRT2", "SQRT3"};
+	if (self == 0 || self->error_number)
+		return;
+	for (size_t i = 0 ; i < sizeof(predefined) / sizeof(*predefined) ; ++i) {
+		self->parsing.search_only = 0;
+		struct bst_entry *const entry = bst_at(&self->parsing, predefined[i]);
+		if (entry == 0) {
+			self->error_number = 1;
+			return;
+		}
+		resolve_name(self, entry);
+	}
+	resolve_node(self, self->unit, 0);
+}
+
 /*
  * context
  */
 
-// A context is nothing without an AST, it's simply zeroed by this function.
+// A context is nothing without an AST, it's simply zeroed by this function (the random generator has the seed 0), the depth limit has its default value.
+// The output is written to STDOUT, using a buffer of the default size.
 void context_create(struct context *const self) {
 	memset(self, 0, sizeof(struct context));
+	prng_seed(&self->random, 0);
+	self->max_depth = TURTLE_DEFAULT_MAX_DEPTH;
+	output_create(&self->output, STDOUT_FILENO, TURTLE_OUTPUT_BUFFER_SIZE);
 }
 
-// A context is destroyed by destroying its 2 trees (variables and procedures).
+// A context is destroyed by flushing its output (and the pending line of its simplification), releasing its variables and its procedures.
+// An output which couldn't be written is the error of a program which succeeded.
 int context_destroy(struct context *const ctx) {
-	bst_destroy(&ctx->variables);
-	bst_destroy(&ctx->procedures);
+	if (ctx->simplify)
+		simplify_finish(ctx->simplify, &ctx->output);
+	output_destroy(&ctx->output);
+	if (ctx->error_number == 0 && ctx->output.error_number)
+		context_output_failure(ctx);
+	free(ctx->variables);
+	free(ctx->defined);
+	free(ctx->frames);
+	ctx->variables = 0;
+	ctx->defined = 0;
+	ctx->frames = 0;
+	ctx->frame_count = ctx->frame_capacity = 0;
+	free(ctx->procedures);
+	ctx->procedures = 0;
+	free(ctx->locals);
+	ctx->locals = 0;
+	ctx->local_count = ctx->local_capacity = ctx->local_base = 0;
 	return ctx->error_number;
 }
 
-// Evaluation of an AST, with a given context.
-// The context and the AST must be free of previous errors.
+// The variables are allocated using the slot count of a resolved AST (see ast_resolve).
 // 3 variables are set here, it will be possible update their value during the program execution.
-void ast_eval(const struct ast *const self, struct context *const ctx) {
-	if (self == 0 || self->error_number || ctx->error_number)
+void context_create_variables(struct context *const self, const size_t count) {
+	self->variable_count = count;
+	self->variables = calloc(count, sizeof(double));
+	self->defined = calloc(count, sizeof(bool));
+	self->stats.allocations += 2;
+	if (self->variables == 0 || self->defined == 0) {
+		self->error_number = 1;
 		return;
+	}
 	// the ratio of the circumference of any circle to the diameter of that circle.
-	struct bst_entry *entry = bst_at(&ctx->variables, "PI");
-	entry->value.number = PI;
+	self->variables[SLOT_PI] = PI;
 	// the length of the hypotenuse of an isosceles right triangle with legs of length 1.
-	entry = bst_at(&ctx->variables, "SQRT2");
-	entry ->value.number = SQRT2;
+	self->variables[SLOT_SQRT2] = SQRT2;
 	// the positive real number that, when multiplied by itself, gives the number 3.
-	entry = bst_at(&ctx->variables, "SQRT3");
-	entry ->value.number = SQRT3;
-	ast_eval_node(ctx, self->unit);
+	self->variables[SLOT_SQRT3] = SQRT3;
+	self->defined[SLOT_PI] = self->defined[SLOT_SQRT2] = self->defined[SLOT_SQRT3] = true;
 }
 
-// This action is used, given a context to write the program output to STDOUT.
+// Evaluation of an AST, with a given context, by walking the tree.
+// The context and the AST must be free of previous errors.
+void ast_eval(const struct ast *const self, struct context *const ctx) {
+	if (self == 0 || self->error_number || ctx->error_number)
+		return;
+	context_create_variables(ctx, self->slot_count);
+	if (ctx->error_number == 0) {
+		ctx->procedures = calloc(self->proc_count + 1, sizeof(struct ast_node *));
+		++ctx->stats.allocations;
+		if (ctx->procedures == 0)
+			ctx->error_number = 1;
+	}
+	if (ctx->error_number == 0)
+		ast_eval_node(ctx, self->unit);
+}
+
+// This action is used, given a context to write the program output (to STDOUT by default).
 // It will only write something if necessary AND if no error was previously found.
 void ast_eval_write_output(struct context *ctx) {
 	if (ctx->error_number)
 		return;
+	if (ctx->memo)
+		memo_write(ctx->memo, ctx);
 	if (ctx->let.r != ctx->r || ctx->let.g != ctx->g || ctx->let.b != ctx->b) {
 		ctx->r = ctx->let.r;
 		ctx->g = ctx->let.g;
 		ctx->b = ctx->let.b;
 		++ctx->lines_printed;
-		fprintf(stdout, "Color\t%7.4f %7.4f %7.4f\n", ctx->r, ctx->g, ctx->b);
+		++ctx->stats.colors;
+		if (ctx->render)
+			render_color(ctx->render, ctx->r, ctx->g, ctx->b);
+		else if (ctx->simplify)
+			simplify_color(ctx->simplify, &ctx->output, ctx->r, ctx->g, ctx->b);
+		else
+			output_color(&ctx->output, ctx->r, ctx->g, ctx->b);
 	}
 	if (ctx->let.x != ctx->x || ctx->let.y != ctx->y) {
 		ctx->x = ctx->let.x ;
 		ctx->y = ctx->let.y ;
 		++ctx->lines_printed;
-		fputs(ctx->up ? "MoveTo\t" : "LineTo\t", stdout);
-		fprintf(stdout, "%7.4f %7.4f\n", ctx->x, ctx->y);
+		if (ctx->up)
+			++ctx->stats.moves;
+		else
+			++ctx->stats.lines;
+		if (ctx->render)
+			render_move(ctx->render, ctx->up, ctx->x, ctx->y);
+		else if (ctx->simplify)
+			simplify_move(ctx->simplify, &ctx->output, ctx->up, ctx->x, ctx->y);
+		else
+			output_move(&ctx->output, ctx->up, ctx->x, ctx->y);
+	}
+	// a closed pipe (or a client gone from the server) stops the evaluation
+	if (ctx->output.error_number)
+		context_output_failure(ctx);
+}
+
+/*
+ * Turtle actions, shared by the evaluators (the tree walker and the bytecode VM).
+ * Their arguments are already evaluated, they are doing nothing once an error was found.
+ */
+
+// The direction of the turtle is cached until its angle changes, sin and cos are computed together (a single sincos call).
+// The multiples of 90 degrees are exact, so the axis-aligned drawings have exact coordinates.
+static void context_direction(struct context *ctx) {
+	static const double quadrants[4][2] = {{0, 1}, {1, 0}, {0, -1}, {-1, 0}};
+	const double turns = fmod(ctx->angle, 360.0);
+	if (fmod(turns, 90.0) == 0.0) {
+		const int quadrant = ((int) (turns / 90.0) + 4) % 4;
+		ctx->sin_angle = quadrants[quadrant][0];
+		ctx->cos_angle = quadrants[quadrant][1];
+	} else {
+		const double radians = ctx->angle * TURTLE_DEG_TO_RAD;
+		ctx->sin_angle = sin(radians);
+		ctx->cos_angle = cos(radians);
+	}
+	ctx->direction_valid = true;
+}
+
+// This action moves the turtle forward, it calls the writer if necessary.
+void context_forward(struct context *ctx, const double value) {
+	if (value && ctx->error_number == 0) {
+		if (!ctx->direction_valid)
+			context_direction(ctx);
+		ctx->let.x -= value * ctx->sin_angle;
+		ctx->let.y -= value * ctx->cos_angle;
+		ast_eval_write_output(ctx);
+	}
+}
+
+// This action moves the turtle backward, it calls the writer if necessary.
+void context_backward(struct context *ctx, const double value) {
+	if (value && ctx->error_number == 0) {
+		if (!ctx->direction_valid)
+			context_direction(ctx);
+		ctx->let.x += value * ctx->sin_angle;
+		ctx->let.y += value * ctx->cos_angle;
+		ast_eval_write_output(ctx);
+	}
+}
+
+// In the normal case the current color is updated, but will not be written to STDOUT (a PEN move will trigger it).
+// An error is shown on stderr if anything's wrong.
+void context_color(struct context *ctx, const double r, const double g, const double b) {
+	if (ctx->error_number)
+		return;
+	ctx->let.r = r;
+	ctx->let.g = g;
+	ctx->let.b = b;
+	if (ctx->let.r < 0.0 || ctx->let.r > 1.0 || ctx->let.g < 0.0 || ctx->let.g > 1.0 || ctx->let.b < 0.0 || ctx->let.b > 1.0) {
+		const char *channel = ctx->let.r < 0.0 || ctx->let.r > 1.0 ? "RED" : ctx->let.g < 0.0 || ctx->let.g > 1.0 ? "GREEN" : "BLUE";
+		fprintf(stderr, "Color in red/green/blue format is out of range on channel %s.\nUse 3 numbers in [0, 1] or a specify a keyword (red, green, blue, cyan, magenta, yellow, black, gray, white) to use a color.", channel);
+		ctx->error_number = 7;
+	}
+}
+
+// The actions changing the angle are invalidating the cached direction.
+void context_left(struct context *ctx, const double value) {
+	if (ctx->error_number == 0) {
+		ctx->angle += value;
+		ctx->direction_valid = false;
+	}
+}
+
+void context_right(struct context *ctx, const double value) {
+	if (ctx->error_number == 0) {
+		ctx->angle -= value;
+		ctx->direction_valid = false;
+	}
+}
+
+void context_heading(struct context *ctx, const double value) {
+	if (ctx->error_number == 0) {
+		ctx->angle = -value;
+		ctx->direction_valid = false;
+	}
+}
+
+// This action updates the absolute position of the Turtle, and write the change to STDOUT.
+void context_position(struct context *ctx, const double x, const double y) {
+	if (ctx->error_number)
+		return;
+	ctx->let.x = x;
+	ctx->let.y = y;
+	ast_eval_write_output(ctx);
+}
+
+// After it every parameter is equal to zero, the color is black.
+// Any change will be written to STDOUT
+void context_home(struct context *ctx) {
+	if (ctx->error_number)
+		return;
+	ctx->angle = ctx->up = 0;
+	ctx->direction_valid = false;
+	ctx->let.r = ctx->let.g = ctx->let.b = 0;
+	ctx->let.x = ctx->let.y = 0;
+	ast_eval_write_output(ctx);
+}
+
+void context_print(struct context *ctx, const double value) {
+	if (ctx->error_number == 0)
+		fprintf(stderr, "%g\n", value);
+}
+
+// Return the number of iterations of a repeat command, given its evaluated argument.
+// There is a limit, the loop can't be longer than a very large configurable number (see TURTLE_REPEAT_MAX_ITERATIONS).
+long long int context_repeat_count(struct context *ctx, const double value) {
+	if (ctx->error_number)
+		return 0;
+	if (value > TURTLE_REPEAT_MAX_ITERATIONS) {
+		fprintf(stderr, "Command repeat %g ... failed : argument is greater than a safety limit of %lli iterations.", value, TURTLE_REPEAT_MAX_ITERATIONS);
+		ctx->error_number = 8;
+	} else if (value >= 1) {
+		return (long long int) value;
+	}
+	// negative values are doing nothing.
+	return 0;
+}
+
+// A while loop has the limit of a repeat, its condition can't be true for more iterations.
+void context_while_failure(struct context *ctx) {
+	fprintf(stderr, "Command while ... failed : the condition is still true after a safety limit of %lli iterations.", TURTLE_REPEAT_MAX_ITERATIONS);
+	ctx->error_number = 8;
+}
+
+// Report a repeat or a call that would go deeper than the limit of the context.
+void context_max_depth_failure(struct context *ctx) {
+	ctx->error_number = 13;
+	fprintf(stderr, "Maximum depth of %zu nested repeats and calls exceeded.", ctx->max_depth);
+}
+
+// Report an output which can't be written (a full disk, a closed pipe), a buffer which can't be allocated is a memory allocation error.
+void context_output_failure(struct context *ctx) {
+	if (ctx->output.error_number == ENOMEM) {
+		ctx->error_number = 1;
+		return;
+	}
+	ctx->error_number = 15;
+	fprintf(stderr, "The output can't be written : %s.", strerror(ctx->output.error_number));
+}
+
+// Report a call giving a procedure another number of arguments than its parameters.
+void context_arity_failure(struct context *ctx, const char *const name, const size_t params, const size_t args) {
+	ctx->error_number = 14;
+	fprintf(stderr, "Procedure '%s' expects %zu parameters, %zu given.", name, params, args);
+}
+
+// The locals are a stack of frames shared by the evaluators, it grows by doubling its capacity.
+// The arguments of a call are written above the current frames, which becomes the frame of the call when it's entered.
+bool context_reserve_locals(struct context *ctx, const size_t count) {
+	if (ctx->locals && ctx->local_count + count <= ctx->local_capacity)
+		return true;
+	size_t capacity = ctx->local_capacity ? 2 * ctx->local_capacity : 64;
+	while (capacity < ctx->local_count + count)
+		capacity *= 2;
+	double *const locals = realloc(ctx->locals, capacity * sizeof(double));
+	if (locals == 0) {
+		ctx->error_number = 1;
+		return false;
+	}
+	ctx->locals = locals;
+	ctx->local_capacity = capacity;
+	++ctx->stats.allocations;
+	return true;
+}
+
+size_t context_enter_locals(struct context *ctx, const size_t count) {
+	const size_t base = ctx->local_base;
+	ctx->local_base = ctx->local_count;
+	ctx->local_count += count;
+	return base;
+}
+
+void context_leave_locals(struct context *ctx, const size_t base) {
+	ctx->local_count = ctx->local_base;
+	ctx->local_base = base;
+}
+
+// Report an operator which result isn't finite, always return 0.
+double context_binop_failure(struct context *ctx, const char op, const double lhs, const double rhs, const double res) {
+	ctx->error_number = 4;
+	fprintf(stderr, "Operator '%c' failed because %g%c%g = %g isn’t finite, only integers from −2^53 to 2^53 are exactly represented.", op, lhs, op, rhs, res);
+	return 0;
+}
+
+// [ lhs=0, rhs=1 ] yield a number greater than or equal to 0 and less than or equal to 1
+double context_random(struct context *ctx, const double lhs, const double rhs) {
+	if (lhs == rhs)
+		return lhs;
+	if (lhs > rhs) {
+		ctx->error_number = 5;
+		fprintf(stderr, "Function random(%.1f, %.1f) failed the 'ordered arguments' check.", lhs, rhs);
+		return 0;
 	}
+	return prng_double(&ctx->random, lhs, rhs);
 }
 
-// This "eval" action is a simple switch that call the appropriate functions.
-// It's calling itself over the "next" node after the current node evaluation is done, so it's recursive.
+double context_sqrt(struct context *ctx, const double value) {
+	if (value < 0.0) {
+		ctx->error_number = 6;
+		fprintf(stderr, "Function sqrt(%g) failed the 'argument greater or equal than zero' check.", value);
+		return 0;
+	}
+	return sqrt(value);
+}
+
+// Push a frame on the explicit stack of the tree walker, it grows by doubling its capacity.
+// The repeats and the calls are limited by the maximum depth of the context.
+static struct ast_frame *ast_push_frame(struct context *ctx, const enum ast_frame_kind kind, struct ast_node *node) {
+	if (kind != FRAME_BLOCK) {
+		if (ctx->depth >= ctx->max_depth) {
+			context_max_depth_failure(ctx);
+			return 0;
+		}
+		if (++ctx->depth > ctx->deepest)
+			ctx->deepest = ctx->depth;
+	}
+	if (ctx->frame_count == ctx->frame_capacity) {
+		const size_t capacity = ctx->frame_capacity ? 2 * ctx->frame_capacity : 64;
+		struct ast_frame *const frames = realloc(ctx->frames, capacity * sizeof(struct ast_frame));
+		if (frames == 0) {
+			ctx->error_number = 1;
+			return 0;
+		}
+		ctx->frames = frames;
+		ctx->frame_capacity = capacity;
+		++ctx->stats.allocations;
+	}
+	struct ast_frame *const frame = ctx->frames + ctx->frame_count++;
+	frame->kind = kind;
+	frame->node = node;
+	return frame;
+}
+
+// Pop the top frame, leaving a repeat or a call.
+static void ast_pop_frame(struct context *ctx) {
+	const struct ast_frame *const frame = ctx->frames + --ctx->frame_count;
+	if (frame->kind != FRAME_BLOCK)
+		--ctx->depth;
+	if (frame->kind == FRAME_CALL) {
+		--ctx->nested_call_count;
+		context_leave_locals(ctx, frame->base);
+		if (ctx->memo)
+			memo_return(ctx->memo, ctx, ctx->depth);
+	}
+}
+
+// The condition of a while loop is evaluated after each iteration, return true when the loop goes on.
+static bool ast_eval_again(struct context *ctx, struct ast_frame *frame) {
+	const double test = ast_eval_expr(ctx, frame->body->children[0]);
+	if (ctx->error_number || test == 0.0)
+		return false;
+	if (--frame->remaining == 0) {
+		context_while_failure(ctx);
+		return false;
+	}
+	frame->node = frame->body->children[1];
+	return true;
+}
+
+// This "eval" action evaluates a sequence of commands without recursion, the frames are kept on an explicit stack.
+// The top frame gives the next command, a simple switch calls the appropriate functions.
+// Repeats, loops, blocks, branches and calls are pushing a new frame, which is popped when its sequence is done.
 void ast_eval_node(struct context *ctx, struct ast_node *node) {
 	if (node == 0 || ctx->error_number)
 		return;
-	switch (node->kind) {
-		case KIND_CMD_SIMPLE :
-			switch (node->u.cmd) {
-				case CMD_FORWARD: ast_eval_forward(ctx, node); break;
-				case CMD_BACKWARD: ast_eval_backward(ctx, node); break;
-				case CMD_UP : ast_eval_up(ctx); break;
-				case CMD_DOWN : ast_eval_down(ctx); break;
-				case CMD_COLOR : ast_eval_color(ctx, node); break;
-				case CMD_LEFT: ast_eval_left(ctx, node); break;
-				case CMD_RIGHT: ast_eval_right(ctx, node); break;
-				case CMD_HEADING: ast_eval_heading(ctx, node); break;
-				case CMD_POSITION: ast_eval_position(ctx, node); break;
-				case CMD_HOME: ast_eval_home(ctx); break;
-				case CMD_PRINT : ast_eval_print(ctx, node); break;
-			}
-			break;
-		case KIND_CMD_REPEAT : ast_eval_repeat(ctx, node); break;
-		case KIND_CMD_BLOCK : ast_eval_block(ctx, node); break;
-		case KIND_CMD_CALL : ast_eval_call(ctx, node); break;
-		case KIND_CMD_SET : ast_eval_set(ctx, node); break;
-		case KIND_CMD_PROC : ast_eval_proc(ctx, node); break;
-		default:
-			ctx->error_number = 2;
-			fprintf(stderr, "Unknown node to eval.");
+	const size_t base = ctx->frame_count;
+	if (ast_push_frame(ctx, FRAME_BLOCK, node) == 0)
+		return;
+	while (ctx->frame_count > base && ctx->error_number == 0) {
+		struct ast_frame *const frame = ctx->frames + ctx->frame_count - 1;
+		node = frame->node;
+		if (node == 0) {
+			if (frame->kind == FRAME_REPEAT && --frame->remaining)
+				frame->node = frame->body;
+			else if (frame->kind != FRAME_WHILE || !ast_eval_again(ctx, frame))
+				ast_pop_frame(ctx);
+			continue;
+		}
+		frame->node = node->next;
+		ctx->stats.commands += node->kind != KIND_CMD_BLOCK;
+		switch (node->kind) {
+			case KIND_CMD_SIMPLE :
+				switch (node->u.cmd) {
+					case CMD_FORWARD: ast_eval_forward(ctx, node); break;
+					case CMD_BACKWARD: ast_eval_backward(ctx, node); break;
+					case CMD_UP : ast_eval_up(ctx); break;
+					case CMD_DOWN : ast_eval_down(ctx); break;
+					case CMD_COLOR : ast_eval_color(ctx, node); break;
+					case CMD_LEFT: ast_eval_left(ctx, node); break;
+					case CMD_RIGHT: ast_eval_right(ctx, node); break;
+					case CMD_HEADING: ast_eval_heading(ctx, node); break;
+					case CMD_POSITION: ast_eval_position(ctx, node); break;
+					case CMD_HOME: ast_eval_home(ctx); break;
+					case CMD_PRINT : ast_eval_print(ctx, node); break;
+				}
+				break;
+			case KIND_CMD_REPEAT : ast_eval_repeat(ctx, node); break;
+			case KIND_CMD_IF : ast_eval_if(ctx, node); break;
+			case KIND_CMD_WHILE : ast_eval_while(ctx, node); break;
+			case KIND_CMD_BLOCK : ast_eval_block(ctx, node); break;
+			case KIND_CMD_CALL : ast_eval_call(ctx, node); break;
+			case KIND_CMD_SET : ast_eval_set(ctx, node); break;
+			case KIND_CMD_SET_LOCAL : ast_eval_set_local(ctx, node); break;
+			case KIND_CMD_PROC : ast_eval_proc(ctx, node); break;
+			default:
+				ctx->error_number = 2;
+				fprintf(stderr, "Unknown node to eval.");
+		}
 	}
-	if (node->next)
-		ast_eval_node(ctx, node->next);
+	// after an error, the frames are simply dropped.
+	while (ctx->frame_count > base)
+		ast_pop_frame(ctx);
 }
 
 // Evaluate an expression, many possibilities at this point :
 // - if the node is a simple value, then the value will be returned.
-// - if the node is a simple name, then the corresponding value will be retrieved in O(log N), and returned.
+// - if the node is a simple name, then the corresponding value will be retrieved from its slot in O(1), and returned.
+// - if the node is a parameter, then its value is read from the frame of the current call, it's always defined.
 // - if the node is a binary operation, both LHS and RHS are resolved recursively, and the result is returned.
+// - if the node is a comparison or a logical operator, the result is 1 or 0, "and" and "or" may not resolve their RHS.
 // - if the node is a math function, the function will be executed after resolving it's argument, and the result returned.
 
 // Error cases :
@@ -599,22 +1113,43 @@ void ast_eval_node(struct context *ctx, struct ast_node *node) {
 double ast_eval_expr(struct context *ctx, struct ast_node *node) {
 	if (node == 0 || ctx->error_number)
 		return 0;
+	// the parentheses and the unary plus are not operations, like in the bytecode
+	if (node->kind != KIND_EXPR_BLOCK && (node->kind != KIND_EXPR_UNOP || node->u.op == '-'))
+		++ctx->stats.expressions;
 	if (node->kind == KIND_EXPR_VALUE)
 		return node->u.value;
 	if (node->kind == KIND_EXPR_NAME) {
-		ctx->variables.search_only = 1;
-		struct bst_entry *entry = bst_at(&ctx->variables, node->u.bst_entry->key);
-		if (entry)
-			return entry->value.number;
+		const size_t slot = node->slot;
+		if (ctx->defined[slot])
+			return ctx->variables[slot];
 		else {
 			ctx->error_number = 3;
 			fprintf(stderr, "Unknown variable '%s'.", node->u.bst_entry->key);
 			return 0;
 		}
 	}
+	if (node->kind == KIND_EXPR_LOCAL)
+		return ctx->locals[ctx->local_base + node->slot];
+	if (node->kind == KIND_EXPR_HOISTED) {
+		// the first evaluation during the loop computes the value, the next ones are reading it.
+		const size_t slot = node->slot;
+		if (!ctx->defined[slot]) {
+			const double value = ast_eval_expr(ctx, node->children[0]);
+			if (ctx->error_number)
+				return 0;
+			ctx->variables[slot] = value;
+			ctx->defined[slot] = true;
+		}
+		return ctx->variables[slot];
+	}
+	// once an error is found, the partial results are not used anymore, so only the first error is reported.
 	double lhs = ast_eval_expr(ctx, node->children[0]);
+	if (ctx->error_number)
+		return 0;
 	if (node->kind == KIND_EXPR_BINOP) {
 		const double rhs = ast_eval_expr(ctx, node->children[1]);
+		if (ctx->error_number)
+			return 0;
 		double res;
 		switch (node->u.op) {
 			case '+' : res = lhs + rhs; break;
@@ -626,9 +1161,27 @@ double ast_eval_expr(struct context *ctx, struct ast_node *node) {
 		}
 		if (isfinite(res))
 			return res;
-		ctx->error_number = 4;
-		fprintf(stderr, "Operator '%c' failed because %g%c%g = %g isn’t finite, only integers from −2^53 to 2^53 are exactly represented.", node->u.op, lhs, node->u.op, rhs, res);
-		return 0;
+		return context_binop_failure(ctx, node->u.op, lhs, rhs, res);
+	}
+	if (node->kind == KIND_EXPR_TEST) {
+		switch (node->u.test) {
+			case TEST_NOT : return lhs == 0.0;
+			case TEST_AND : if (lhs == 0.0) return 0; break;
+			case TEST_OR : if (lhs != 0.0) return 1; break;
+			default : break;
+		}
+		const double rhs = ast_eval_expr(ctx, node->children[1]);
+		if (ctx->error_number)
+			return 0;
+		switch (node->u.test) {
+			case TEST_LT : return lhs < rhs;
+			case TEST_LE : return lhs <= rhs;
+			case TEST_EQ : return lhs == rhs;
+			case TEST_NE : return lhs != rhs;
+			case TEST_GT : return lhs > rhs;
+			case TEST_GE : return lhs >= rhs;
+			default : return rhs != 0.0; // "and" or "or", decided by its RHS
+		}
 	}
 	if (node->kind == KIND_EXPR_BLOCK)
 		return lhs;
@@ -637,27 +1190,19 @@ double ast_eval_expr(struct context *ctx, struct ast_node *node) {
 	if (node->kind == KIND_EXPR_FUNC) {
 		switch (node->u.func) {
 			case FUNC_RANDOM :;
-				double rhs = ast_eval_expr(ctx, node->children[1]);
-				if (lhs == rhs)
-					return lhs;
-				if (lhs > rhs) {
-					ctx->error_number = 5;
-					fprintf(stderr, "Function random(%.1f, %.1f) failed the 'ordered arguments' check.", lhs, rhs);
+				const double rhs = ast_eval_expr(ctx, node->children[1]);
+				if (ctx->error_number)
 					return 0;
-				}
-				return lhs + (double) rand() / (double) RAND_MAX * (rhs - lhs);
-				// [ lhs=0, rhs=1 ] yield a number greater than or equal to 0 and less than or equal to 1
+				return context_random(ctx, lhs, rhs);
 			case FUNC_COS : return cos(lhs * TURTLE_DEG_TO_RAD);
 			case FUNC_SIN : return sin(lhs * TURTLE_DEG_TO_RAD);
 			case FUNC_TAN : return tan(lhs * TURTLE_DEG_TO_RAD);
+			case FUNC_SQUARE :
+				if (isfinite(lhs * lhs))
+					return lhs * lhs;
+				return context_binop_failure(ctx, '^', lhs, 2.0, lhs * lhs);
 			case FUNC_SQRT:
-			default :
-				if (lhs < 0.0) {
-					ctx->error_number = 6;
-					fprintf(stderr, "Function sqrt(%g) failed the 'argument greater or equal than zero' check.", lhs);
-					return 0;
-				}
-				return sqrt(lhs);
+			default : return context_sqrt(ctx, lhs);
 		}
 	}
 	return 0;
@@ -667,24 +1212,14 @@ double ast_eval_expr(struct context *ctx, struct ast_node *node) {
 void ast_eval_forward(struct context *ctx, struct ast_node *node) {
 	if (node == 0 || ctx->error_number)
 		return;
-	const double value = ast_eval_expr(ctx, node->children[0]);
-	if (value) {
-		ctx->let.x -= value * sin(ctx->angle * TURTLE_DEG_TO_RAD);
-		ctx->let.y -= value * cos(ctx->angle * TURTLE_DEG_TO_RAD);
-		ast_eval_write_output(ctx);
-	}
+	context_forward(ctx, ast_eval_expr(ctx, node->children[0]));
 }
 
 // This action evaluate a "backward" node, it calls the writer if necessary.
 void ast_eval_backward(struct context *ctx, struct ast_node *node) {
 	if (node == 0 || ctx->error_number)
 		return;
-	const double value = ast_eval_expr(ctx, node->children[0]);
-	if (value) {
-		ctx->let.x += value * sin(ctx->angle * TURTLE_DEG_TO_RAD);
-		ctx->let.y += value * cos(ctx->angle * TURTLE_DEG_TO_RAD);
-		ast_eval_write_output(ctx);
-	}
+	context_backward(ctx, ast_eval_expr(ctx, node->children[0]));
 }
 
 // This action update the current state of the pen, after it the pen is UP (not writing).
@@ -699,135 +1234,177 @@ void ast_eval_down(struct context *ctx) {
 		ctx->up = false;
 }
 
-// This action evaluates a color, which must be rightly specified.
-// In the normal case the current color is updated, but will not be written to STDOUT (a PEN move will trigger it).
-// An error is shown on stderr if anything's wrong.
+// This action evaluates a color, the 3 channels are checked by context_color.
 void ast_eval_color(struct context *ctx, struct ast_node *node) {
 	if (node == 0 || ctx->error_number)
 		return;
-	ctx->let.r = ast_eval_expr(ctx, node->children[0]);
-	ctx->let.g = ast_eval_expr(ctx, node->children[1]);
-	ctx->let.b = ast_eval_expr(ctx, node->children[2]);
-	if (ctx->let.r < 0.0 || ctx->let.r > 1.0 || ctx->let.g < 0.0 || ctx->let.g > 1.0 || ctx->let.b < 0.0 || ctx->let.b > 1.0) {
-		const char *channel = ctx->let.r < 0.0 || ctx->let.r > 1.0 ? "RED" : ctx->let.g < 0.0 || ctx->let.g > 1.0 ? "GREEN" : "BLUE";
-		fprintf(stderr, "Color in red/green/blue format is out of range on channel %s.\nUse 3 numbers in [0, 1] or a specify a keyword (red, green, blue, cyan, magenta, yellow, black, gray, white) to use a color.", channel);
-		ctx->error_number = 7;
-	}
+	const double r = ast_eval_expr(ctx, node->children[0]);
+	const double g = ast_eval_expr(ctx, node->children[1]);
+	const double b = ast_eval_expr(ctx, node->children[2]);
+	context_color(ctx, r, g, b);
 }
 
 // This action simply update the current angle of the Turtle.
 void ast_eval_left(struct context *ctx, struct ast_node *node) {
 	if (node && ctx->error_number == 0)
-		ctx->angle += ast_eval_expr(ctx, node->children[0]);
+		context_left(ctx, ast_eval_expr(ctx, node->children[0]));
 }
 
 // This action simply update the current angle of the Turtle.
 void ast_eval_right(struct context *ctx, struct ast_node *node) {
 	if (node && ctx->error_number == 0)
-		ctx->angle -= ast_eval_expr(ctx, node->children[0]);
+		context_right(ctx, ast_eval_expr(ctx, node->children[0]));
 }
 
 // This action simply update the current heading of the Turtle.
 void ast_eval_heading(struct context *ctx, struct ast_node *node) {
 	if (node && ctx->error_number == 0)
-		ctx->angle = -ast_eval_expr(ctx, node->children[0]);
+		context_heading(ctx, ast_eval_expr(ctx, node->children[0]));
 }
 
 // This action updates the absolute position of the Turtle, and write the change to STDOUT.
 void ast_eval_position(struct context *ctx, struct ast_node *node) {
 	if (node == 0 || ctx->error_number)
 		return;
-	ctx->let.x = ast_eval_expr(ctx, node->children[0]);
-	ctx->let.y = ast_eval_expr(ctx, node->children[1]);
-	ast_eval_write_output(ctx);
+	const double x = ast_eval_expr(ctx, node->children[0]);
+	const double y = ast_eval_expr(ctx, node->children[1]);
+	context_position(ctx, x, y);
 }
 
 // This action reset all the PEN parameters.
-// After it every parameter is equal to zero, the color is black.
-// Any change will be written to STDOUT
 void ast_eval_home(struct context *ctx) {
-	if (ctx->error_number)
-		return;
-	ctx->angle = ctx->up = 0;
-	ctx->let.r = ctx->let.g = ctx->let.b = 0;
-	ctx->let.x = ctx->let.y = 0;
-	ast_eval_write_output(ctx);
+	context_home(ctx);
 }
 
 // This action is used for debug, its able to write the value of a node as a double.
 void ast_eval_print(struct context *ctx, struct ast_node *node) {
 	if (node == 0 || ctx->error_number)
 		return;
-	fprintf(stderr, "%g\n", ast_eval_expr(ctx, node->children[0]));
+	context_print(ctx, ast_eval_expr(ctx, node->children[0]));
 }
 
-// This action is performing a for loop for the user, executing the previously specified node at every iteration.
+// This action is performing a for loop for the user, a frame will execute the previously specified node at every iteration.
 // There is a limit, the loop can't be longer than a very large configurable number (see TURTLE_REPEAT_MAX_ITERATIONS).
 void ast_eval_repeat(struct context *ctx, struct ast_node *node) {
 	if (node == 0 || ctx->error_number) return ;
-	const double value = ast_eval_expr(ctx, node->children[0]);
-	if (ctx->error_number) return ;
-	if (value > TURTLE_REPEAT_MAX_ITERATIONS) {
-		fprintf(stderr, "Command repeat %g ... failed : argument is greater than a safety limit of %lli iterations.", value, TURTLE_REPEAT_MAX_ITERATIONS);
-		ctx->error_number = 8;
-	} else if (value < 0) {
-		// do nothing.
-	} else if (value >= 1) {
-		const long long int count = (long long int) value;
-		for (long long int i = 0 ; i < count && !ctx->error_number ; ++i) {
-			ast_eval_node(ctx, node->children[1]);
+	const long long int count = context_repeat_count(ctx, ast_eval_expr(ctx, node->children[0]));
+	if (count) {
+		// the hoisted expressions of the body are computed again by its first iteration.
+		memset(ctx->defined + node->u.hoisted.first, 0, node->u.hoisted.count * sizeof(bool));
+		struct ast_frame *const frame = ast_push_frame(ctx, FRAME_REPEAT, node->children[1]);
+		if (frame && ctx->depth - ctx->nested_call_count > ctx->stats.deepest_repeats)
+			ctx->stats.deepest_repeats = ctx->depth - ctx->nested_call_count;
+		struct motion_step steps[MOTION_STEPS_MAX];
+		size_t step_count;
+		if (frame && ctx->replay && count > 1 && (step_count = motion_flatten(node->children[1], steps))) {
+			// the frame only checked the depth, the iterations are replayed at once.
+			motion_replay(ctx, steps, step_count, count);
+			ast_pop_frame(ctx);
+		} else if (frame) {
+			frame->body = node->children[1];
+			frame->remaining = count;
 		}
 	}
 }
 
-// This action is a wrapper, is simply evaluated normally.
+// This action evaluates a condition, then the command chosen by it is evaluated by a new frame (like a block).
+void ast_eval_if(struct context *ctx, struct ast_node *node) {
+	if (node == 0 || ctx->error_number)
+		return;
+	const double test = ast_eval_expr(ctx, node->children[0]);
+	if (ctx->error_number)
+		return;
+	struct ast_node *const branch = test != 0.0 ? node->children[1] : node->children[2];
+	if (branch)
+		ast_push_frame(ctx, FRAME_BLOCK, branch);
+}
+
+// This action is performing a while loop, a frame will execute the command while the condition is true.
+// Like a repeat, there is a limit of TURTLE_REPEAT_MAX_ITERATIONS iterations, the condition is evaluated by ast_eval_again.
+void ast_eval_while(struct context *ctx, struct ast_node *node) {
+	if (node == 0 || ctx->error_number)
+		return;
+	const double test = ast_eval_expr(ctx, node->children[0]);
+	if (ctx->error_number || test == 0.0)
+		return;
+	struct ast_frame *const frame = ast_push_frame(ctx, FRAME_WHILE, node->children[1]);
+	if (frame) {
+		frame->body = node;
+		frame->remaining = TURTLE_REPEAT_MAX_ITERATIONS;
+		if (ctx->depth - ctx->nested_call_count > ctx->stats.deepest_repeats)
+			ctx->stats.deepest_repeats = ctx->depth - ctx->nested_call_count;
+	}
+}
+
+// This action is a wrapper, its commands are evaluated by a new frame.
 void ast_eval_block(struct context *ctx, struct ast_node *node) {
 	if (node == 0 || ctx->error_number)
 		return;
-	ast_eval_node(ctx, node->children[0]);
+	if (node->children[0])
+		ast_push_frame(ctx, FRAME_BLOCK, node->children[0]);
 }
 
 // This action is executing a call, the user want to call a procedure.
-// The action is searching the procedure in the context BST, the complexity of the search O(log N).
-// If found the procedure will be executed, otherwise the program will abort with an error to STDERR.
+// The call is bound to its procedure by the slot of its name (see ast_resolve), the declaration is read in O(1) from
+// the table of the context, filled by the declarations. The AST is only read, so it can be shared by many contexts.
+// The arguments are evaluated by the caller, then they are the locals of the frame of the call.
+// If declared with as many parameters the procedure will be executed by a new frame, otherwise the program will abort with an error to STDERR.
 void ast_eval_call(struct context *ctx, struct ast_node *node) {
 	if (node == 0 || ctx->error_number)
 		return;
-	ctx->procedures.search_only = 1;
-	struct bst_entry *entry = bst_at(&ctx->procedures, node->u.bst_entry->key);
-	if (entry == 0) {
+	const size_t proc_slot = node->u.bst_entry->value.parsing.proc_slot;
+	const struct ast_node *const proc = ctx->procedures[proc_slot];
+	if (proc == 0) {
 		ctx->error_number = 9;
 		fprintf(stderr, "Procedure '%s' does not exists.", node->u.bst_entry->key);
 		return;
-	} else {
-		struct ast_node *target = entry->value.node;
-		++ctx->nested_call_count;
-		ast_eval_node(ctx, target);
-		--ctx->nested_call_count;
+	}
+	if (proc->arity != node->arity) {
+		context_arity_failure(ctx, node->u.bst_entry->key, proc->arity, node->arity);
+		return;
+	}
+	if (!context_reserve_locals(ctx, node->arity))
+		return;
+	size_t local = ctx->local_count;
+	for (struct ast_node *arg = node->children[0] ; arg && ctx->error_number == 0 ; arg = arg->next)
+		ctx->locals[local++] = ast_eval_expr(ctx, arg->children[0]);
+	if (ctx->error_number)
+		return;
+	if (ctx->memo && memo_call(ctx->memo, ctx, proc_slot, ctx->depth))
+		return; // the outputs of a previous call were replayed
+	struct ast_frame *const frame = ast_push_frame(ctx, FRAME_CALL, proc->children[0]);
+	if (frame) {
+		frame->base = context_enter_locals(ctx, node->arity);
+		if (++ctx->nested_call_count > ctx->stats.deepest_calls)
+			ctx->stats.deepest_calls = ctx->nested_call_count;
 	}
 }
 
 // This action is used to create or update a variable.
-// - The variable is constructed bt bst_at or retrieved by bst_at (return a bst_entry).
+// - The variable is marked as defined in its slot, so an undefined variable reads 0 in its own expression.
 // - Then the value is resolved (maybe recursively) by ast_eval_expr (return a double).
-// - Then the double value is registered into the bst_entry for a future usage.
+// - Then the double value is registered into the slot for a future usage.
 void ast_eval_set(struct context *ctx, struct ast_node *node) {
 	if (node == 0 || ctx->error_number)
 		return;
-	ctx->variables.search_only = 0 ;
-	struct bst_entry *entry = bst_at(&ctx->variables, node->u.bst_entry->key);
-	if (entry)
-		entry ->value.number = ast_eval_expr(ctx, node->children[0]);
-	else {
-		ctx->error_number = 10;
-	}
+	const size_t slot = node->slot;
+	ctx->defined[slot] = true;
+	ctx->variables[slot] = ast_eval_expr(ctx, node->children[0]);
+}
+
+// This action updates a parameter of the current call, in its frame.
+void ast_eval_set_local(struct context *ctx, struct ast_node *node) {
+	if (node == 0 || ctx->error_number)
+		return;
+	const double value = ast_eval_expr(ctx, node->children[0]);
+	ctx->locals[ctx->local_base + node->slot] = value;
 }
 
 // This action is used to create a procedure.
-// - The procedure is constructed bt bst_at (return a bst_entry).
-// - Then the corresponding node is registered into the bst_entry for a future usage.
+// - The declaration is registered in the table of the context, at the slot of the procedure name (see ast_resolve).
+// - A declared procedure never changes, so the calls never see another body (or other parameters) for the same slot.
 // There is multiple error cases:
-// - if the procedure already exist the program will abort with a message to STDERR.
+// - if the procedure already exist a message is written to STDERR, the first declaration is kept.
 // - if the procedure is created inside another procedure the program will abort with a message to STDERR.
 void ast_eval_proc(struct context *ctx, struct ast_node *node) {
 	if (node == 0 || ctx->error_number)
@@ -837,17 +1414,12 @@ void ast_eval_proc(struct context *ctx, struct ast_node *node) {
 		fprintf(stderr, "Procedure '%s' declaration failed : nested procedure are not allowed.", node->u.bst_entry->key);
 		return;
 	}
-	ctx->procedures.search_only = 0;
-	struct bst_entry *entry = bst_at(&ctx->procedures, node->u.bst_entry->key);
-	if (entry) {
-		if (ctx->procedures.affected)
-			entry->value.node = node->children[0];
-		else
-			fprintf(stderr, "Procedure '%s' declaration failed : the procedure already exists.", node->u.bst_entry->key);
-	}
-	else {
-		ctx->error_number = 12;
-	}
+	struct ast_node **const proc = ctx->procedures + node->u.bst_entry->value.parsing.proc_slot;
+	if (*proc == 0) {
+		*proc = node;
+		++ctx->stats.procedures;
+	} else
+		fprintf(stderr, "Procedure '%s' declaration failed : the procedure already exists.", node->u.bst_entry->key);
 }
 
 /*
@@ -883,9 +1455,12 @@ void ast_print_node(struct ast_node *node) {
 			}
 			break;
 		case KIND_CMD_REPEAT : ast_print_repeat(node); break;
+		case KIND_CMD_IF : ast_print_if(node); break;
+		case KIND_CMD_WHILE : ast_print_while(node); break;
 		case KIND_CMD_BLOCK : ast_print_block(node); break;
 		case KIND_CMD_CALL : ast_print_call(node); break;
-		case KIND_CMD_SET : ast_print_set(node); break;
+		case KIND_CMD_SET :
+		case KIND_CMD_SET_LOCAL : ast_print_set(node); break;
 		case KIND_CMD_PROC : ast_print_proc(node); break;
 		default:
 			fputs("Unknown node", stderr);
@@ -901,13 +1476,34 @@ void ast_print_expr(struct ast_node *node) {
 			fprintf(stderr, "%g", node->u.value);
 			break;
 		case KIND_EXPR_NAME:
+		case KIND_EXPR_LOCAL:
 			fputs(node->u.bst_entry->key, stderr);
 			break;
+		case KIND_EXPR_HOISTED :
+			ast_print_expr(node->children[0]);
+			break;
 		case KIND_EXPR_BINOP :
 			ast_print_expr(node->children[0]);
 			fprintf(stderr, " %c ", node->u.op);
 			ast_print_expr(node->children[1]);
 			break;
+		case KIND_EXPR_TEST : {
+			static const char *const tests[] = {
+				[TEST_LT] = " < ", [TEST_LE] = " <= ", [TEST_EQ] = " == ", [TEST_NE] = " != ", [TEST_GT] = " > ",
+				[TEST_GE] = " >= ", [TEST_AND] = " and ", [TEST_OR] = " or ", [TEST_NOT] = "not ",
+			};
+			if (node->u.test == TEST_NOT) {
+				fputs(tests[TEST_NOT], stderr);
+				ast_print_expr(node->children[0]);
+				break;
+			}
+			fputc('(', stderr);
+			ast_print_expr(node->children[0]);
+			fputs(tests[node->u.test], stderr);
+			ast_print_expr(node->children[1]);
+			fputc(')', stderr);
+			break;
+		}
 		case KIND_EXPR_BLOCK :
 			ast_print_expr(node->children[0]);
 			break;
@@ -936,6 +1532,11 @@ void ast_print_expr(struct ast_node *node) {
 					fputs("tan(", stderr);
 					ast_print_expr(node->children[0]);
 					break;
+				case FUNC_SQUARE :
+					fputs("(", stderr);
+					ast_print_expr(node->children[0]);
+					fputs(") ^ 2", stderr);
+					return;
 				case FUNC_SQRT:
 				default :
 					fputs("sqrt(", stderr);
@@ -1011,6 +1612,24 @@ void ast_print_repeat(struct ast_node *node) {
 	ast_print_node(node->children[1]);
 }
 
+void ast_print_if(struct ast_node *node) {
+	fputs("if ", stderr);
+	ast_print_expr(node->children[0]);
+	fputs(" ", stderr);
+	ast_print_node(node->children[1]);
+	if (node->children[2]) {
+		fputs("else ", stderr);
+		ast_print_node(node->children[2]);
+	}
+}
+
+void ast_print_while(struct ast_node *node) {
+	fputs("while ", stderr);
+	ast_print_expr(node->children[0]);
+	fputs(" ", stderr);
+	ast_print_node(node->children[1]);
+}
+
 void ast_print_block(struct ast_node *node) {
 	fputs("{\n", stderr);
 	if (node->children[0]) {
@@ -1023,6 +1642,15 @@ void ast_print_block(struct ast_node *node) {
 void ast_print_call(struct ast_node *node) {
 	fputs("call ", stderr);
 	fputs(node->u.bst_entry->key, stderr);
+	if (node->arity) {
+		fputc('(', stderr);
+		for (struct ast_node *arg = node->children[0] ; arg ; arg = arg->next) {
+			ast_print_expr(arg->children[0]);
+			if (arg->next)
+				fputs(", ", stderr);
+		}
+		fputc(')', stderr);
+	}
 }
 
 void ast_print_set(struct ast_node *node) {
@@ -1033,6 +1661,15 @@ void ast_print_set(struct ast_node *node) {
 void ast_print_proc(struct ast_node *node) {
 	fputs("proc ", stderr);
 	fputs(node->u.bst_entry->key, stderr);
+	if (node->arity) {
+		fputc('(', stderr);
+		for (struct ast_node *param = node->children[1] ; param ; param = param->next) {
+			fputs(param->u.bst_entry->key, stderr);
+			if (param->next)
+				fputs(", ", stderr);
+		}
+		fputc(')', stderr);
+	}
 	fputc('\n', stderr);
 	ast_print_node(node->children[0]);
 }
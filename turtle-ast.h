@@ -7,40 +7,71 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <math.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "turtle-output.h"
+#include "turtle-prng.h"
+#include "turtle-stats.h"
 
 #define TURTLE_DEG_TO_RAD				0.0174532925199432957692369076848861271344287188854172545609719144
 #define TURTLE_REPEAT_MAX_ITERATIONS	140737488355328LL
+#define TURTLE_DEFAULT_MAX_DEPTH		1048576
+#define TURTLE_SOURCE_MAX				((size_t) INT_MAX - 2) // the largest source, the size of a flex buffer is an int
 
 // simple commands
 enum ast_cmd {
 	CMD_UP, CMD_DOWN, CMD_RIGHT, CMD_LEFT, CMD_HEADING, CMD_FORWARD, CMD_BACKWARD, CMD_POSITION, CMD_HOME, CMD_COLOR, CMD_PRINT,
 };
 
-// internal functions
+// internal functions, FUNC_SQUARE is not a keyword (the optimizer turns x ^ 2 into it)
 enum ast_func {
-	FUNC_COS, FUNC_RANDOM, FUNC_SIN, FUNC_SQRT, FUNC_TAN,
+	FUNC_COS, FUNC_RANDOM, FUNC_SIN, FUNC_SQRT, FUNC_TAN, FUNC_SQUARE,
+};
+
+// comparisons and logical operators, their value is 1 (true) or 0 (false), a condition is true when it's not 0
+// "and" and "or" are not evaluating their right operand when the left one gives the result, "not" has no right operand
+enum ast_test {
+	TEST_LT, TEST_LE, TEST_EQ, TEST_NE, TEST_GT, TEST_GE, TEST_AND, TEST_OR, TEST_NOT,
 };
 
 // kind of a node in the abstract syntax tree
 enum ast_kind {
 	KIND_CMD_SIMPLE, KIND_CMD_REPEAT, KIND_CMD_BLOCK, KIND_CMD_PROC, KIND_CMD_CALL, KIND_CMD_SET,
+	KIND_CMD_SET_LOCAL, // a "set" of a parameter (see ast_resolve)
+	KIND_CMD_IF, // a condition, the command evaluated when it's true, then the one evaluated otherwise (if any)
+	KIND_CMD_WHILE, // a condition evaluated before each iteration, the command repeated
+	KIND_ARG, // an argument of a call, its expression is its child, the next argument is its next node
 	KIND_EXPR_FUNC, KIND_EXPR_VALUE, KIND_EXPR_UNOP, KIND_EXPR_BINOP, KIND_EXPR_BLOCK, KIND_EXPR_NAME,
+	KIND_EXPR_HOISTED, // a loop invariant expression, its value is kept in a hidden slot (see ast_hoist)
+	KIND_EXPR_LOCAL, // a parameter read by its procedure, its slot is its index in the frame of the call
+	KIND_EXPR_TEST, // a comparison or a logical operator
 };
 
 #define AST_CHILDREN_MAX 3
 
-// a node in the abstract syntax tree
+// a node in the abstract syntax tree, allocated by the arena of its AST
 struct ast_node {
-	enum ast_kind kind; // kind of the node
+	unsigned char kind; // kind of the node (enum ast_kind)
+	unsigned char children_count;  // the number of children of the node
+	uint16_t arity; // kind == KIND_CMD_PROC or kind == KIND_CMD_CALL, the number of parameters or arguments
+	uint32_t slot; // kind == KIND_EXPR_NAME or kind == KIND_CMD_SET (or KIND_EXPR_HOISTED), the variable slot given by ast_resolve
+	               // kind == KIND_EXPR_LOCAL or kind == KIND_CMD_SET_LOCAL, the index of the parameter
+	uint32_t line; // the line of a command in its source, set by the parser (0 for an expression)
 	union {
+		struct {
+			uint32_t first;
+			uint32_t count;
+		} hoisted;          // kind == KIND_CMD_REPEAT, the hidden slots forgotten when the loop starts
 		enum ast_cmd cmd;   // kind == KIND_CMD_SIMPLE
 		double value;       // kind == KIND_EXPR_VALUE, for literals
 		char op;            // kind == KIND_EXPR_BINOP or kind == KIND_EXPR_UNOP, for operators in expressions
 		enum ast_func func; // kind == KIND_EXPR_FUNC, a function
+		enum ast_test test; // kind == KIND_EXPR_TEST, a comparison or a logical operator
 		struct bst_entry * bst_entry ; // kind == KIND_EXPR_NAME, the key of procedures and variables
 	} u;
-	size_t children_count;  // the number of children of the node
 	struct ast_node *children[AST_CHILDREN_MAX];  // the children of the node (arguments of commands, etc)
+	                                              // a declaration keeps its parameters (linked names) after its children
 	struct ast_node *next;  // the next node in the sequence
 };
 
@@ -54,6 +85,8 @@ struct bst_entry {
 		struct {
 			bool is_proc_name ;
 			bool is_var_name ;
+			size_t slot ; // index in the context variables, valid when is_var_name is set
+			size_t proc_slot ; // index of the procedure, valid when is_proc_name is set
 		} parsing;
 	} value;
 };
@@ -74,22 +107,75 @@ struct bst_manager {
 struct bst_entry *bst_at(struct bst_manager *, const char *);
 void bst_destroy(struct bst_manager *);
 
+// the nodes are allocated by chunks, they are all released at once
+struct ast_chunk {
+	struct ast_chunk *next;
+	size_t count;
+	size_t capacity;
+	struct ast_node nodes[];
+};
+
 // root of the abstract syntax tree
 struct ast {
-	struct ast_node *unit;
+	struct ast_node *unit; // the commands of the program, null when it has none (an empty program, or only comments)
+	struct ast_chunk *chunks ; // the arena of the nodes, the first chunk is the current one
+	size_t node_count ;
 	struct bst_manager parsing ;
+	size_t slot_count ; // the number of distinct variables, see ast_resolve (and the hidden slots of ast_hoist)
+	size_t proc_count ; // the number of distinct procedure names, see ast_resolve
 	int error_number ;
 };
 
+// the predefined variables are always using the first slots
+enum ast_slot {
+	SLOT_PI, SLOT_SQRT2, SLOT_SQRT3,
+};
+
+// parse a program, return 0 on success, 1 on a syntax error or 2 on memory allocation error (like yyparse)
+// a source larger than TURTLE_SOURCE_MAX is a memory allocation error, the messages are written
+// the source is followed by two null bytes, it's scanned in place (the buffer is modified while scanning)
+// the state of the scanner and the parser is local, so independent programs can be parsed concurrently
+int ast_parse(struct ast *self, char *buffer, size_t length);
+
+// scan the tokens of a program without parsing them (see turtle-bench), the buffer is given like to ast_parse
+// return the number of tokens, or -1 on an unknown token or a memory allocation error
+long long int ast_scan(struct ast *self, char *buffer, size_t length);
+
+// give each distinct variable and procedure name a dense index, must be called once before evaluation
+void ast_resolve(struct ast *self);
+
 // do not forget to destroy properly! no leaks allowed!
 void ast_destroy(struct ast *self);
 
+// kind of a frame of the tree walker
+enum ast_frame_kind {
+	FRAME_BLOCK, FRAME_REPEAT, FRAME_WHILE, FRAME_CALL,
+};
+
+// a frame of the tree walker, it evaluates a sequence of commands
+struct ast_frame {
+	struct ast_node *node; // the next command to evaluate, the frame ends with a null node
+	struct ast_node *body; // kind == FRAME_REPEAT, the command repeated (kind == FRAME_WHILE, the loop)
+	long long int remaining; // kind == FRAME_REPEAT, the iterations left including the current one (FRAME_WHILE, the ones allowed)
+	size_t base; // kind == FRAME_CALL, the first local of the caller (see context_enter_locals)
+	enum ast_frame_kind kind;
+};
+
+struct memo;
+struct simplify;
+struct render;
+struct profile;
+
 // the execution context
 struct context {
 	double x;
 	double y;
 	double angle;
+	double sin_angle; // the cached direction of the turtle, valid when direction_valid is set
+	double cos_angle;
+	bool direction_valid;
 	bool up;
+	bool replay; // the geometry only loops are replayed from their first iteration (see turtle-motion.h)
 	double r;
 	double g;
 	double b;
@@ -101,9 +187,28 @@ struct context {
 		double x;
 	} let ;
 	size_t lines_printed ;
+	struct prng random ; // the generator of the function random, each context has its own (see turtle-prng.h)
 	size_t nested_call_count;
-	struct bst_manager variables ;
-	struct bst_manager procedures ;
+	size_t depth ; // the number of nested repeats and calls being evaluated
+	size_t max_depth ; // the depth limit, reaching it is an error
+	size_t deepest ; // the deepest nesting reached, used by the memoization of the procedures
+	struct memo *memo ; // the memoization of the procedures, when enabled (see turtle-memo.h)
+	struct ast_frame *frames ; // the explicit stack of the tree walker
+	size_t frame_count ;
+	size_t frame_capacity ;
+	double *variables ; // values indexed by the slots of the AST
+	bool *defined ; // tell whether a slot has been assigned by the program
+	size_t variable_count ;
+	struct ast_node **procedures ; // the declarations of the tree walker indexed by the procedure slots of the AST, null until declared
+	double *locals ; // the parameters of the calls in progress, each call has a frame of fixed size slots
+	size_t local_count ;
+	size_t local_capacity ;
+	size_t local_base ; // the frame of the current call, its parameters are locals[local_base + index]
+	struct output output ; // the drawing instructions are written here
+	struct simplify *simplify ; // the simplification of the output, when enabled (see turtle-simplify.h)
+	struct render *render ; // the rasterizer replacing the output, when enabled (see turtle-render.h)
+	struct profile *profile ; // the profile of the VM, when enabled (see turtle-profile.h)
+	struct stats stats ; // the counters of the evaluation, always kept (see turtle-stats.h)
 	int error_number ;
 };
 
@@ -113,38 +218,72 @@ int context_destroy(struct context *ctx);
 // create an initial context
 void context_create(struct context *self);
 
+// allocate the variables of a resolved AST and define PI, SQRT2 and SQRT3
+void context_create_variables(struct context *self, size_t count);
+
+// the turtle actions shared by the evaluators, their arguments are already evaluated
+void context_forward(struct context *ctx, double value);
+void context_backward(struct context *ctx, double value);
+void context_color(struct context *ctx, double r, double g, double b);
+void context_left(struct context *ctx, double value);
+void context_right(struct context *ctx, double value);
+void context_heading(struct context *ctx, double value);
+void context_position(struct context *ctx, double x, double y);
+void context_home(struct context *ctx);
+void context_print(struct context *ctx, double value);
+long long int context_repeat_count(struct context *ctx, double value);
+void context_while_failure(struct context *ctx);
+void context_max_depth_failure(struct context *ctx);
+void context_output_failure(struct context *ctx);
+void context_arity_failure(struct context *ctx, const char *name, size_t params, size_t args);
+
+// the frames of the parameters, the arguments of a call are written after local_count before entering it
+// reserve returns false on memory allocation error, enter returns the base to give back to leave
+bool context_reserve_locals(struct context *ctx, size_t count);
+size_t context_enter_locals(struct context *ctx, size_t count);
+void context_leave_locals(struct context *ctx, size_t base);
+double context_binop_failure(struct context *ctx, char op, double lhs, double rhs, double res);
+double context_random(struct context *ctx, double lhs, double rhs);
+double context_sqrt(struct context *ctx, double value);
+
 // print the tree as if it was a Turtle program
 void ast_print(const struct ast *self);
 
 // evaluate the tree and generate some basic primitives
 void ast_eval(const struct ast *self, struct context *ctx);
 
-struct ast_node * make_forward(struct ast_node * expr);
-struct ast_node * make_backward(struct ast_node * expr);
-struct ast_node * make_up();
-struct ast_node * make_down();
-struct ast_node * make_color(unsigned long long int number);
-struct ast_node * make_raw_color(struct ast_node * expr_r, struct ast_node * expr_g, struct ast_node * expr_b);
-struct ast_node * make_left(struct ast_node * expr);
-struct ast_node * make_right(struct ast_node * expr);
-struct ast_node * make_heading(struct ast_node * expr);
-struct ast_node * make_position(struct ast_node * expr_x, struct ast_node * expr_y);
-struct ast_node * make_home();
-struct ast_node * make_print(struct ast_node * expr);
-struct ast_node * make_repeat(struct ast_node * expr_count, struct ast_node * to_repeat);
-struct ast_node * make_cmds_block(struct ast_node * to_block);
-struct ast_node * make_call(struct bst_entry * entry);
-struct ast_node * make_set(struct bst_entry * entry, struct ast_node *expr);
-struct ast_node * make_proc(struct bst_entry * entry, struct ast_node *root);
-struct ast_node * make_value(double value);
-struct ast_node * make_name(struct bst_entry * entry);
-struct ast_node * make_math_func(enum ast_func func, struct ast_node * expr);
-struct ast_node * make_random(struct ast_node * expr_low, struct ast_node * expr_high);
-struct ast_node * make_expr_block(struct ast_node * to_block);
-struct ast_node * make_binop(char op, struct ast_node * lhs, struct ast_node * rhs);
-struct ast_node * make_unop(char op, struct ast_node * expr);
+struct ast_node * make_forward(struct ast *self, struct ast_node * expr);
+struct ast_node * make_backward(struct ast *self, struct ast_node * expr);
+struct ast_node * make_up(struct ast *self);
+struct ast_node * make_down(struct ast *self);
+struct ast_node * make_color(struct ast *self, unsigned long long int number);
+struct ast_node * make_raw_color(struct ast *self, struct ast_node * expr_r, struct ast_node * expr_g, struct ast_node * expr_b);
+struct ast_node * make_left(struct ast *self, struct ast_node * expr);
+struct ast_node * make_right(struct ast *self, struct ast_node * expr);
+struct ast_node * make_heading(struct ast *self, struct ast_node * expr);
+struct ast_node * make_position(struct ast *self, struct ast_node * expr_x, struct ast_node * expr_y);
+struct ast_node * make_home(struct ast *self);
+struct ast_node * make_print(struct ast *self, struct ast_node * expr);
+struct ast_node * make_repeat(struct ast *self, struct ast_node * expr_count, struct ast_node * to_repeat);
+struct ast_node * make_if(struct ast *self, struct ast_node * expr_test, struct ast_node * if_true, struct ast_node * if_false);
+struct ast_node * make_while(struct ast *self, struct ast_node * expr_test, struct ast_node * to_repeat);
+struct ast_node * make_cmds_block(struct ast *self, struct ast_node * to_block);
+struct ast_node * make_call(struct ast *self, struct bst_entry * entry, struct ast_node *args);
+struct ast_node * make_set(struct ast *self, struct bst_entry * entry, struct ast_node *expr);
+struct ast_node * make_proc(struct ast *self, struct bst_entry * entry, struct ast_node *params, struct ast_node *root);
+struct ast_node * make_value(struct ast *self, double value);
+struct ast_node * make_name(struct ast *self, struct bst_entry * entry);
+struct ast_node * make_arg(struct ast *self, struct ast_node * expr);
+struct ast_node * make_math_func(struct ast *self, enum ast_func func, struct ast_node * expr);
+struct ast_node * make_random(struct ast *self, struct ast_node * expr_low, struct ast_node * expr_high);
+struct ast_node * make_expr_block(struct ast *self, struct ast_node * to_block);
+struct ast_node * make_binop(struct ast *self, char op, struct ast_node * lhs, struct ast_node * rhs);
+struct ast_node * make_unop(struct ast *self, char op, struct ast_node * expr);
+struct ast_node * make_test(struct ast *self, enum ast_test test, struct ast_node * lhs, struct ast_node * rhs);
+struct ast_node * make_hoisted(struct ast *self, uint32_t slot, struct ast_node * expr);
 
 void ast_eval_node(struct context *ctx, struct ast_node *node);
+void ast_eval_write_output(struct context *ctx);
 double ast_eval_expr(struct context *ctx, struct ast_node *node);
 void ast_eval_forward(struct context *ctx, struct ast_node *node);
 void ast_eval_backward(struct context *ctx, struct ast_node *node);
@@ -158,9 +297,12 @@ void ast_eval_position(struct context *ctx, struct ast_node *node);
 void ast_eval_home(struct context *ctx);
 void ast_eval_print(struct context *ctx, struct ast_node *node);
 void ast_eval_repeat(struct context *ctx, struct ast_node *node);
+void ast_eval_if(struct context *ctx, struct ast_node *node);
+void ast_eval_while(struct context *ctx, struct ast_node *node);
 void ast_eval_block(struct context *ctx, struct ast_node *node);
 void ast_eval_call(struct context *ctx, struct ast_node *node);
 void ast_eval_set(struct context *ctx, struct ast_node *node);
+void ast_eval_set_local(struct context *ctx, struct ast_node *node);
 void ast_eval_proc(struct context *ctx, struct ast_node *node);
 
 void ast_print_node(struct ast_node *node);
@@ -177,6 +319,8 @@ void ast_print_position(struct ast_node *node);
 void ast_print_home();
 void ast_print_print(struct ast_node *node);
 void ast_print_repeat(struct ast_node *node);
+void ast_print_if(struct ast_node *node);
+void ast_print_while(struct ast_node *node);
 void ast_print_block(struct ast_node *node);
 void ast_print_call(struct ast_node *node);
 void ast_print_set(struct ast_node *node);
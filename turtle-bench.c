@@ -0,0 +1,549 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "turtle-run.h"
+#include "turtle-vm.h"
+#include "turtle-optimizer.h"
+#include "turtle-profile.h"
+
+// This tool measures the phases of the interpreter, each one is run a few times and its best time is kept :
+// - lex (ast_scan), parse (ast_parse without its lexing), compile (folding, resolution, hoisting and bytecode),
+// - eval, the evaluation writing nothing (OUTPUT_NONE), and output, the time added by the text format written to
+//   /dev/null, the commands evaluated are counted by a profiled run (see turtle-profile.h),
+// on the bundled programs or on given ones, and on synthetic programs of any size :
+// - straight:N, N commands without a loop (in blocks of BENCH_BLOCK commands, like variables:N),
+// - recursion:N, a procedure calling itself N times (the depth isn't limited),
+// - variables:N, N distinct variables, each one computed from the previous one,
+// - repeat:N, a loop of N iterations computing its turn from a variable.
+// Then some microbenchmarks are timing bst_at, ast_eval_expr and ast_eval_write_output.
+// Example : ./turtle-bench --json=before.json, then ./turtle-bench --json=after.json with another build.
+
+#ifndef TURTLE_BENCH_DIR
+#define TURTLE_BENCH_DIR "." // the directory of the bundled programs, given by CMake
+#endif
+
+#define BENCH_REPEAT_DEFAULT	5
+#define BENCH_MICRO_OPERATIONS	1000000
+#define BENCH_MICRO_KEYS		65536
+#define BENCH_BLOCK				1000 // the commands of a list are stacked by the parser (YYMAXDEPTH), long lists are cut in blocks
+
+static const char *const bench_bundled[] = {
+	"my-fougeres.turtle", "my-logo.turtle", "my-t-square-1.turtle", "my-t-square-2.turtle", "my-t-square-3.turtle",
+	"my-triangle-sierpinski.turtle",
+};
+
+static const char *const bench_synthetic[] = {
+	"straight:100000", "recursion:10000", "variables:10000", "repeat:1000000",
+};
+
+// a program followed by two null bytes (see ast_parse)
+struct bench_source {
+	const char *name;
+	char *bytes;
+	size_t length;
+	size_t capacity;
+};
+
+struct bench_result {
+	const char *name;
+	size_t bytes;
+	long long int tokens;
+	size_t nodes;
+	unsigned long long int commands;
+	size_t lines;
+	double lex; // the best times, in seconds
+	double parse;
+	double compile;
+	double eval;
+	double output;
+	int error_number;
+};
+
+struct bench_micro {
+	const char *name;
+	size_t operations;
+	double time;
+};
+
+struct bench_options {
+	enum engine engine;
+	size_t repeat;
+	int null_fd; // /dev/null, where the text format is written
+};
+
+static int usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--repeat=N] [--engine=vm|tree] [--json=FILE] [--no-micro] [--generate=KIND:SIZE ...] [program.turtle ...]\n", name);
+	fprintf(stderr, "       %s --print=KIND:SIZE\n", name);
+	fprintf(stderr, "The kinds of the synthetic programs are straight, recursion, variables and repeat.\n");
+	return EXIT_FAILURE;
+}
+
+// the clock of the stats, in seconds
+static double bench_clock(void) {
+	return (double) stats_clock() / 1e9;
+}
+
+/*
+ * sources
+ */
+
+// Make room for some bytes followed by the two null bytes, the source grows by doubling its capacity.
+static bool bench_reserve(struct bench_source *const source, const size_t count) {
+	if (source->length + count + 2 <= source->capacity)
+		return true;
+	size_t capacity = source->capacity ? 2 * source->capacity : 65536;
+	while (capacity < source->length + count + 2)
+		capacity *= 2;
+	char *const bytes = realloc(source->bytes, capacity);
+	if (bytes == 0)
+		return false;
+	source->bytes = bytes;
+	source->capacity = capacity;
+	return true;
+}
+
+// Append some formatted text, return false on memory allocation error.
+static bool bench_printf(struct bench_source *const source, const char *const format, ...) {
+	va_list args;
+	va_start(args, format);
+	int count = vsnprintf(0, 0, format, args);
+	va_end(args);
+	if (count < 0 || !bench_reserve(source, (size_t) count))
+		return false;
+	va_start(args, format);
+	count = vsnprintf(source->bytes + source->length, (size_t) count + 1, format, args);
+	va_end(args);
+	source->length += (size_t) count;
+	source->bytes[source->length + 1] = 0;
+	return true;
+}
+
+// Write a synthetic program given by "KIND:SIZE", return false when it's unknown or on memory allocation error.
+static bool bench_generate(struct bench_source *const source, const char *const name) {
+	memset(source, 0, sizeof(struct bench_source));
+	source->name = name;
+	const char *const colon = strchr(name, ':');
+	char *end = 0;
+	const unsigned long long int size = colon ? strtoull(colon + 1, &end, 10) : 0;
+	if (colon == 0 || end == colon + 1 || *end || size == 0)
+		return false;
+	const size_t kind = (size_t) (colon - name);
+	bool ok = bench_printf(source, "");
+	if (kind == 8 && strncmp(name, "straight", kind) == 0) {
+		for (unsigned long long int i = 0 ; ok && i < size ; ++i) {
+			ok = (i % BENCH_BLOCK || bench_printf(source, i ? "}\n{\n" : "{\n"))
+				&& (i % 2 ? bench_printf(source, "rt %llu\n", 1 + i % 7 * 13) : bench_printf(source, "fw %llu\n", 1 + i % 17));
+		}
+		ok = ok && bench_printf(source, "}\n");
+	} else if (kind == 9 && strncmp(name, "recursion", kind) == 0) {
+		// 2 * D / (D + 1) is 1 while D is positive, 0 after
+		ok = ok && bench_printf(source, "set D %llu\nproc R {\n\tfw 1\n\trt 1\n\tset D D - 1\n\trepeat 2 * D / (D + 1) { call R }\n}\ncall R\n", size);
+	} else if (kind == 9 && strncmp(name, "variables", kind) == 0) {
+		ok = ok && bench_printf(source, "{\nset V0 1\n");
+		for (unsigned long long int i = 1 ; ok && i < size ; ++i) {
+			ok = (i % BENCH_BLOCK || bench_printf(source, "}\n{\n"))
+				&& bench_printf(source, "set V%llu V%llu + %llu\n", i, i - 1, i % 10);
+		}
+		ok = ok && bench_printf(source, "}\n");
+		for (unsigned long long int i = 0 ; ok && i < size ; i += 1 + size / 100)
+			ok = bench_printf(source, "fw V%llu / V%llu\nrt 7\n", i, size - 1);
+	} else if (kind == 6 && strncmp(name, "repeat", kind) == 0) {
+		ok = ok && bench_printf(source, "set A 0\nrepeat %llu {\n\tset A A + 1\n\tfw 1\n\trt A / 1000\n}\n", size);
+	} else
+		ok = false;
+	return ok;
+}
+
+// Read a program, return false when it can't be read (the message is written).
+static bool bench_read(struct bench_source *const source, const char *const path) {
+	memset(source, 0, sizeof(struct bench_source));
+	source->name = path;
+	FILE *const file = fopen(path, "rb");
+	int error = file ? 0 : errno;
+	while (error == 0) {
+		if (!bench_reserve(source, 65536)) {
+			error = ENOMEM;
+			break;
+		}
+		const size_t count = fread(source->bytes + source->length, 1, source->capacity - source->length - 2, file);
+		source->length += count;
+		if (count == 0 && ferror(file))
+			error = EIO;
+		else if (count == 0)
+			break;
+	}
+	if (file)
+		fclose(file);
+	if (error) {
+		fprintf(stderr, "The program '%s' can't be read : %s.\n", path, strerror(error));
+		return false;
+	}
+	source->bytes[source->length] = source->bytes[source->length + 1] = 0;
+	return true;
+}
+
+/*
+ * phases
+ */
+
+static double bench_min(const double a, const double b) {
+	return a < b ? a : b;
+}
+
+// Parse and prepare a copy of the source like run_parse_source, compile it for the VM, return the error of the parser.
+static int bench_prepare(const struct bench_source *const source, char *const copy, struct ast *const root, struct vm_program *const program, struct profile *const profile, double *const parse, double *const compile) {
+	memcpy(copy, source->bytes, source->length + 2);
+	memset(root, 0, sizeof(struct ast));
+	memset(program, 0, sizeof(struct vm_program));
+	const double start = bench_clock();
+	int ret = ast_parse(root, copy, source->length);
+	const double parsed = bench_clock();
+	if (ret == 0) {
+		ast_fold(root);
+		ast_resolve(root);
+		ast_hoist(root);
+		ret = root->error_number;
+	}
+	if (ret == 0 && (profile == 0 || (ret = profile_create(profile, root)) == 0))
+		ret = vm_compile(program, root, profile);
+	*parse = parsed - start;
+	*compile = bench_clock() - parsed;
+	return ret;
+}
+
+// Evaluate a prepared program writing a format to /dev/null, return the error number of the evaluator.
+static int bench_eval(const struct bench_options *const options, const struct ast *const root, const struct vm_program *const program, const enum output_format format, struct profile *const profile, double *const time, size_t *const lines) {
+	struct context ctx;
+	context_create(&ctx);
+	ctx.max_depth = SIZE_MAX; // the synthetic recursion is as deep as it is asked
+	output_create(&ctx.output, options->null_fd, TURTLE_OUTPUT_BUFFER_SIZE);
+	ctx.output.format = format;
+	ctx.profile = profile;
+	const double start = bench_clock();
+	if (profile)
+		profile_start(profile);
+	if (options->engine == ENGINE_TREE && profile == 0)
+		ast_eval(root, &ctx);
+	else
+		vm_eval(program, &ctx);
+	const int ret = context_destroy(&ctx);
+	*time = bench_clock() - start;
+	*lines = ctx.lines_printed;
+	return ret;
+}
+
+// The phases of a program, run options->repeat times each, the errors are the ones of turtle.
+static void bench_program(const struct bench_options *const options, const struct bench_source *const source, struct bench_result *const result) {
+	memset(result, 0, sizeof(struct bench_result));
+	result->name = source->name;
+	result->bytes = source->length;
+	result->lex = result->parse = result->compile = result->eval = result->output = HUGE_VAL;
+	char *const copy = malloc(source->length + 2);
+	if (copy == 0) {
+		result->error_number = 1;
+		return;
+	}
+	double parse = HUGE_VAL, total = HUGE_VAL;
+	for (size_t i = 0 ; i < options->repeat && result->error_number == 0 ; ++i) {
+		struct ast root = {0};
+		memcpy(copy, source->bytes, source->length + 2);
+		const double start = bench_clock();
+		result->tokens = ast_scan(&root, copy, source->length);
+		result->lex = bench_min(result->lex, bench_clock() - start);
+		ast_destroy(&root);
+		if (result->tokens < 0)
+			result->error_number = EXIT_FAILURE;
+	}
+	// the parser is lexing the source, the time of the lexer is removed from its time
+	struct ast root = {0};
+	struct vm_program program = {0};
+	for (size_t i = 0 ; i < options->repeat && result->error_number == 0 ; ++i) {
+		double parsed, compiled;
+		vm_destroy(&program);
+		ast_destroy(&root);
+		result->error_number = bench_prepare(source, copy, &root, &program, 0, &parsed, &compiled);
+		parse = bench_min(parse, parsed);
+		result->compile = bench_min(result->compile, compiled);
+	}
+	result->nodes = root.node_count;
+	result->parse = parse > result->lex ? parse - result->lex : 0;
+	for (size_t i = 0 ; i < options->repeat && result->error_number == 0 ; ++i) {
+		double time;
+		result->error_number = bench_eval(options, &root, &program, OUTPUT_NONE, 0, &time, &result->lines);
+		result->eval = bench_min(result->eval, time);
+	}
+	for (size_t i = 0 ; i < options->repeat && result->error_number == 0 ; ++i) {
+		double time;
+		result->error_number = bench_eval(options, &root, &program, OUTPUT_TEXT, 0, &time, &result->lines);
+		total = bench_min(total, time);
+	}
+	result->output = total > result->eval ? total - result->eval : 0;
+	vm_destroy(&program);
+	ast_destroy(&root);
+	// the commands are counted by the profiled code, whatever the engine
+	if (result->error_number == 0) {
+		struct profile profile = {0};
+		double parsed, compiled, time;
+		size_t lines;
+		result->error_number = bench_prepare(source, copy, &root, &program, &profile, &parsed, &compiled);
+		if (result->error_number == 0)
+			result->error_number = bench_eval(options, &root, &program, OUTPUT_NONE, &profile, &time, &lines);
+		for (size_t i = 0 ; i < profile.site_count ; ++i)
+			result->commands += profile.sites[i].count;
+		profile_destroy(&profile);
+		vm_destroy(&program);
+		ast_destroy(&root);
+	}
+	free(copy);
+}
+
+/*
+ * microbenchmarks
+ */
+
+// The keys are inserted into an empty tree, then they are searched until the number of operations is reached.
+static int bench_bst(struct bench_micro *const insert, struct bench_micro *const lookup) {
+	char (*const keys)[16] = malloc(BENCH_MICRO_KEYS * sizeof(*keys));
+	if (keys == 0)
+		return 1;
+	for (size_t i = 0 ; i < BENCH_MICRO_KEYS ; ++i)
+		sprintf(keys[i], "K%zu", (i * 40503) % BENCH_MICRO_KEYS); // not in the order of the tree
+	struct bst_manager manager = {0};
+	int ret = 0;
+	double start = bench_clock();
+	for (size_t i = 0 ; i < BENCH_MICRO_KEYS && ret == 0 ; ++i)
+		if (bst_at(&manager, keys[i]) == 0)
+			ret = 1;
+	*insert = (struct bench_micro) {"bst_at insert", BENCH_MICRO_KEYS, bench_clock() - start};
+	manager.search_only = 1;
+	size_t found = 0;
+	start = bench_clock();
+	for (size_t i = 0 ; i < BENCH_MICRO_OPERATIONS && ret == 0 ; ++i)
+		found += bst_at(&manager, keys[(i * 7) % BENCH_MICRO_KEYS]) != 0;
+	*lookup = (struct bench_micro) {"bst_at lookup", BENCH_MICRO_OPERATIONS, bench_clock() - start};
+	bst_destroy(&manager);
+	free(keys);
+	return ret || found != BENCH_MICRO_OPERATIONS;
+}
+
+// An expression reading variables and calling a function, evaluated by the tree walker.
+static int bench_expr(struct bench_micro *const micro, const int null_fd) {
+	char source[] = "set X 1.5\nset Y 2.5\nset Z 3\nfw X * 2 + sin(Y) - 3 / Z ^ 2 + (X - Y) * Z\n\0";
+	struct ast root = {0};
+	int ret = ast_parse(&root, source, strlen(source));
+	struct context ctx;
+	context_create(&ctx);
+	output_create(&ctx.output, null_fd, TURTLE_OUTPUT_BUFFER_SIZE);
+	ctx.output.format = OUTPUT_NONE;
+	if (ret == 0) {
+		ast_resolve(&root);
+		ast_eval(&root, &ctx);
+		ret = ctx.error_number;
+	}
+	if (ret == 0) {
+		struct ast_node *node = root.unit;
+		while (node->next)
+			node = node->next;
+		volatile double sum = 0;
+		const double start = bench_clock();
+		for (size_t i = 0 ; i < BENCH_MICRO_OPERATIONS ; ++i)
+			sum += ast_eval_expr(&ctx, node->children[0]);
+		*micro = (struct bench_micro) {"ast_eval_expr", BENCH_MICRO_OPERATIONS, bench_clock() - start};
+		ret = ctx.error_number;
+	}
+	context_destroy(&ctx);
+	ast_destroy(&root);
+	return ret;
+}
+
+// The turtle moves between two points, each call writes a LineTo in the text format to /dev/null.
+static int bench_write_output(struct bench_micro *const micro, const int null_fd) {
+	struct context ctx;
+	context_create(&ctx);
+	output_create(&ctx.output, null_fd, TURTLE_OUTPUT_BUFFER_SIZE);
+	const double start = bench_clock();
+	for (size_t i = 0 ; i < BENCH_MICRO_OPERATIONS ; ++i) {
+		ctx.let.x = i & 1 ? 12.5 : -301.0625;
+		ctx.let.y = (double) (i % 1000) / 8;
+		ast_eval_write_output(&ctx);
+	}
+	const int ret = context_destroy(&ctx);
+	*micro = (struct bench_micro) {"ast_eval_write_output", ctx.lines_printed, bench_clock() - start};
+	return ret || ctx.output.error_number;
+}
+
+/*
+ * reports
+ */
+
+static void bench_report(const struct bench_result *const results, const size_t result_count, const struct bench_micro *const micros, const size_t micro_count) {
+	printf("%-28s %10s %10s %10s %9s %9s %9s %9s %9s %13s %13s\n", "program", "bytes", "tokens", "nodes", "lex ms", "parse ms", "comp. ms", "eval ms", "out. ms", "commands/s", "lines/s");
+	for (size_t i = 0 ; i < result_count ; ++i) {
+		const struct bench_result *const r = results + i;
+		if (r->error_number) {
+			printf("%-28s failed with the error %d\n", r->name, r->error_number);
+			continue;
+		}
+		printf("%-28s %10zu %10lld %10zu %9.3f %9.3f %9.3f %9.3f %9.3f %13.0f %13.0f\n", r->name, r->bytes, r->tokens, r->nodes,
+			r->lex * 1e3, r->parse * 1e3, r->compile * 1e3, r->eval * 1e3, r->output * 1e3,
+			r->eval > 0 ? (double) r->commands / r->eval : 0, r->output > 0 ? (double) r->lines / r->output : 0);
+	}
+	if (micro_count)
+		printf("\n%-28s %10s %12s\n", "microbenchmark", "operations", "ns/op");
+	for (size_t i = 0 ; i < micro_count ; ++i)
+		printf("%-28s %10zu %12.2f\n", micros[i].name, micros[i].operations, micros[i].time * 1e9 / (double) micros[i].operations);
+}
+
+// The names of the programs are paths or synthetic names, the characters needing an escape are escaped.
+static void bench_json_string(FILE *const file, const char *text) {
+	fputc('"', file);
+	for (; *text ; ++text) {
+		if (*text == '"' || *text == '\\')
+			fprintf(file, "\\%c", *text);
+		else if ((unsigned char) *text < 0x20)
+			fprintf(file, "\\u%04x", (unsigned char) *text);
+		else
+			fputc(*text, file);
+	}
+	fputc('"', file);
+}
+
+// Return 0 on success or an errno value.
+static int bench_json(const char *const path, const struct bench_options *const options, const struct bench_result *const results, const size_t result_count, const struct bench_micro *const micros, const size_t micro_count) {
+	FILE *const file = fopen(path, "w");
+	if (file == 0)
+		return errno;
+	errno = 0;
+	fprintf(file, "{\"engine\": \"%s\", \"repeat\": %zu,\n\"programs\": [", options->engine == ENGINE_TREE ? "tree" : "vm", options->repeat);
+	for (size_t i = 0 ; i < result_count ; ++i) {
+		const struct bench_result *const r = results + i;
+		fprintf(file, "%s\n{\"name\": ", i ? "," : "");
+		bench_json_string(file, r->name);
+		if (r->error_number)
+			fprintf(file, ", \"error\": %d}", r->error_number);
+		else
+			fprintf(file, ", \"bytes\": %zu, \"tokens\": %lld, \"nodes\": %zu, \"commands\": %llu, \"lines\": %zu, \"lex\": %.9f, \"parse\": %.9f, \"compile\": %.9f, \"eval\": %.9f, \"output\": %.9f}",
+				r->bytes, r->tokens, r->nodes, r->commands, r->lines, r->lex, r->parse, r->compile, r->eval, r->output);
+	}
+	fprintf(file, "],\n\"microbenchmarks\": [");
+	for (size_t i = 0 ; i < micro_count ; ++i)
+		fprintf(file, "%s\n{\"name\": \"%s\", \"operations\": %zu, \"time\": %.9f}", i ? "," : "", micros[i].name, micros[i].operations, micros[i].time);
+	fprintf(file, "]}\n");
+	int error = ferror(file) ? (errno ? errno : EIO) : 0;
+	if (fclose(file) && error == 0)
+		error = errno;
+	return error;
+}
+
+int main(int argc, char *argv[]) {
+	struct bench_options options = {.engine = ENGINE_VM, .repeat = BENCH_REPEAT_DEFAULT};
+	const char *json_path = 0;
+	bool micro = true;
+	// the synthetic programs of the command line, or the default ones
+	const char **generated = calloc((size_t) argc + sizeof(bench_synthetic) / sizeof(*bench_synthetic), sizeof(const char *));
+	size_t generated_count = 0;
+	int first_program = argc;
+	char *end;
+	if (generated == 0)
+		return EXIT_FAILURE;
+	for (int i = 1 ; i < argc && first_program == argc ; ++i) {
+		if (strncmp(argv[i], "--repeat=", 9) == 0) {
+			options.repeat = strtoull(argv[i] + 9, &end, 10);
+			if (*end || end == argv[i] + 9 || options.repeat == 0)
+				return usage(argv[0]);
+		} else if (strcmp(argv[i], "--engine=vm") == 0)
+			options.engine = ENGINE_VM;
+		else if (strcmp(argv[i], "--engine=tree") == 0)
+			options.engine = ENGINE_TREE;
+		else if (strncmp(argv[i], "--json=", 7) == 0 && argv[i][7])
+			json_path = argv[i] + 7;
+		else if (strcmp(argv[i], "--no-micro") == 0)
+			micro = false;
+		else if (strncmp(argv[i], "--generate=", 11) == 0)
+			generated[generated_count++] = argv[i] + 11;
+		else if (strncmp(argv[i], "--print=", 8) == 0) {
+			struct bench_source source;
+			const bool ok = bench_generate(&source, argv[i] + 8);
+			if (ok)
+				fwrite(source.bytes, 1, source.length, stdout);
+			free(source.bytes);
+			free(generated);
+			return ok ? 0 : usage(argv[0]);
+		} else if (strncmp(argv[i], "--", 2) == 0)
+			return usage(argv[0]);
+		else
+			first_program = i;
+	}
+	// without programs, the bundled ones are measured, then the default synthetic ones
+	const bool defaults = first_program == argc && generated_count == 0;
+	const size_t bundled_count = sizeof(bench_bundled) / sizeof(*bench_bundled);
+	const size_t synthetic_count = sizeof(bench_synthetic) / sizeof(*bench_synthetic);
+	if (defaults)
+		for (size_t i = 0 ; i < synthetic_count ; ++i)
+			generated[generated_count++] = bench_synthetic[i];
+	const size_t path_count = defaults ? bundled_count : (size_t) (argc - first_program);
+	struct bench_result *const results = calloc(path_count + generated_count + 1, sizeof(struct bench_result));
+	char **const paths = calloc(path_count + 1, sizeof(char *));
+	options.null_fd = open("/dev/null", O_WRONLY);
+	int ret = results == 0 || paths == 0 || options.null_fd < 0 ? EXIT_FAILURE : 0;
+	size_t result_count = 0;
+	for (size_t i = 0 ; i < path_count && ret == 0 ; ++i) {
+		const char *const name = defaults ? bench_bundled[i] : argv[first_program + (int) i];
+		paths[i] = malloc(strlen(TURTLE_BENCH_DIR) + strlen(name) + 2);
+		if (paths[i] == 0) {
+			ret = EXIT_FAILURE;
+			break;
+		}
+		if (defaults)
+			sprintf(paths[i], "%s/%s", TURTLE_BENCH_DIR, name);
+		else
+			strcpy(paths[i], name);
+		struct bench_source source;
+		if (bench_read(&source, paths[i])) {
+			source.name = defaults ? name : paths[i];
+			bench_program(&options, &source, results + result_count++);
+		} else
+			ret = EXIT_FAILURE;
+		free(source.bytes);
+	}
+	for (size_t i = 0 ; i < generated_count && ret == 0 ; ++i) {
+		struct bench_source source;
+		if (bench_generate(&source, generated[i]))
+			bench_program(&options, &source, results + result_count++);
+		else {
+			fprintf(stderr, "The synthetic program '%s' can't be generated.\n", generated[i]);
+			ret = EXIT_FAILURE;
+		}
+		free(source.bytes);
+	}
+	struct bench_micro micros[4];
+	size_t micro_count = 0;
+	if (micro && ret == 0) {
+		if (bench_bst(micros, micros + 1) || bench_expr(micros + 2, options.null_fd) || bench_write_output(micros + 3, options.null_fd))
+			ret = EXIT_FAILURE;
+		else
+			micro_count = 4;
+	}
+	if (result_count || micro_count)
+		bench_report(results, result_count, micros, micro_count);
+	for (size_t i = 0 ; i < result_count && ret == 0 ; ++i)
+		if (results[i].error_number)
+			ret = EXIT_FAILURE;
+	if (json_path) {
+		const int error = bench_json(json_path, &options, results, result_count, micros, micro_count);
+		if (error) {
+			fprintf(stderr, "The results can't be written to '%s' : %s.\n", json_path, strerror(error));
+			ret = EXIT_FAILURE;
+		}
+	}
+	for (size_t i = 0 ; paths && i < path_count ; ++i)
+		free(paths[i]);
+	free(paths);
+	free(results);
+	free(generated);
+	if (options.null_fd >= 0)
+		close(options.null_fd);
+	return ret;
+}
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// This tool sends programs to a turtle server (turtle --serve SOCKET) and writes their outputs on STDOUT,
+// the programs are given as paths or read from STDIN, they are sent on the same connection (see turtle-serve.h).
+// Example : ./turtle-client /tmp/turtle.sock --seed=42 default-star.turtle | ./turtle-viewer
+// The exit code is the first status which isn't 0.
+
+static int fail(const char *message) {
+	fprintf(stderr, "turtle-client: %s\n", message);
+	return EXIT_FAILURE;
+}
+
+static int usage(const char *name) {
+	fprintf(stderr, "Usage: %s SOCKET [--seed=N] [--max-depth=N] [--engine=vm|tree] [--format=text|binary] [program.turtle ...]\n", name);
+	return EXIT_FAILURE;
+}
+
+// Read a whole stream, return null on error.
+static char *read_source(FILE *const input, size_t *const length) {
+	size_t capacity = 65536;
+	char *source = malloc(capacity);
+	*length = 0;
+	while (source) {
+		*length += fread(source + *length, 1, capacity - *length, input);
+		if (*length < capacity)
+			break;
+		char *const larger = realloc(source, capacity *= 2);
+		if (larger == 0)
+			free(source);
+		source = larger;
+	}
+	if (source && ferror(input)) {
+		free(source);
+		source = 0;
+	}
+	return source;
+}
+
+static bool read_uint32(FILE *const input, uint32_t *const value) {
+	unsigned char bytes[4];
+	if (fread(bytes, 1, 4, input) != 4)
+		return false;
+	*value = (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8 | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+	return true;
+}
+
+// Send a request, then copy the chunks of the response until the status.
+static bool request(FILE *const requests, FILE *const responses, const char *const options, const char *const source, const size_t length, int *const status) {
+	if (fprintf(requests, "%slength=%zu\n", options, length) < 0 || fwrite(source, 1, length, requests) != length || fflush(requests))
+		return false;
+	char buffer[65536];
+	uint32_t size;
+	while (read_uint32(responses, &size) && size) {
+		while (size) {
+			const size_t count = size < sizeof(buffer) ? size : sizeof(buffer);
+			if (fread(buffer, 1, count, responses) != count)
+				return false;
+			fwrite(buffer, 1, count, stdout);
+			size -= (uint32_t) count;
+		}
+	}
+	uint32_t value;
+	if (size || !read_uint32(responses, &value))
+		return false;
+	*status = (int) value;
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2)
+		return usage(argv[0]);
+	char options[1024] = "";
+	int first_program = argc;
+	for (int i = 2 ; i < argc && first_program == argc ; ++i) {
+		if (strncmp(argv[i], "--seed=", 7) == 0 || strncmp(argv[i], "--max-depth=", 12) == 0
+				|| strncmp(argv[i], "--engine=", 9) == 0 || strncmp(argv[i], "--format=", 9) == 0) {
+			if (strlen(options) + strlen(argv[i]) + 1 >= sizeof(options))
+				return usage(argv[0]);
+			strcat(options, argv[i] + 2);
+			strcat(options, " ");
+		} else if (strncmp(argv[i], "--", 2) == 0)
+			return usage(argv[0]);
+		else
+			first_program = i;
+	}
+	struct sockaddr_un address = {0};
+	address.sun_family = AF_UNIX;
+	if (strlen(argv[1]) >= sizeof(address.sun_path))
+		return fail("the path of the socket is too long.");
+	strcpy(address.sun_path, argv[1]);
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *) &address, sizeof(address))) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	const int request_fd = dup(fd);
+	FILE *const responses = fdopen(fd, "r");
+	FILE *const requests = request_fd < 0 ? 0 : fdopen(request_fd, "w");
+	if (responses == 0 || requests == 0)
+		return fail("the connection can't be opened.");
+	int ret = EXIT_SUCCESS;
+	const int count = first_program == argc ? 1 : argc - first_program;
+	for (int i = 0 ; i < count ; ++i) {
+		const char *const path = first_program == argc ? 0 : argv[first_program + i];
+		FILE *const input = path ? fopen(path, "r") : stdin;
+		if (input == 0) {
+			perror(path);
+			ret = ret ? ret : EXIT_FAILURE;
+			continue;
+		}
+		size_t length;
+		char *const source = read_source(input, &length);
+		if (input != stdin)
+			fclose(input);
+		if (source == 0)
+			return fail("the program can't be read.");
+		int status;
+		const bool done = request(requests, responses, options, source, length, &status);
+		free(source);
+		if (!done)
+			return fail("the connection was closed by the server.");
+		if (ret == EXIT_SUCCESS)
+			ret = status;
+	}
+	fclose(requests);
+	fclose(responses);
+	if (fflush(stdout))
+		return fail("the output can't be written.");
+	return ret;
+}
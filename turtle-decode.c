@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "turtle-output.h"
+
+// This tool reads the binary format of turtle (--format=binary) on STDIN,
+// and writes the same drawing instructions in the text format on STDOUT, for the turtle viewer.
+// Example : ./turtle --format=binary < program.turtle | ./turtle-decode | ./turtle-viewer
+
+static int fail(const char *message) {
+	fprintf(stderr, "turtle-decode: %s\n", message);
+	return EXIT_FAILURE;
+}
+
+static bool read_bytes(unsigned char *dest, const size_t count) {
+	return fread(dest, 1, count, stdin) == count;
+}
+
+static bool read_double(double *const dest) {
+	unsigned char bytes[8];
+	if (!read_bytes(bytes, 8))
+		return false;
+	uint64_t bits = 0;
+	for (int i = 7 ; i >= 0 ; --i)
+		bits = bits << 8 | bytes[i];
+	memcpy(dest, &bits, sizeof(bits));
+	return true;
+}
+
+static bool read_varint(int64_t *const dest) {
+	uint64_t zigzag = 0;
+	for (int shift = 0 ; shift < 64 ; shift += 7) {
+		const int byte = getchar();
+		if (byte == EOF)
+			return false;
+		zigzag |= (uint64_t) (byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			*dest = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+// A fixed-point number is turned back into the nearest double, which is written with the same 4 decimals.
+static double from_fixed(const int64_t fixed, const bool negative_zero) {
+	return negative_zero ? -0.0 : (double) fixed / 1e4;
+}
+
+int main(void) {
+	unsigned char header[6];
+	if (!read_bytes(header, 6) || memcmp(header, "TRTB", 4) != 0)
+		return fail("the input is not a binary turtle stream.");
+	if (header[4] != OUTPUT_BINARY_VERSION || header[5] != OUTPUT_BINARY_DECIMALS)
+		return fail("unsupported version of the binary turtle stream.");
+	struct output output;
+	output_create(&output, STDOUT_FILENO, TURTLE_OUTPUT_BUFFER_SIZE);
+	int64_t x = 0, y = 0;
+	for (;;) {
+		const int opcode = getchar();
+		if (opcode == EOF)
+			goto truncated;
+		const bool raw = opcode & OUTPUT_FLAG_RAW;
+		double values[3];
+		switch (opcode & OUTPUT_OP_MASK) {
+			case OUTPUT_OP_END :
+				output_destroy(&output);
+				return output.error_number ? EXIT_FAILURE : EXIT_SUCCESS;
+			case OUTPUT_OP_COLOR :
+				for (int i = 0 ; i < 3 ; ++i) {
+					unsigned char bytes[2];
+					if (raw ? !read_double(values + i) : !read_bytes(bytes, 2))
+						goto truncated;
+					if (!raw)
+						values[i] = from_fixed(bytes[0] | bytes[1] << 8, opcode & (OUTPUT_FLAG_NEGATIVE_ZERO << i));
+				}
+				output_color(&output, values[0], values[1], values[2]);
+				break;
+			case OUTPUT_OP_MOVE_TO :
+			case OUTPUT_OP_LINE_TO : {
+				if (raw) {
+					if (!read_double(values) || !read_double(values + 1))
+						goto truncated;
+				} else {
+					int64_t dx, dy;
+					if (!read_varint(&dx) || !read_varint(&dy))
+						goto truncated;
+					x += dx;
+					y += dy;
+					values[0] = from_fixed(x, opcode & OUTPUT_FLAG_NEGATIVE_ZERO);
+					values[1] = from_fixed(y, opcode & (OUTPUT_FLAG_NEGATIVE_ZERO << 1));
+				}
+				output_move(&output, (opcode & OUTPUT_OP_MASK) == OUTPUT_OP_MOVE_TO, values[0], values[1]);
+				break;
+			}
+			default :
+				output_destroy(&output);
+				return fail("unknown opcode in the binary turtle stream.");
+		}
+	}
+truncated:
+	output_destroy(&output);
+	return fail("the binary turtle stream is truncated.");
+}
@@ -0,0 +1,391 @@
+#include "turtle-memo.h"
+#include "turtle-motion.h"
+
+#define MEMO_STATE_SIZE 7 // the pen and the colors are following the variables in a key
+
+/*
+ * analysis
+ * The direct reads and writes of each procedure are collected, then the ones of the procedures it may call.
+ */
+
+struct memo_analysis {
+	size_t variable_count;
+	size_t proc_count;
+	bool *reads;        // [proc][slot] the variables read by the declarations of a procedure
+	bool *writes;       // [proc][slot] the variables written by the declarations of a procedure
+	bool *main_reads;   // [slot] the variables read outside of the procedures
+	bool *calls;        // [proc][proc] the procedures called by the declarations of a procedure
+	bool *declared;     // [proc] the procedures having a declaration
+	bool *unsafe;       // [proc] the procedures using a command which can't be replayed
+	bool *reachable;    // [proc] the procedures reached by a call of the current one
+	size_t *pending;
+	size_t *read_counts;   // [slot] the number of procedures reading a variable, plus one if the main program reads it
+	size_t *inside_reads;  // [slot] the number of reached procedures reading a variable
+	bool *inside_writes;   // [slot] the variables written by the reached procedures
+};
+
+static void memo_scan_expr(const struct ast_node *const node, bool *const reads, bool *const unsafe) {
+	if (node == 0)
+		return;
+	if (node->kind == KIND_EXPR_NAME)
+		reads[node->slot] = true;
+	else if (node->kind == KIND_EXPR_FUNC && node->u.func == FUNC_RANDOM)
+		*unsafe = true;
+	for (size_t i = 0 ; i < node->children_count ; ++i)
+		memo_scan_expr(node->children[i], reads, unsafe);
+}
+
+// Scan the commands of a procedure (proc < proc_count) or of the main program (proc == proc_count).
+static void memo_scan(struct memo_analysis *const analysis, const struct ast_node *node, const size_t proc) {
+	const bool main = proc == analysis->proc_count;
+	bool *const reads = main ? analysis->main_reads : analysis->reads + proc * analysis->variable_count;
+	bool ignored = false, *const unsafe = main ? &ignored : analysis->unsafe + proc;
+	for (; node ; node = node->next) {
+		switch (node->kind) {
+			case KIND_CMD_SIMPLE :
+				switch (node->u.cmd) {
+					case CMD_POSITION : case CMD_HOME : case CMD_HEADING : case CMD_PRINT : *unsafe = true; break;
+					default : break;
+				}
+				for (size_t i = 0 ; i < node->children_count ; ++i)
+					memo_scan_expr(node->children[i], reads, unsafe);
+				break;
+			case KIND_CMD_REPEAT :
+				memo_scan_expr(node->children[0], reads, unsafe);
+				memo_scan(analysis, node->children[1], proc);
+				break;
+			case KIND_CMD_IF :
+			case KIND_CMD_WHILE :
+				memo_scan_expr(node->children[0], reads, unsafe);
+				for (size_t i = 1 ; i < node->children_count ; ++i)
+					memo_scan(analysis, node->children[i], proc);
+				break;
+			case KIND_CMD_BLOCK :
+				memo_scan(analysis, node->children[0], proc);
+				break;
+			case KIND_CMD_CALL :
+				if (!main)
+					analysis->calls[proc * analysis->proc_count + node->u.bst_entry->value.parsing.proc_slot] = true;
+				memo_scan(analysis, node->children[0], proc);
+				break;
+			case KIND_ARG :
+			case KIND_CMD_SET_LOCAL : // a parameter is not a variable
+				memo_scan_expr(node->children[0], reads, unsafe);
+				break;
+			case KIND_CMD_SET :
+				if (!main)
+					analysis->writes[proc * analysis->variable_count + node->slot] = true;
+				memo_scan_expr(node->children[0], reads, unsafe);
+				break;
+			case KIND_CMD_PROC : {
+				// a declaration during a call is an error, the body belongs to the declared procedure.
+				const size_t declared = node->u.bst_entry->value.parsing.proc_slot;
+				*unsafe = !main;
+				analysis->declared[declared] = true;
+				// the key of a call doesn't hold its arguments.
+				analysis->unsafe[declared] |= node->arity != 0;
+				memo_scan(analysis, node->children[0], declared);
+				break;
+			}
+			default : break;
+		}
+	}
+}
+
+// Mark the procedures reached by a call of proc, they are all unsafe if one of them is.
+static bool memo_reach(struct memo_analysis *const analysis, const size_t proc) {
+	bool unsafe = false;
+	size_t count = 0;
+	memset(analysis->reachable, 0, analysis->proc_count * sizeof(bool));
+	analysis->reachable[proc] = true;
+	analysis->pending[count++] = proc;
+	while (count) {
+		const size_t current = analysis->pending[--count];
+		unsafe |= analysis->unsafe[current] || !analysis->declared[current];
+		for (size_t callee = 0 ; callee < analysis->proc_count ; ++callee)
+			if (analysis->calls[current * analysis->proc_count + callee] && !analysis->reachable[callee]) {
+				analysis->reachable[callee] = true;
+				analysis->pending[count++] = callee;
+			}
+	}
+	return !unsafe;
+}
+
+// Give a procedure its reads and writes, it's eligible if no written variable is read by an unreached procedure.
+static int memo_analyze(struct memo *const self, struct memo_analysis *const analysis, const size_t proc) {
+	struct memo_proc *const target = self->procs + proc;
+	const size_t variable_count = analysis->variable_count;
+	if (!memo_reach(analysis, proc))
+		return 0;
+	memset(analysis->inside_reads, 0, variable_count * sizeof(size_t));
+	memset(analysis->inside_writes, 0, variable_count * sizeof(bool));
+	for (size_t other = 0 ; other < analysis->proc_count ; ++other)
+		if (analysis->reachable[other])
+			for (size_t slot = 0 ; slot < variable_count ; ++slot) {
+				analysis->inside_reads[slot] += analysis->reads[other * variable_count + slot];
+				analysis->inside_writes[slot] |= analysis->writes[other * variable_count + slot];
+			}
+	size_t read_count = 0, write_count = 0;
+	for (size_t slot = 0 ; slot < variable_count ; ++slot) {
+		if (analysis->inside_writes[slot] && analysis->read_counts[slot] > analysis->inside_reads[slot])
+			return 0;
+		read_count += analysis->inside_reads[slot] != 0;
+		write_count += analysis->inside_writes[slot];
+	}
+	target->reads = malloc((read_count + 1) * sizeof(size_t));
+	target->writes = malloc((write_count + 1) * sizeof(size_t));
+	if (target->reads == 0 || target->writes == 0)
+		return 1;
+	for (size_t slot = 0 ; slot < variable_count ; ++slot) {
+		if (analysis->inside_reads[slot])
+			target->reads[target->read_count++] = slot;
+		if (analysis->inside_writes[slot])
+			target->writes[target->write_count++] = slot;
+	}
+	target->eligible = true;
+	return 0;
+}
+
+int memo_create(struct memo *const self, const struct ast *const ast) {
+	memset(self, 0, sizeof(struct memo));
+	const size_t variable_count = ast->slot_count, proc_count = ast->proc_count;
+	struct memo_analysis analysis = {.variable_count = variable_count, .proc_count = proc_count};
+	analysis.reads = calloc(proc_count * variable_count + 1, sizeof(bool));
+	analysis.writes = calloc(proc_count * variable_count + 1, sizeof(bool));
+	analysis.main_reads = calloc(variable_count + 1, sizeof(bool));
+	analysis.calls = calloc(proc_count * proc_count + 1, sizeof(bool));
+	analysis.declared = calloc(proc_count + 1, sizeof(bool));
+	analysis.unsafe = calloc(proc_count + 1, sizeof(bool));
+	analysis.reachable = calloc(proc_count + 1, sizeof(bool));
+	analysis.pending = calloc(proc_count + 1, sizeof(size_t));
+	analysis.read_counts = calloc(variable_count + 1, sizeof(size_t));
+	analysis.inside_reads = calloc(variable_count + 1, sizeof(size_t));
+	analysis.inside_writes = calloc(variable_count + 1, sizeof(bool));
+	self->procs = calloc(proc_count + 1, sizeof(struct memo_proc));
+	self->proc_count = proc_count;
+	self->variable_count = variable_count;
+	self->key = calloc(variable_count + MEMO_STATE_SIZE, sizeof(double));
+	int error = !analysis.reads || !analysis.writes || !analysis.main_reads || !analysis.calls || !analysis.declared
+		|| !analysis.unsafe || !analysis.reachable || !analysis.pending || !analysis.read_counts || !analysis.inside_reads
+		|| !analysis.inside_writes || !self->procs || !self->key;
+	if (error == 0) {
+		memo_scan(&analysis, ast->unit, proc_count);
+		for (size_t slot = 0 ; slot < variable_count ; ++slot) {
+			analysis.read_counts[slot] = analysis.main_reads[slot];
+			for (size_t proc = 0 ; proc < proc_count ; ++proc)
+				analysis.read_counts[slot] += analysis.reads[proc * variable_count + slot];
+		}
+		for (size_t proc = 0 ; proc < proc_count && error == 0 ; ++proc)
+			error = memo_analyze(self, &analysis, proc);
+	}
+	free(analysis.reads);
+	free(analysis.writes);
+	free(analysis.main_reads);
+	free(analysis.calls);
+	free(analysis.declared);
+	free(analysis.unsafe);
+	free(analysis.reachable);
+	free(analysis.pending);
+	free(analysis.read_counts);
+	free(analysis.inside_reads);
+	free(analysis.inside_writes);
+	return error;
+}
+
+static void memo_free_entry(struct memo_entry *const entry) {
+	if (entry) {
+		free(entry->key);
+		free(entry->written);
+		free(entry->events);
+		free(entry);
+	}
+}
+
+void memo_destroy(struct memo *const self) {
+	for (size_t i = 0 ; self->procs && i < self->proc_count ; ++i) {
+		free(self->procs[i].reads);
+		free(self->procs[i].writes);
+		for (size_t j = 0 ; j < self->procs[i].entry_count ; ++j)
+			memo_free_entry(self->procs[i].entries[j]);
+	}
+	for (size_t i = 0 ; i < self->recording_count ; ++i)
+		free(self->recordings[i].key);
+	free(self->procs);
+	free(self->key);
+	free(self->recordings);
+	free(self->log);
+	memset(self, 0, sizeof(struct memo));
+}
+
+/*
+ * evaluation
+ */
+
+// The key of a call, the variables are compared bit by bit (a variable can't be NaN, so NaN marks an undefined one).
+static size_t memo_key(const struct memo_proc *const proc, const struct context *const ctx, double *const key) {
+	size_t size = 0;
+	for (size_t i = 0 ; i < proc->read_count ; ++i)
+		key[size++] = ctx->defined[proc->reads[i]] ? ctx->variables[proc->reads[i]] : NAN;
+	key[size++] = ctx->up;
+	key[size++] = ctx->r;
+	key[size++] = ctx->g;
+	key[size++] = ctx->b;
+	key[size++] = ctx->let.r;
+	key[size++] = ctx->let.g;
+	key[size++] = ctx->let.b;
+	return size;
+}
+
+static struct memo_entry *memo_find(const struct memo_proc *const proc, const double *const key, const size_t size) {
+	for (size_t i = 0 ; i < proc->entry_count ; ++i)
+		if (memcmp(proc->entries[i]->key, key, size * sizeof(double)) == 0)
+			return proc->entries[i];
+	return 0;
+}
+
+// Write the outputs of a recorded call, from the current position and angle of the turtle.
+static void memo_replay(struct context *const ctx, const struct memo_proc *const proc, const struct memo_entry *const entry) {
+	const double x = ctx->let.x, y = ctx->let.y, angle = ctx->angle;
+	const bool same = x == entry->start.x && y == entry->start.y && angle == entry->start_angle;
+	double c = 1, s = 0;
+	if (!same)
+		motion_rotation(angle - entry->start_angle, &c, &s);
+	for (size_t i = 0 ; i < entry->event_count && ctx->error_number == 0 ; ++i) {
+		const struct memo_event *const event = entry->events + i;
+		const double dx = event->x - entry->start.x, dy = event->y - entry->start.y;
+		ctx->up = event->up;
+		ctx->let.r = event->r;
+		ctx->let.g = event->g;
+		ctx->let.b = event->b;
+		ctx->let.x = same ? event->x : x + (c * dx + s * dy);
+		ctx->let.y = same ? event->y : y + (c * dy - s * dx);
+		ast_eval_write_output(ctx);
+	}
+	const double dx = entry->end.x - entry->start.x, dy = entry->end.y - entry->start.y;
+	ctx->up = entry->end.up;
+	ctx->let.r = entry->end.r;
+	ctx->let.g = entry->end.g;
+	ctx->let.b = entry->end.b;
+	ctx->x = ctx->let.x = same ? entry->end.x : x + (c * dx + s * dy);
+	ctx->y = ctx->let.y = same ? entry->end.y : y + (c * dy - s * dx);
+	ctx->angle = same ? entry->end_angle : angle + (entry->end_angle - entry->start_angle);
+	ctx->direction_valid = false;
+	for (size_t i = 0 ; i < proc->write_count ; ++i) {
+		const size_t slot = proc->writes[i];
+		ctx->defined[slot] = !isnan(entry->written[i]);
+		ctx->variables[slot] = ctx->defined[slot] ? entry->written[i] : 0;
+	}
+}
+
+bool memo_call(struct memo *const self, struct context *const ctx, const size_t proc, const size_t depth) {
+	struct memo_proc *const target = self->procs + proc;
+	if (!target->eligible || ctx->error_number)
+		return false;
+	const size_t size = memo_key(target, ctx, self->key);
+	const struct memo_entry *const entry = memo_find(target, self->key, size);
+	if (entry) {
+		// the call would reach the depth limit, it's evaluated to report the error.
+		if (depth + entry->depth > ctx->max_depth)
+			return false;
+		++self->hits;
+		if (ctx->deepest < depth + entry->depth)
+			ctx->deepest = depth + entry->depth; // a recorded caller reaches this depth too
+		memo_replay(ctx, target, entry);
+		return true;
+	}
+	++self->misses;
+	if (target->entry_count == MEMO_ENTRIES_MAX)
+		return false;
+	if (self->recording_count == self->recording_capacity) {
+		const size_t capacity = self->recording_capacity ? 2 * self->recording_capacity : 16;
+		struct memo_recording *const recordings = realloc(self->recordings, capacity * sizeof(struct memo_recording));
+		if (recordings == 0)
+			return false; // the call is simply not recorded
+		self->recordings = recordings;
+		self->recording_capacity = capacity;
+	}
+	double *const key = malloc(size * sizeof(double));
+	if (key == 0)
+		return false;
+	memcpy(key, self->key, size * sizeof(double));
+	struct memo_recording *const recording = self->recordings + self->recording_count++;
+	recording->proc = proc;
+	recording->depth = depth;
+	recording->first_event = self->log_count;
+	recording->deepest = ctx->deepest;
+	recording->overflow = false;
+	recording->key = key;
+	recording->start = (struct memo_event) {.x = ctx->let.x, .y = ctx->let.y, .up = ctx->up};
+	recording->start_angle = ctx->angle;
+	ctx->deepest = depth;
+	return false;
+}
+
+// Keep a recorded call, unless it's already kept (by a recursive call with the same key).
+static void memo_keep(struct memo *const self, struct context *const ctx, struct memo_recording *const recording) {
+	struct memo_proc *const target = self->procs + recording->proc;
+	const size_t size = target->read_count + MEMO_STATE_SIZE;
+	if (target->entry_count == MEMO_ENTRIES_MAX || memo_find(target, recording->key, size))
+		return;
+	struct memo_entry *const entry = calloc(1, sizeof(struct memo_entry));
+	const size_t event_count = self->log_count - recording->first_event;
+	if (entry == 0)
+		return;
+	entry->written = malloc((target->write_count + 1) * sizeof(double));
+	entry->events = malloc((event_count + 1) * sizeof(struct memo_event));
+	if (entry->written == 0 || entry->events == 0) {
+		memo_free_entry(entry);
+		return;
+	}
+	entry->key = recording->key;
+	recording->key = 0;
+	memcpy(entry->events, self->log + recording->first_event, event_count * sizeof(struct memo_event));
+	entry->event_count = event_count;
+	entry->start = recording->start;
+	entry->start_angle = recording->start_angle;
+	entry->end = (struct memo_event) {.x = ctx->let.x, .y = ctx->let.y, .r = ctx->let.r, .g = ctx->let.g, .b = ctx->let.b, .up = ctx->up};
+	entry->end_angle = ctx->angle;
+	entry->depth = ctx->deepest - recording->depth;
+	for (size_t i = 0 ; i < target->write_count ; ++i) {
+		const size_t slot = target->writes[i];
+		entry->written[i] = ctx->defined[slot] ? ctx->variables[slot] : NAN;
+	}
+	target->entries[target->entry_count++] = entry;
+}
+
+void memo_return(struct memo *const self, struct context *const ctx, const size_t depth) {
+	if (self->recording_count == 0 || self->recordings[self->recording_count - 1].depth != depth)
+		return;
+	struct memo_recording *const recording = self->recordings + --self->recording_count;
+	if (!recording->overflow && ctx->error_number == 0)
+		memo_keep(self, ctx, recording);
+	free(recording->key);
+	// the caller may be recorded too, its depth includes the one of the call.
+	if (ctx->deepest < recording->deepest)
+		ctx->deepest = recording->deepest;
+	if (self->recording_count == 0)
+		self->log_count = 0;
+}
+
+void memo_write(struct memo *const self, const struct context *const ctx) {
+	if (self->recording_count == 0)
+		return;
+	if (self->log_count == self->log_capacity) {
+		const size_t capacity = self->log_capacity ? 2 * self->log_capacity : 1024;
+		struct memo_event *const log = capacity <= MEMO_LOG_MAX ? realloc(self->log, capacity * sizeof(struct memo_event)) : 0;
+		if (log == 0) {
+			// the current recordings are dropped, the next ones are using the log from its start.
+			for (size_t i = 0 ; i < self->recording_count ; ++i)
+				self->recordings[i].overflow = true;
+			self->log_count = 0;
+			if (self->log_capacity == 0)
+				return;
+		} else {
+			self->log = log;
+			self->log_capacity = capacity;
+		}
+	}
+	self->log[self->log_count++] = (struct memo_event) {
+		.x = ctx->let.x, .y = ctx->let.y, .r = ctx->let.r, .g = ctx->let.g, .b = ctx->let.b, .up = ctx->up,
+	};
+}
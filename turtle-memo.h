@@ -0,0 +1,93 @@
+#ifndef TURTLE_MEMO_H
+#define TURTLE_MEMO_H
+
+#include "turtle-ast.h"
+
+#define MEMO_ENTRIES_MAX	16		// the calls kept for a procedure, the next ones are evaluated
+#define MEMO_LOG_MAX		1048576	// the outputs recorded at once, the calls writing more are not kept
+
+// The memoization of the procedures is optional (see --memoize), it's shared by the evaluators.
+// A procedure can be memoized when the procedures it may call (itself included) are not using random, print,
+// position, home, heading or a declaration, are declared without parameters, and are not writing a variable
+// which is read by another procedure or by the main program. A call is keyed by the values of the variables it reads, the pen and the colors.
+// The first call with a key is evaluated and its outputs are recorded, the next ones are replayed :
+// the recorded points are turned and translated to the position and the angle of the turtle, like the loops
+// replayed by turtle-motion.c (with the same tolerance), they are exact when the turtle starts from the same place.
+
+// an output of a call, as given to ast_eval_write_output
+struct memo_event {
+	double x;
+	double y;
+	double r;
+	double g;
+	double b;
+	bool up;
+};
+
+// a recorded call, the positions are the ones of the recording
+struct memo_entry {
+	double *key;     // the values read by the call (NaN for an undefined variable), then the pen and the colors
+	double *written; // the values of the written variables after the call (NaN for an undefined variable)
+	struct memo_event *events;
+	size_t event_count;
+	struct memo_event start; // the turtle before the call (the color fields are unused)
+	struct memo_event end;   // the turtle after the call
+	double start_angle;
+	double end_angle;
+	size_t depth;    // the deepest nesting of repeats and calls reached by the call, relative to its caller
+};
+
+// a procedure slot
+struct memo_proc {
+	bool eligible;
+	size_t *reads;   // the slots read by a call
+	size_t read_count;
+	size_t *writes;  // the slots written by a call
+	size_t write_count;
+	struct memo_entry *entries[MEMO_ENTRIES_MAX];
+	size_t entry_count;
+};
+
+// a call being recorded, the recordings are nested like the calls
+struct memo_recording {
+	size_t proc;
+	size_t depth;       // the depth of the caller, to recognize the end of the call
+	size_t first_event; // the outputs of the call are following this index of the log
+	size_t deepest;     // the deepest nesting of the context before the call
+	bool overflow;      // the call wrote too many outputs, it's not kept
+	double *key;
+	struct memo_event start;
+	double start_angle;
+};
+
+struct memo {
+	struct memo_proc *procs;
+	size_t proc_count;
+	size_t variable_count;
+	double *key;  // the key of the current call
+	struct memo_recording *recordings;
+	size_t recording_count;
+	size_t recording_capacity;
+	struct memo_event *log;
+	size_t log_count;
+	size_t log_capacity;
+	size_t hits;
+	size_t misses;
+};
+
+// analyze the procedures of a resolved AST, return 0 on success or 1 on memory allocation error
+int memo_create(struct memo *self, const struct ast *ast);
+
+// release the procedures and the recorded calls
+void memo_destroy(struct memo *self);
+
+// called by an evaluator before a call at the given depth, return true if the call was replayed (its body is skipped)
+bool memo_call(struct memo *self, struct context *ctx, size_t proc, size_t depth);
+
+// called by an evaluator when a call returns to the given depth
+void memo_return(struct memo *self, struct context *ctx, size_t depth);
+
+// called by ast_eval_write_output, the outputs are recorded while a call is recorded
+void memo_write(struct memo *self, const struct context *ctx);
+
+#endif /* TURTLE_MEMO_H */
@@ -0,0 +1,168 @@
+#include "turtle-motion.h"
+
+// Collect the commands of a body, the blocks are flattened, return false if a command can't be replayed.
+static bool motion_collect(const struct ast_node *node, struct motion_step *const steps, size_t *const count) {
+	for (; node ; node = node->next) {
+		if (node->kind == KIND_CMD_BLOCK) {
+			if (!motion_collect(node->children[0], steps, count))
+				return false;
+			continue;
+		}
+		if (node->kind != KIND_CMD_SIMPLE)
+			return false;
+		switch (node->u.cmd) {
+			case CMD_FORWARD : case CMD_BACKWARD : case CMD_LEFT : case CMD_RIGHT :
+			case CMD_UP : case CMD_DOWN : case CMD_COLOR : break;
+			default : return false;
+		}
+		struct motion_step step = {.cmd = node->u.cmd};
+		for (size_t i = 0 ; i < node->children_count ; ++i) {
+			if (node->children[i] == 0 || node->children[i]->kind != KIND_EXPR_VALUE)
+				return false;
+			step.value[i] = node->children[i]->u.value;
+		}
+		if (step.cmd == CMD_COLOR)
+			for (size_t i = 0 ; i < 3 ; ++i)
+				if (!(step.value[i] >= 0.0 && step.value[i] <= 1.0))
+					return false; // the error is reported by the evaluator
+		if (*count == MOTION_STEPS_MAX)
+			return false;
+		steps[(*count)++] = step;
+	}
+	return true;
+}
+
+size_t motion_flatten(const struct ast_node *const body, struct motion_step *const steps) {
+	size_t count = 0;
+	return motion_collect(body, steps, &count) ? count : 0;
+}
+
+// The rotation of the turtle by some degrees, the multiples of 90 degrees are exact (like the direction of the turtle).
+void motion_rotation(const double degrees, double *const c, double *const s) {
+	static const double quadrants[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+	const double turns = fmod(degrees, 360.0);
+	if (fmod(turns, 90.0) == 0.0) {
+		const int quadrant = ((int) (turns / 90.0) + 4) % 4;
+		*c = quadrants[quadrant][0];
+		*s = quadrants[quadrant][1];
+	} else {
+		*c = cos(degrees * TURTLE_DEG_TO_RAD);
+		*s = sin(degrees * TURTLE_DEG_TO_RAD);
+	}
+}
+
+// The angle is updated like the turtle actions do, so it's exact after any number of iterations.
+static double motion_turn(double angle, const struct motion_step *const steps, const size_t count) {
+	for (size_t i = 0 ; i < count ; ++i)
+		if (steps[i].cmd == CMD_LEFT)
+			angle += steps[i].value[0];
+		else if (steps[i].cmd == CMD_RIGHT)
+			angle -= steps[i].value[0];
+	return angle;
+}
+
+// Evaluate an iteration by the turtle actions, the moves are recorded relative to (x0, y0) when dx and dy are given.
+static size_t motion_iterate(struct context *const ctx, const struct motion_step *const steps, const size_t count, double *const dx, double *const dy, const double x0, const double y0) {
+	size_t moves = 0;
+	for (size_t i = 0 ; i < count ; ++i) {
+		const struct motion_step *const step = steps + i;
+		switch (step->cmd) {
+			case CMD_FORWARD :
+			case CMD_BACKWARD :
+				if (step->value[0] == 0.0)
+					break; // the turtle doesn't move, the step is only counted
+				if (step->cmd == CMD_FORWARD)
+					context_forward(ctx, step->value[0]);
+				else
+					context_backward(ctx, step->value[0]);
+				if (dx) {
+					dx[moves] = ctx->let.x - x0;
+					dy[moves] = ctx->let.y - y0;
+				}
+				++moves;
+				break;
+			case CMD_LEFT : context_left(ctx, step->value[0]); break;
+			case CMD_RIGHT : context_right(ctx, step->value[0]); break;
+			case CMD_UP : ctx->up = true; break;
+			case CMD_DOWN : ctx->up = false; break;
+			case CMD_COLOR : context_color(ctx, step->value[0], step->value[1], step->value[2]); break;
+			default : break;
+		}
+	}
+	return moves;
+}
+
+// A move of the turtle is a vector (-sin(angle), -cos(angle)), turning it by some degrees with the cosine c and the sine s
+// gives (x * c + y * s, y * c - x * s), every point of an iteration is the recorded one, turned and translated.
+void motion_replay(struct context *const ctx, const struct motion_step *const steps, const size_t count, const long long int iterations) {
+	double dx[MOTION_STEPS_MAX], dy[MOTION_STEPS_MAX]; // the recorded moves, relative to the start of the first iteration
+	double xs[MOTION_BATCH * MOTION_STEPS_MAX], ys[MOTION_BATCH * MOTION_STEPS_MAX]; // the points of a batch
+	double start_x[MOTION_BATCH], start_y[MOTION_BATCH], c[MOTION_BATCH], s[MOTION_BATCH];
+	if (ctx->error_number || iterations <= 0)
+		return;
+	const double x0 = ctx->let.x, y0 = ctx->let.y, angle0 = ctx->angle;
+	ctx->stats.commands += count * (unsigned long long int) iterations; // the first iteration isn't dispatched either
+	const size_t moves = motion_iterate(ctx, steps, count, dx, dy, x0, y0);
+	const double end_x = ctx->let.x - x0, end_y = ctx->let.y - y0;
+	double x = ctx->let.x, y = ctx->let.y, angle = ctx->angle;
+	long long int done = 1;
+	for (bool finite = true ; finite && done < iterations && ctx->error_number == 0 ; ) {
+		size_t batch = iterations - done < MOTION_BATCH ? (size_t) (iterations - done) : MOTION_BATCH;
+		// the start of each iteration depends on the previous one, an infinite one isn't turned (0 * inf is NaN).
+		for (size_t i = 0 ; i < batch ; ++i) {
+			if (!isfinite(x) || !isfinite(y)) {
+				batch = i;
+				finite = false;
+				break;
+			}
+			motion_rotation(angle - angle0, c + i, s + i);
+			start_x[i] = x;
+			start_y[i] = y;
+			x = start_x[i] + (c[i] * end_x + s[i] * end_y);
+			y = start_y[i] + (c[i] * end_y - s[i] * end_x);
+			angle = motion_turn(angle, steps, count);
+		}
+		// the points of the iterations are independent, this loop is vectorized by the compiler.
+		for (size_t i = 0 ; i < batch ; ++i) {
+			double *const px = xs + i * moves, *const py = ys + i * moves;
+			for (size_t j = 0 ; j < moves ; ++j) {
+				px[j] = start_x[i] + (c[i] * dx[j] + s[i] * dy[j]);
+				py[j] = start_y[i] + (c[i] * dy[j] - s[i] * dx[j]);
+			}
+		}
+		// the outputs are written in the order of the commands, the pen and the color are evaluated as usual.
+		for (size_t i = 0, point = 0 ; i < batch ; ++i) {
+			for (size_t j = 0 ; j < count ; ++j) {
+				const struct motion_step *const step = steps + j;
+				switch (step->cmd) {
+					case CMD_FORWARD :
+					case CMD_BACKWARD :
+						if (step->value[0] == 0.0)
+							break;
+						ctx->let.x = xs[point];
+						ctx->let.y = ys[point++];
+						ast_eval_write_output(ctx);
+						break;
+					case CMD_UP : ctx->up = true; break;
+					case CMD_DOWN : ctx->up = false; break;
+					case CMD_COLOR :
+						ctx->let.r = step->value[0];
+						ctx->let.g = step->value[1];
+						ctx->let.b = step->value[2];
+						break;
+					default : break;
+				}
+			}
+		}
+		done += (long long int) batch;
+	}
+	ctx->angle = angle;
+	ctx->direction_valid = false;
+	if (done < iterations) {
+		// the turtle went to infinity, the next iterations are evaluated by the turtle actions
+		ctx->let.x = x;
+		ctx->let.y = y;
+		for (; done < iterations && ctx->error_number == 0 ; ++done)
+			motion_iterate(ctx, steps, count, 0, 0, x0, y0);
+	}
+}
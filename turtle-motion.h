@@ -0,0 +1,36 @@
+#ifndef TURTLE_MOTION_H
+#define TURTLE_MOTION_H
+
+#include "turtle-ast.h"
+
+#define MOTION_STEPS_MAX	64 // the longest body that can be replayed
+#define MOTION_BATCH		16 // the number of iterations whose points are computed together
+
+// A geometry only loop body is a motion template : its commands are forward, backward, left, right, up, down and color,
+// their arguments are literals (after the constant folding), there is no nested repeat, no call and no variable.
+// The first iteration is evaluated by the turtle actions and recorded, the next ones are a rotation and a translation
+// of the recorded points, computed by batches. The angle and the pen are evaluated exactly.
+//
+// Tolerance : the replayed coordinates are not the sums computed step by step by the evaluators, a point of
+// the iteration k differs by about k * 2^-52 times the largest distance between the points of the drawing.
+// For a drawing of 1000 units and 1 million iterations it's below 1e-6, the 4 decimals of the output
+// are the same unless a coordinate is that close to a rounding boundary (a zero may also change its sign).
+// Once the turtle is at infinity, the next iterations are evaluated by the turtle actions, like without --replay.
+
+// a command of a motion template
+struct motion_step {
+	enum ast_cmd cmd;
+	double value[3];
+};
+
+// turn a loop body into a motion template, return its number of steps or 0 if the body is not geometry only
+// every command is a step (a move of 0 too, it's only counted), so the stats don't depend on --replay
+size_t motion_flatten(const struct ast_node *body, struct motion_step *steps);
+
+// the cosine and the sine of a rotation of the turtle, exact for the multiples of 90 degrees
+void motion_rotation(double degrees, double *c, double *s);
+
+// evaluate the iterations of a motion template, the first one is evaluated exactly, the next ones are replayed
+void motion_replay(struct context *ctx, const struct motion_step *steps, size_t count, long long int iterations);
+
+#endif /* TURTLE_MOTION_H */
@@ -0,0 +1,310 @@
+#include "turtle-optimizer.h"
+
+/*
+ * Constant folding.
+ * An expression is folded only if its evaluation can't fail, otherwise it's kept so the error is raised at runtime.
+ * The random function is never folded, its arguments can be.
+ * An "and" (or an "or") with a known left operand giving the result is folded, even if its right operand could fail.
+ */
+
+// Turn a node into a literal, its children are left in the arena.
+static struct ast_node *fold_value(struct ast_node *const node, const double value) {
+	node->kind = KIND_EXPR_VALUE;
+	node->u.value = value;
+	node->children_count = 0;
+	memset(node->children, 0, sizeof(node->children));
+	return node;
+}
+
+static bool is_value(const struct ast_node *const node) {
+	return node && node->kind == KIND_EXPR_VALUE;
+}
+
+// Return the folded expression, which may be a child of the given node.
+static struct ast_node *fold_expr(struct ast_node *const node) {
+	if (node == 0)
+		return 0;
+	for (size_t i = 0 ; i < node->children_count ; ++i)
+		node->children[i] = fold_expr(node->children[i]);
+	struct ast_node *const lhs = node->children[0], *const rhs = node->children[1];
+	switch (node->kind) {
+		case KIND_EXPR_BLOCK :
+			// the parentheses are only useful to the parser.
+			return lhs;
+		case KIND_EXPR_UNOP :
+			if (node->u.op == '+')
+				return lhs;
+			if (is_value(lhs))
+				return fold_value(node, lhs->u.value ? -lhs->u.value : lhs->u.value);
+			return node;
+		case KIND_EXPR_BINOP : {
+			if (node->u.op == '^' && is_value(rhs) && rhs->u.value == 2.0) {
+				// x ^ 2 is x * x, the product is exactly the value computed by pow.
+				node->kind = KIND_EXPR_FUNC;
+				node->u.func = FUNC_SQUARE;
+				node->children[1] = 0;
+				node->children_count = 1;
+				return fold_expr(node);
+			}
+			if (!is_value(lhs) || !is_value(rhs))
+				return node;
+			double res;
+			switch (node->u.op) {
+				case '+' : res = lhs->u.value + rhs->u.value; break;
+				case '-' : res = lhs->u.value - rhs->u.value; break;
+				case '*' : res = lhs->u.value * rhs->u.value; break;
+				case '/' : res = lhs->u.value / rhs->u.value; break;
+				case '^' :
+				default : res = pow(lhs->u.value, rhs->u.value); break;
+			}
+			return isfinite(res) ? fold_value(node, res) : node;
+		}
+		case KIND_EXPR_TEST : {
+			if (node->u.test == TEST_NOT)
+				return is_value(lhs) ? fold_value(node, lhs->u.value == 0.0) : node;
+			if (node->u.test == TEST_AND && is_value(lhs) && lhs->u.value == 0.0)
+				return fold_value(node, 0);
+			if (node->u.test == TEST_OR && is_value(lhs) && lhs->u.value != 0.0)
+				return fold_value(node, 1);
+			if (!is_value(lhs) || !is_value(rhs))
+				return node;
+			bool res;
+			switch (node->u.test) {
+				case TEST_LT : res = lhs->u.value < rhs->u.value; break;
+				case TEST_LE : res = lhs->u.value <= rhs->u.value; break;
+				case TEST_EQ : res = lhs->u.value == rhs->u.value; break;
+				case TEST_NE : res = lhs->u.value != rhs->u.value; break;
+				case TEST_GT : res = lhs->u.value > rhs->u.value; break;
+				case TEST_GE : res = lhs->u.value >= rhs->u.value; break;
+				default : res = rhs->u.value != 0.0; break; // "and" or "or", decided by its right operand
+			}
+			return fold_value(node, res);
+		}
+		case KIND_EXPR_FUNC :
+			if (!is_value(lhs))
+				return node;
+			switch (node->u.func) {
+				case FUNC_COS : return fold_value(node, cos(lhs->u.value * TURTLE_DEG_TO_RAD));
+				case FUNC_SIN : return fold_value(node, sin(lhs->u.value * TURTLE_DEG_TO_RAD));
+				case FUNC_TAN : return fold_value(node, tan(lhs->u.value * TURTLE_DEG_TO_RAD));
+				case FUNC_SQRT : return lhs->u.value < 0.0 ? node : fold_value(node, sqrt(lhs->u.value));
+				case FUNC_SQUARE : return isfinite(lhs->u.value * lhs->u.value) ? fold_value(node, lhs->u.value * lhs->u.value) : node;
+				case FUNC_RANDOM :
+				default : return node;
+			}
+		default :
+			return node;
+	}
+}
+
+// Walk the commands, every expression they hold is folded.
+static void fold_node(struct ast_node *node) {
+	for (; node ; node = node->next) {
+		for (size_t i = 0 ; i < node->children_count ; ++i) {
+			struct ast_node *const child = node->children[i];
+			if (child == 0)
+				continue;
+			if (child->kind >= KIND_EXPR_FUNC) // the expressions are the last kinds
+				node->children[i] = fold_expr(child);
+			else
+				fold_node(child);
+		}
+	}
+}
+
+void ast_fold(struct ast *const self) {
+	if (self && self->error_number == 0)
+		fold_node(self->unit);
+}
+
+/*
+ * Loop invariant hoisting.
+ * A repeat body may evaluate expressions which are not reading any variable written by the loop, they are computed once.
+ * The writes of a loop are the "set" commands of its body (its branches and its nested loops included) and of the
+ * procedures it may call (transitively). Only the repeats have hidden slots, the while loops are walked for nested repeats.
+ * An invariant expression is kept at its place, it's computed by the first iteration then kept in a hidden slot,
+ * so the errors and the outputs are produced in the same order as before. The random function is always variant,
+ * so are the parameters of the procedures (they are not variables, the "set" of a parameter is not a write).
+ */
+
+struct hoist_pass {
+	struct ast *ast;
+	size_t variable_count; // the slots of the program, the hidden slots are following them
+	bool *writes;          // indexed by slot, the variables written by the current loop
+	bool *visited;         // indexed by procedure slot, the procedures already walked by the current loop
+	size_t *pending;       // the procedures to walk, a stack of procedure slots
+	size_t pending_count;
+	struct ast_node **procs; // the declarations sorted by procedure slot, a name may be declared many times
+	size_t *proc_start;      // the declarations of a procedure slot are procs[proc_start[slot] .. proc_start[slot + 1]]
+};
+
+// Collect the declarations of procedures, a declaration can be nested anywhere in the program.
+static void hoist_collect(struct hoist_pass *const pass, struct ast_node *node, const bool store) {
+	for (; node ; node = node->next) {
+		if (node->kind == KIND_CMD_PROC) {
+			const size_t slot = node->u.bst_entry->value.parsing.proc_slot;
+			if (store)
+				pass->procs[pass->proc_start[slot]++] = node;
+			else
+				++pass->proc_start[slot + 1];
+		}
+		if (node->kind < KIND_EXPR_FUNC)
+			for (size_t i = 0 ; i < node->children_count ; ++i)
+				hoist_collect(pass, node->children[i], store);
+	}
+}
+
+// Mark the variables written by the commands, the called procedures are queued once.
+// A procedure declared by the commands is not executed here, its body is skipped.
+static void hoist_writes(struct hoist_pass *const pass, struct ast_node *node) {
+	for (; node ; node = node->next) {
+		switch (node->kind) {
+			case KIND_CMD_SET :
+				pass->writes[node->slot] = true;
+				break;
+			case KIND_CMD_CALL : {
+				const size_t slot = node->u.bst_entry->value.parsing.proc_slot;
+				if (!pass->visited[slot]) {
+					pass->visited[slot] = true;
+					pass->pending[pass->pending_count++] = slot;
+				}
+				break;
+			}
+			case KIND_CMD_REPEAT :
+			case KIND_CMD_WHILE :
+				hoist_writes(pass, node->children[1]);
+				break;
+			case KIND_CMD_IF :
+				hoist_writes(pass, node->children[1]);
+				hoist_writes(pass, node->children[2]);
+				break;
+			case KIND_CMD_BLOCK :
+				hoist_writes(pass, node->children[0]);
+				break;
+			default : break;
+		}
+	}
+}
+
+static void hoist_loop_writes(struct hoist_pass *const pass, struct ast_node *const body) {
+	memset(pass->writes, 0, pass->variable_count * sizeof(bool));
+	memset(pass->visited, 0, pass->ast->proc_count * sizeof(bool));
+	pass->pending_count = 0;
+	hoist_writes(pass, body);
+	while (pass->pending_count) {
+		const size_t slot = pass->pending[--pass->pending_count];
+		for (size_t i = slot ? pass->proc_start[slot - 1] : 0 ; i < pass->proc_start[slot] ; ++i)
+			hoist_writes(pass, pass->procs[i]->children[0]);
+	}
+}
+
+// Replace an invariant expression by a hoisted one, unless it's already as cheap as a hidden slot.
+static void hoist_replace(struct hoist_pass *const pass, struct ast_node **const link) {
+	struct ast_node *const node = *link;
+	if (node == 0 || node->kind == KIND_EXPR_VALUE || node->kind == KIND_EXPR_NAME || node->kind == KIND_EXPR_HOISTED)
+		return;
+	struct ast_node *const hoisted = make_hoisted(pass->ast, (uint32_t) pass->ast->slot_count, node);
+	if (hoisted == 0) {
+		pass->ast->error_number = 1;
+		return;
+	}
+	++pass->ast->slot_count;
+	*link = hoisted;
+}
+
+// Tell whether the expression is invariant, the largest invariant parts of a variant expression are hoisted.
+static bool hoist_expr(struct hoist_pass *const pass, struct ast_node *const node) {
+	if (node == 0)
+		return true;
+	switch (node->kind) {
+		case KIND_EXPR_VALUE :
+		case KIND_EXPR_HOISTED : return true; // hoisted by an outer loop, it can't change during this one
+		case KIND_EXPR_NAME : return !pass->writes[node->slot];
+		case KIND_EXPR_LOCAL : return false; // a recursive call would find the hidden slot of another frame
+		default : break;
+	}
+	bool invariant = node->kind != KIND_EXPR_FUNC || node->u.func != FUNC_RANDOM;
+	bool children[AST_CHILDREN_MAX];
+	for (size_t i = 0 ; i < node->children_count ; ++i)
+		invariant &= children[i] = hoist_expr(pass, node->children[i]);
+	if (!invariant)
+		for (size_t i = 0 ; i < node->children_count ; ++i)
+			if (children[i])
+				hoist_replace(pass, node->children + i);
+	return invariant;
+}
+
+// Hoist the expressions of the commands of a loop body, including the nested loops.
+static void hoist_cmds(struct hoist_pass *const pass, struct ast_node *node) {
+	for (; node ; node = node->next) {
+		if (node->kind == KIND_CMD_PROC)
+			continue;
+		for (size_t i = 0 ; i < node->children_count ; ++i) {
+			struct ast_node *const child = node->children[i];
+			if (child == 0)
+				continue;
+			if (child->kind >= KIND_EXPR_FUNC) {
+				if (hoist_expr(pass, child))
+					hoist_replace(pass, node->children + i);
+			} else
+				hoist_cmds(pass, child);
+		}
+	}
+}
+
+static void hoist_node(struct hoist_pass *pass, struct ast_node *node);
+
+// The hidden slots of a loop are contiguous, the nested loops are processed after it (their writes are a subset).
+static void hoist_repeat(struct hoist_pass *const pass, struct ast_node *const node) {
+	hoist_loop_writes(pass, node->children[1]);
+	const size_t first = pass->ast->slot_count;
+	hoist_cmds(pass, node->children[1]);
+	node->u.hoisted.first = (uint32_t) first;
+	node->u.hoisted.count = (uint32_t) (pass->ast->slot_count - first);
+	hoist_node(pass, node->children[1]);
+}
+
+// Walk the commands to find the outermost loops, the procedures may contain loops too.
+static void hoist_node(struct hoist_pass *const pass, struct ast_node *node) {
+	for (; node && pass->ast->error_number == 0 ; node = node->next) {
+		switch (node->kind) {
+			case KIND_CMD_REPEAT : hoist_repeat(pass, node); break;
+			case KIND_CMD_BLOCK :
+			case KIND_CMD_PROC : hoist_node(pass, node->children[0]); break;
+			case KIND_CMD_IF :
+				hoist_node(pass, node->children[1]);
+				hoist_node(pass, node->children[2]);
+				break;
+			case KIND_CMD_WHILE : hoist_node(pass, node->children[1]); break;
+			default : break;
+		}
+	}
+}
+
+void ast_hoist(struct ast *const self) {
+	if (self == 0 || self->error_number)
+		return;
+	struct hoist_pass pass = {.ast = self, .variable_count = self->slot_count};
+	pass.writes = malloc((pass.variable_count + 1) * sizeof(bool));
+	pass.visited = malloc((self->proc_count + 1) * sizeof(bool));
+	pass.pending = malloc((self->proc_count + 1) * sizeof(size_t));
+	pass.proc_start = calloc(self->proc_count + 1, sizeof(size_t));
+	if (pass.writes && pass.visited && pass.pending && pass.proc_start) {
+		// a counting sort of the declarations, afterwards proc_start[slot] is the end of the declarations of slot.
+		hoist_collect(&pass, self->unit, false);
+		for (size_t i = 1 ; i <= self->proc_count ; ++i)
+			pass.proc_start[i] += pass.proc_start[i - 1];
+		pass.procs = malloc((pass.proc_start[self->proc_count] + 1) * sizeof(struct ast_node *));
+		if (pass.procs) {
+			hoist_collect(&pass, self->unit, true);
+			hoist_node(&pass, self->unit);
+		} else
+			self->error_number = 1;
+	} else
+		self->error_number = 1;
+	free(pass.writes);
+	free(pass.visited);
+	free(pass.pending);
+	free(pass.proc_start);
+	free(pass.procs);
+}
@@ -0,0 +1,15 @@
+#ifndef TURTLE_OPTIMIZER_H
+#define TURTLE_OPTIMIZER_H
+
+#include "turtle-ast.h"
+
+// The optimizations are working on the AST, between the parser and the evaluators.
+// They are giving the same results as the original tree, including the errors and their numbers.
+
+// fold the constant expressions, drop the useless wrappers and simplify some operators
+void ast_fold(struct ast *self);
+
+// compute the loop invariant expressions once per loop, must be called after ast_resolve (it adds hidden slots)
+void ast_hoist(struct ast *self);
+
+#endif /* TURTLE_OPTIMIZER_H */
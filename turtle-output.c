@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "turtle-output.h"
+
+// The fast formatter works on the value multiplied by 10^4, it must stay below 2^53.
+#define OUTPUT_FIXED_MAX	1e11
+
+void output_create(struct output *const self, const int fd, const size_t capacity) {
+	memset(self, 0, sizeof(struct output));
+	self->fd = fd;
+	self->capacity = capacity < TURTLE_OUTPUT_LINE_MAX ? TURTLE_OUTPUT_LINE_MAX : capacity;
+	self->svg.decimals = OUTPUT_SVG_DECIMALS_DEFAULT;
+}
+
+// Write some bytes, a partial write is continued, an interrupted write is retried.
+static void output_write(struct output *const self, const char *const bytes, const size_t count) {
+	size_t done = 0;
+	while (done < count && self->error_number == 0) {
+		const ssize_t written = write(self->fd, bytes + done, count - done);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			self->error_number = errno;
+			break;
+		}
+		done += (size_t) written;
+	}
+}
+
+// Write the whole buffer, a framed output writes its little-endian 32 bits length first.
+void output_flush(struct output *const self) {
+	if (self->framed && self->used) {
+		const char length[4] = {(char) self->used, (char) (self->used >> 8), (char) (self->used >> 16), (char) (self->used >> 24)};
+		output_write(self, length, 4);
+	}
+	output_write(self, self->buffer, self->used);
+	self->flushed += self->used;
+	self->used = 0;
+}
+
+// Return where a line (or a record) of at most TURTLE_OUTPUT_LINE_MAX bytes can be written.
+// The buffer is allocated at the first call, it's flushed when the line may not fit.
+// Return null when the buffer can't be allocated, the output is then failing with ENOMEM.
+static char *output_reserve(struct output *const self) {
+	if (self->buffer == 0) {
+		self->buffer = malloc(self->capacity);
+		if (self->buffer == 0) {
+			self->error_number = ENOMEM;
+			return 0;
+		}
+	}
+	if (self->capacity - self->used < TURTLE_OUTPUT_LINE_MAX)
+		output_flush(self);
+	return self->buffer + self->used;
+}
+
+// The magnitude is multiplied by 10^4, fma gives the exact error of this product.
+// So the rounding to 4 decimals is decided like printf does, using the exact binary value (ties to even).
+static bool output_round(const double magnitude, uint64_t *const rounded) {
+	if (!(magnitude < OUTPUT_FIXED_MAX))
+		return false;
+	const double scaled = magnitude * 1e4;
+	const double error = fma(magnitude, 1e4, -scaled);
+	const double floor_scaled = floor(scaled);
+	const double fraction = scaled - floor_scaled; // exact, both are on the same grid
+	*rounded = (uint64_t) floor_scaled;
+	if (fraction > 0.5 || (fraction == 0.5 && (error > 0 || (error == 0 && (*rounded & 1)))))
+		++*rounded;
+	return true;
+}
+
+bool output_fixed_point(const double value, int64_t *const fixed) {
+	uint64_t rounded;
+	if (!output_round(fabs(value), &rounded))
+		return false;
+	*fixed = signbit(value) ? -(int64_t) rounded : (int64_t) rounded;
+	return true;
+}
+
+// NaN, infinities and very large numbers are delegated to snprintf.
+size_t output_format_fixed(char *const dest, const double value) {
+	uint64_t n;
+	if (!output_round(fabs(value), &n))
+		return (size_t) snprintf(dest, TURTLE_OUTPUT_LINE_MAX / 3, "%7.4f", value);
+	char digits[32];
+	size_t count = 0;
+	for (int i = 0 ; i < 4 ; ++i, n /= 10)
+		digits[count++] = (char) ('0' + n % 10);
+	digits[count++] = '.';
+	do {
+		digits[count++] = (char) ('0' + n % 10);
+		n /= 10;
+	} while (n);
+	if (signbit(value))
+		digits[count++] = '-';
+	size_t length = 0;
+	for (; count + length < 7 ; ++length)
+		dest[length] = ' ';
+	while (count)
+		dest[length++] = digits[--count];
+	return length;
+}
+
+/*
+ * binary format
+ */
+
+static char *binary_uint16(char *p, const uint64_t value) {
+	*p++ = (char) (value & 0xFF);
+	*p++ = (char) (value >> 8 & 0xFF);
+	return p;
+}
+
+static char *binary_double(char *p, const double value) {
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	for (int i = 0 ; i < 8 ; ++i, bits >>= 8)
+		*p++ = (char) (bits & 0xFF);
+	return p;
+}
+
+// The signed difference is zigzag encoded, so small negative numbers are small varints too.
+static char *binary_varint(char *p, const int64_t value) {
+	uint64_t zigzag = ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+	while (zigzag >= 0x80) {
+		*p++ = (char) ((zigzag & 0x7F) | 0x80);
+		zigzag >>= 7;
+	}
+	*p++ = (char) zigzag;
+	return p;
+}
+
+// Return where a record can be written, the header is written before the first record.
+static char *binary_reserve(struct output *const self) {
+	char *p = output_reserve(self);
+	if (p && !self->started) {
+		memcpy(p, "TRTB", 4);
+		p[4] = OUTPUT_BINARY_VERSION;
+		p[5] = OUTPUT_BINARY_DECIMALS;
+		self->used += 6;
+		self->started = true;
+		p += 6;
+	}
+	return p;
+}
+
+static void binary_color(struct output *const self, const double r, const double g, const double b) {
+	char *const record = binary_reserve(self);
+	if (record == 0)
+		return;
+	const double channels[3] = {r, g, b};
+	int64_t fixed[3];
+	char *p = record + 1;
+	unsigned char opcode = OUTPUT_OP_COLOR;
+	bool raw = false;
+	for (int i = 0 ; i < 3 ; ++i)
+		raw = raw || !output_fixed_point(channels[i], fixed + i) || fixed[i] < 0 || fixed[i] > 0xFFFF;
+	for (int i = 0 ; i < 3 ; ++i) {
+		if (raw)
+			p = binary_double(p, channels[i]);
+		else {
+			p = binary_uint16(p, (uint64_t) fixed[i]);
+			if (fixed[i] == 0 && signbit(channels[i]))
+				opcode |= OUTPUT_FLAG_NEGATIVE_ZERO << i;
+		}
+	}
+	*record = (char) (raw ? opcode | OUTPUT_FLAG_RAW : opcode);
+	self->used += (size_t) (p - record);
+}
+
+static void binary_move(struct output *const self, const bool up, const double x, const double y) {
+	char *const record = binary_reserve(self);
+	if (record == 0)
+		return;
+	char *p = record + 1;
+	unsigned char opcode = up ? OUTPUT_OP_MOVE_TO : OUTPUT_OP_LINE_TO;
+	int64_t fixed_x, fixed_y;
+	if (output_fixed_point(x, &fixed_x) && output_fixed_point(y, &fixed_y)) {
+		p = binary_varint(p, fixed_x - self->x);
+		p = binary_varint(p, fixed_y - self->y);
+		if (fixed_x == 0 && signbit(x))
+			opcode |= OUTPUT_FLAG_NEGATIVE_ZERO;
+		if (fixed_y == 0 && signbit(y))
+			opcode |= OUTPUT_FLAG_NEGATIVE_ZERO << 1;
+		self->x = fixed_x;
+		self->y = fixed_y;
+	} else {
+		opcode |= OUTPUT_FLAG_RAW;
+		p = binary_double(p, x);
+		p = binary_double(p, y);
+	}
+	*record = (char) opcode;
+	self->used += (size_t) (p - record);
+}
+
+/*
+ * SVG format
+ */
+
+// Round a coordinate to the decimals of the SVG, return false if it's not drawable.
+static bool svg_fixed(const struct output *const self, const double value, int64_t *const fixed) {
+	const double scaled = value * (double) self->svg.scale;
+	if (!(fabs(scaled) < 9007199254740992.0))
+		return false;
+	*fixed = llround(scaled);
+	return true;
+}
+
+// Write a rounded coordinate without its trailing zeros, return the number of bytes written.
+static size_t svg_number(char *const dest, const int64_t value, const unsigned int decimals) {
+	uint64_t n = value < 0 ? -(uint64_t) value : (uint64_t) value;
+	char digits[32];
+	size_t count = 0;
+	unsigned int i = 0;
+	for (; i < decimals && n % 10 == 0 ; ++i)
+		n /= 10;
+	const bool fraction = i < decimals;
+	for (; i < decimals ; ++i, n /= 10)
+		digits[count++] = (char) ('0' + n % 10);
+	if (fraction)
+		digits[count++] = '.';
+	do {
+		digits[count++] = (char) ('0' + n % 10);
+		n /= 10;
+	} while (n);
+	if (value < 0)
+		digits[count++] = '-';
+	for (size_t length = 0 ; length < count ; ++length)
+		dest[length] = digits[count - 1 - length];
+	return count;
+}
+
+static char *svg_pair(char *p, const struct output *const self, const int64_t x, const int64_t y) {
+	p += svg_number(p, x, self->svg.decimals);
+	*p++ = ' ';
+	return p + svg_number(p, y, self->svg.decimals);
+}
+
+// Write the viewBox attribute into its reserved bytes, the window of the viewer when nothing is drawn.
+static void svg_viewbox(const struct output *const self, char *const dest) {
+	const struct output_svg *const svg = &self->svg;
+	char *p = dest;
+	memcpy(p, "viewBox=\"", 9);
+	p += 9;
+	if (svg->bounded) {
+		const int64_t margin = svg->scale; // half a line
+		p = svg_pair(p, self, svg->min_x - margin, svg->min_y - margin);
+		*p++ = ' ';
+		p = svg_pair(p, self, svg->max_x - svg->min_x + 2 * margin, svg->max_y - svg->min_y + 2 * margin);
+	} else {
+		memcpy(p, "-500 -500 1000 1000", 19);
+		p += 19;
+	}
+	*p++ = '"';
+	memset(p, ' ', OUTPUT_SVG_VIEWBOX_SIZE - (size_t) (p - dest));
+}
+
+// Return where some commands can be written, the header is written first.
+static char *svg_reserve(struct output *const self) {
+	static const char before[] = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg xmlns=\"http://www.w3.org/2000/svg\" ";
+	static const char after[] = " fill=\"none\" stroke-width=\"2\" stroke-linecap=\"round\" stroke-linejoin=\"round\">\n";
+	char *p = output_reserve(self);
+	if (p && !self->started) {
+		struct output_svg *const svg = &self->svg;
+		svg->scale = 1;
+		for (unsigned int i = 0 ; i < svg->decimals ; ++i)
+			svg->scale *= 10;
+		// the stream can be rewritten in its file when it's seekable, unless it's appended (pwrite would append too)
+		const int flags = fcntl(self->fd, F_GETFL);
+		svg->file_offset = flags < 0 || (flags & O_APPEND) ? -1 : (long long int) lseek(self->fd, 0, SEEK_CUR);
+		memcpy(p, before, sizeof(before) - 1);
+		p += sizeof(before) - 1;
+		svg->viewbox = self->flushed + self->used + (sizeof(before) - 1);
+		svg_viewbox(self, p);
+		p += OUTPUT_SVG_VIEWBOX_SIZE;
+		memcpy(p, after, sizeof(after) - 1);
+		p += sizeof(after) - 1;
+		self->used = (size_t) (p - self->buffer);
+		self->started = true;
+	}
+	return p;
+}
+
+static void svg_bound(struct output_svg *const svg, const int64_t x, const int64_t y) {
+	if (!svg->bounded) {
+		svg->min_x = svg->max_x = x;
+		svg->min_y = svg->max_y = y;
+		svg->bounded = true;
+	}
+	svg->min_x = x < svg->min_x ? x : svg->min_x;
+	svg->max_x = x > svg->max_x ? x : svg->max_x;
+	svg->min_y = y < svg->min_y ? y : svg->min_y;
+	svg->max_y = y > svg->max_y ? y : svg->max_y;
+}
+
+static uint32_t svg_channel(const double value) {
+	return value > 0 ? value < 1 ? (uint32_t) (value * 255 + 0.5) : 255 : 0;
+}
+
+static void svg_color(struct output *const self, const double r, const double g, const double b) {
+	self->svg.color = svg_channel(r) << 16 | svg_channel(g) << 8 | svg_channel(b);
+}
+
+// A LineTo continues the path of its color, a new path starts with an absolute MoveTo.
+static void svg_move(struct output *const self, const bool up, const double x, const double y) {
+	char *const start = svg_reserve(self);
+	if (start == 0)
+		return;
+	struct output_svg *const svg = &self->svg;
+	int64_t fx = 0, fy = 0;
+	const bool valid = svg_fixed(self, x, &fx) && svg_fixed(self, y, &fy);
+	if (up || !valid || !svg->pen_valid) {
+		svg->pen_valid = valid;
+		svg->pen_x = fx;
+		svg->pen_y = fy;
+		return;
+	}
+	char *p = start;
+	if (svg->path_open && svg->path_color != svg->color) {
+		memcpy(p, "\"/>\n", 4);
+		p += 4;
+		svg->path_open = false;
+	}
+	if (!svg->path_open) {
+		p += sprintf(p, "<path stroke=\"#%06x\" d=\"M", (unsigned int) svg->color);
+		p = svg_pair(p, self, svg->pen_x, svg->pen_y);
+		svg->path_open = true;
+		svg->path_color = svg->color;
+		svg->line_command = false;
+		svg->path_x = svg->pen_x;
+		svg->path_y = svg->pen_y;
+		svg_bound(svg, svg->pen_x, svg->pen_y);
+	} else if (svg->path_x != svg->pen_x || svg->path_y != svg->pen_y) {
+		*p++ = 'm';
+		p = svg_pair(p, self, svg->pen_x - svg->path_x, svg->pen_y - svg->path_y);
+		svg->line_command = false;
+		svg_bound(svg, svg->pen_x, svg->pen_y);
+	}
+	// the long paths are cut into lines of 16 segments
+	*p++ = svg->line_command ? ++svg->path_segments % 16 ? ' ' : '\n' : 'l';
+	p = svg_pair(p, self, fx - svg->pen_x, fy - svg->pen_y);
+	svg->line_command = true;
+	svg_bound(svg, fx, fy);
+	svg->path_x = svg->pen_x = fx;
+	svg->path_y = svg->pen_y = fy;
+	self->used += (size_t) (p - start);
+}
+
+// Close the document, then write its viewBox in the buffer if it's still there, otherwise in the file.
+static void svg_destroy(struct output *const self) {
+	char *p = svg_reserve(self);
+	if (p == 0)
+		return;
+	if (self->svg.path_open) {
+		memcpy(p, "\"/>\n", 4);
+		p += 4;
+	}
+	memcpy(p, "</svg>\n", 7);
+	self->used = (size_t) (p + 7 - self->buffer);
+	const bool buffered = self->svg.viewbox >= self->flushed;
+	if (buffered)
+		svg_viewbox(self, self->buffer + (self->svg.viewbox - self->flushed));
+	output_flush(self);
+	if (!buffered && self->svg.file_offset >= 0 && self->error_number == 0) {
+		char viewbox[OUTPUT_SVG_VIEWBOX_SIZE];
+		svg_viewbox(self, viewbox);
+		if (pwrite(self->fd, viewbox, OUTPUT_SVG_VIEWBOX_SIZE, (off_t) (self->svg.file_offset + (long long int) self->svg.viewbox)) != OUTPUT_SVG_VIEWBOX_SIZE)
+			self->error_number = errno ? errno : EIO;
+	}
+}
+
+/*
+ * text format
+ */
+
+// The other formats are dispatched by a single test, OUTPUT_NONE is writing nothing.
+void output_color(struct output *const self, const double r, const double g, const double b) {
+	if (self->format != OUTPUT_TEXT) {
+		if (self->format == OUTPUT_BINARY)
+			binary_color(self, r, g, b);
+		else if (self->format == OUTPUT_SVG)
+			svg_color(self, r, g, b);
+		return;
+	}
+	char *const line = output_reserve(self);
+	if (line == 0)
+		return;
+	char *p = line;
+	memcpy(p, "Color\t", 6);
+	p += 6;
+	p += output_format_fixed(p, r);
+	*p++ = ' ';
+	p += output_format_fixed(p, g);
+	*p++ = ' ';
+	p += output_format_fixed(p, b);
+	*p++ = '\n';
+	self->used += (size_t) (p - line);
+}
+
+void output_move(struct output *const self, const bool up, const double x, const double y) {
+	if (self->format != OUTPUT_TEXT) {
+		if (self->format == OUTPUT_BINARY)
+			binary_move(self, up, x, y);
+		else if (self->format == OUTPUT_SVG)
+			svg_move(self, up, x, y);
+		return;
+	}
+	char *const line = output_reserve(self);
+	if (line == 0)
+		return;
+	char *p = line;
+	memcpy(p, up ? "MoveTo\t" : "LineTo\t", 7);
+	p += 7;
+	p += output_format_fixed(p, x);
+	*p++ = ' ';
+	p += output_format_fixed(p, y);
+	*p++ = '\n';
+	self->used += (size_t) (p - line);
+}
+
+// The binary format is always complete, with its header and its end record, so is the SVG format.
+void output_destroy(struct output *const self) {
+	if (self->format == OUTPUT_BINARY) {
+		char *const p = binary_reserve(self);
+		if (p) {
+			*p = OUTPUT_OP_END;
+			++self->used;
+		}
+	} else if (self->format == OUTPUT_SVG)
+		svg_destroy(self);
+	if (self->buffer)
+		output_flush(self);
+	free(self->buffer);
+	self->buffer = 0;
+}
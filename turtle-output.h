@@ -0,0 +1,116 @@
+#ifndef TURTLE_OUTPUT_H
+#define TURTLE_OUTPUT_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TURTLE_OUTPUT_BUFFER_SIZE	1048576
+#define TURTLE_OUTPUT_BUFFER_MAX	1073741824 // the largest buffer accepted by --buffer-size (1 GiB)
+#define TURTLE_OUTPUT_LINE_MAX		1024
+
+// The text format is the protocol read by the turtle viewer (Color, MoveTo and LineTo lines).
+// The binary format is more compact, turtle-decode turns it back into the text format.
+// The SVG format is a vector image, for the web.
+// Nothing is written with OUTPUT_NONE, turtle-bench uses it to time the evaluators without the writer.
+enum output_format {
+	OUTPUT_TEXT, OUTPUT_BINARY, OUTPUT_SVG, OUTPUT_NONE,
+};
+
+/*
+ * The binary format (version 1) starts with a header :
+ * - the 4 bytes "TRTB", the version byte, the number of decimals byte (4, the precision of the text format).
+ * Then every record starts with an opcode byte, the low bits give the instruction :
+ * - OUTPUT_OP_END, the last record of the stream.
+ * - OUTPUT_OP_COLOR, followed by the packed red, green and blue channels, 3 little-endian 16 bits fixed-point numbers.
+ * - OUTPUT_OP_MOVE_TO and OUTPUT_OP_LINE_TO, followed by the difference with the previous fixed-point position (x then y),
+ *   both zigzag encoded into unsigned LEB128 varints (the initial position is 0, 0).
+ * The high bits of the opcode are flags :
+ * - OUTPUT_FLAG_RAW, the numbers are written as little-endian IEEE 754 doubles instead (NaN, infinities, very large numbers),
+ *   a raw position doesn't change the previous fixed-point position.
+ * - OUTPUT_FLAG_NEGATIVE_ZERO << i, the number i is a negative number rounded to zero, its text is "-0.0000".
+ */
+#define OUTPUT_BINARY_VERSION		1
+#define OUTPUT_BINARY_DECIMALS		4
+#define OUTPUT_OP_END				0x00
+#define OUTPUT_OP_COLOR				0x01
+#define OUTPUT_OP_MOVE_TO			0x02
+#define OUTPUT_OP_LINE_TO			0x03
+#define OUTPUT_OP_MASK				0x0F
+#define OUTPUT_FLAG_NEGATIVE_ZERO	0x10
+#define OUTPUT_FLAG_RAW				0x80
+
+/*
+ * The SVG format is streamed, its memory doesn't depend on the size of the drawing :
+ * - the consecutive segments of the same color are a single <path>, its commands are relative (l and m)
+ *   to the coordinates rounded to a number of decimals (--svg-decimals), so the rounding doesn't accumulate,
+ * - a MoveTo is only written before the next LineTo, a point which can't be rounded (NaN, infinities, very large
+ *   numbers) isn't drawn, neither are the segments ending on it,
+ * - the lines are 2 units wide with round ends, like the viewer's, the y axis goes down like the viewer's,
+ * - the viewBox is the bounds of the drawing (plus half a line), they are only known at the end : the header
+ *   reserves OUTPUT_SVG_VIEWBOX_SIZE bytes which are rewritten when the output is destroyed, in the buffer or in
+ *   the file. A pipe which was flushed can't be rewritten, the viewBox stays the window of the viewer.
+ */
+#define OUTPUT_SVG_DECIMALS_DEFAULT	2
+#define OUTPUT_SVG_DECIMALS_MAX		6
+#define OUTPUT_SVG_VIEWBOX_SIZE		100
+
+struct output_svg {
+	unsigned int decimals;
+	int64_t scale; // 10^decimals
+	uint32_t color; // the color given, 0xRRGGBB
+	uint32_t path_color;
+	bool path_open;
+	bool line_command; // the last command of the path is a 'l', the next one doesn't repeat it
+	size_t path_segments;
+	bool pen_valid; // the position given, rounded
+	int64_t pen_x;
+	int64_t pen_y;
+	int64_t path_x; // the position reached by the path
+	int64_t path_y;
+	bool bounded; // the bounds of the drawn points
+	int64_t min_x;
+	int64_t min_y;
+	int64_t max_x;
+	int64_t max_y;
+	size_t viewbox; // the position of the viewBox in the stream
+	long long int file_offset; // the position of the stream in its file, -1 if it can't be rewritten
+};
+
+// The drawing instructions are written into a large buffer, flushed using write(2) when it's full.
+struct output {
+	char *buffer;
+	size_t used;
+	size_t capacity; // the requested size of the buffer, it's allocated at the first write
+	int fd;
+	int error_number;
+	enum output_format format;
+	bool started; // format == OUTPUT_BINARY or OUTPUT_SVG, the header is written
+	int64_t x; // format == OUTPUT_BINARY, the previous fixed-point position
+	int64_t y;
+	bool framed; // each flush is a chunk prefixed by its length, for the server (see turtle-serve.h)
+	size_t flushed; // the bytes written by the flushes
+	struct output_svg svg; // format == OUTPUT_SVG
+};
+
+// prepare an output writing to a file descriptor, nothing is allocated
+void output_create(struct output *self, int fd, size_t capacity);
+
+// write what's remaining in the buffer
+void output_flush(struct output *self);
+
+// flush and release the buffer
+void output_destroy(struct output *self);
+
+// the lines of the protocol read by the turtle viewer
+void output_color(struct output *self, double r, double g, double b);
+void output_move(struct output *self, bool up, double x, double y);
+
+// write a number like printf("%7.4f") does, return the number of bytes written (at most TURTLE_OUTPUT_LINE_MAX / 3)
+size_t output_format_fixed(char *dest, double value);
+
+// round a number to 4 decimals like printf("%7.4f") does, the result is in units of 10^-4
+// return false if the number is too large to be exactly converted (NaN and infinities included)
+bool output_fixed_point(double value, int64_t *fixed);
+
+#endif /* TURTLE_OUTPUT_H */
@@ -3,8 +3,6 @@
 
 #include "turtle-ast.h"
 
-int yylex();
-void yyerror(struct ast *ast, const char *);
 #define YYDEBUG 1
 %}
 
@@ -13,11 +11,14 @@ void yyerror(struct ast *ast, const char *);
 
 %define parse.error verbose
 
-/* the lexer know the existence of the AST by using a global variable
-it's needed because i'm using a BST helper */
+/* the parser is pure, the lexer and the parser are given the state of the scanner
+and the AST (the lexer needs it because i'm using a BST helper) */
 
-%lex-param { struct ast *ast }
-%parse-param { struct ast *ast }
+%define api.pure full
+%param { void *scanner } { struct ast *ast }
+
+/* the locations give the line of each command to its node (see --profile) */
+%locations
 
 /* i created my types :
  - the bst_entry is used to provide some O(log(n)) solutions to my user
@@ -31,6 +32,11 @@ it's needed because i'm using a BST helper */
   struct ast_node * node ;
 }
 
+%code {
+int yylex(YYSTYPE *lvalp, YYLTYPE *llocp, void *scanner, struct ast *ast);
+void yyerror(YYLTYPE *llocp, void *scanner, struct ast *ast, const char *);
+}
+
 /* the list of tokens i'm using */
 
 %token <value>		VALUE		"value"
@@ -58,14 +64,38 @@ it's needed because i'm using a BST helper */
 %token			KW_PROC
 %token			KW_REPEAT
 %token			KW_SET
-
-/* what i think about precedence, maybe some of them are useless */
+%token			KW_IF
+%token			KW_ELSE
+%token			KW_WHILE
+%token			KW_AND
+%token			KW_OR
+%token			KW_NOT
+
+/* the comparisons of two characters, '<' and '>' are characters */
+%token			CMP_LE		"<="
+%token			CMP_GE		">="
+%token			CMP_EQ		"=="
+%token			CMP_NE		"!="
+
+/* returned by the lexer for an unknown character, it's a syntax error */
+%token			UNKNOWN
+
+/* an else belongs to the closest if */
+%nonassoc THEN
+%nonassoc KW_ELSE
+
+/* what i think about precedence, maybe some of them are useless
+the comparisons can't be chained, "not" is applied after them (not A < B is not (A < B)) */
+%left KW_OR
+%left KW_AND
+%right KW_NOT
+%nonassoc '<' '>' CMP_LE CMP_GE CMP_EQ CMP_NE
 %left '+' '-'
 %left '*' '/'
 %right '^'
 %nonassoc UNOP
 
-%type <node> unit cmds cmd  cmd1  cmd2 cmd3 cmd4 expr
+%type <node> unit cmds cmd  cmd1  cmd2 cmd3 cmd4 expr params names args exprs
 
 %%
 
@@ -76,62 +106,99 @@ cmds:
 	cmd cmds		{ if ($1) { $1->next = $2; $$ = $1; } else { ast -> error_number = 1 ; YYERROR; } ; }
 | /* empty */			{ $$ = NULL ; }
 
-/* i divided the commands in 4 groups, it's useless but it work */
+/* i divided the commands in 4 groups, it's useless but it work, a command is on the line of its first token */
 cmd:
-cmd1 | cmd2 | cmd3 | cmd4
+	cmd1					{ $$ = $1; if ($$) $$->line = @1.first_line;					}
+|	cmd2					{ $$ = $1; if ($$) $$->line = @1.first_line;					}
+|	cmd3					{ $$ = $1; if ($$) $$->line = @1.first_line;					}
+|	cmd4					{ $$ = $1; if ($$) $$->line = @1.first_line;					}
 
 /* the very simple commands */
 cmd1:
-	KW_UP					{ $$ = make_up(); 							}
-|	KW_DOWN					{ $$ = make_down(); 							}
-|	KW_COLOR	COLOR			{ $$ = make_color($2);							}
-|	KW_HOME					{ $$ = make_home(); 							}
+	KW_UP					{ $$ = make_up(ast); 							}
+|	KW_DOWN					{ $$ = make_down(ast); 							}
+|	KW_COLOR	COLOR			{ $$ = make_color(ast, $2);							}
+|	KW_HOME					{ $$ = make_home(ast); 							}
 
 /* the more complex commands, a command is also a block of commands */
 cmd2:
-	'{' cmds '}'				{ $$ = make_cmds_block($2);						}
-|	KW_PROC		BST_ENTRY	cmd	{ $$ = make_proc($2, $3); 						}
-|	KW_REPEAT	expr	cmd		{ $$ = make_repeat($2, $3) ;						}
+	'{' cmds '}'				{ $$ = make_cmds_block(ast, $2);						}
+|	KW_PROC		BST_ENTRY	cmd	{ $$ = make_proc(ast, $2, NULL, $3); 					}
+|	KW_PROC		BST_ENTRY '(' params ')' cmd	{ $$ = make_proc(ast, $2, $4, $6); 				}
+|	KW_REPEAT	expr	cmd		{ $$ = make_repeat(ast, $2, $3) ;						}
+|	KW_IF		expr	cmd %prec THEN	{ $$ = make_if(ast, $2, $3, NULL) ;						}
+|	KW_IF		expr	cmd KW_ELSE cmd	{ $$ = make_if(ast, $2, $3, $5) ;						}
+|	KW_WHILE	expr	cmd		{ $$ = make_while(ast, $2, $3) ;						}
 
 /* the other commands are using expr */
 cmd3:
-	KW_COLOR	expr ',' expr ',' expr	{ $$ = make_raw_color($2, $4, $6);					}
-|	KW_LEFT		expr			{ $$ = make_left($2); 							}
-|	KW_RIGHT	expr			{ $$ = make_right($2); 							}
-|	KW_HEADING	expr			{ $$ = make_heading($2); 						}
-|	KW_POSITION	expr ',' expr		{ $$ = make_position($2, $4); 						}
-|	KW_PRINT	expr			{ $$ = make_print($2); 							}
-|	KW_SET		BST_ENTRY	expr	{ $$ = make_set($2, $3); 						}
-|	KW_FORWARD	expr			{ $$ = make_forward($2); 						}
-|	KW_BACKWARD	expr			{ $$ = make_backward($2); 						}
-
-/* the last command is call */
+	KW_COLOR	expr ',' expr ',' expr	{ $$ = make_raw_color(ast, $2, $4, $6);					}
+|	KW_LEFT		expr			{ $$ = make_left(ast, $2); 							}
+|	KW_RIGHT	expr			{ $$ = make_right(ast, $2); 							}
+|	KW_HEADING	expr			{ $$ = make_heading(ast, $2); 						}
+|	KW_POSITION	expr ',' expr		{ $$ = make_position(ast, $2, $4); 						}
+|	KW_PRINT	expr			{ $$ = make_print(ast, $2); 							}
+|	KW_SET		BST_ENTRY	expr	{ $$ = make_set(ast, $2, $3); 						}
+|	KW_FORWARD	expr			{ $$ = make_forward(ast, $2); 						}
+|	KW_BACKWARD	expr			{ $$ = make_backward(ast, $2); 						}
+
+/* the last command is call, with its arguments between parentheses (like the parameters of proc) */
 cmd4:
-	KW_CALL		BST_ENTRY		{ $$ = make_call($2); 							}
+	KW_CALL		BST_ENTRY		{ $$ = make_call(ast, $2, NULL); 						}
+|	KW_CALL		BST_ENTRY '(' args ')'	{ $$ = make_call(ast, $2, $4); 						}
+
+/* the parameters and the arguments are linked lists separated by commas, they may be empty */
+params:
+	names					{ $$ = $1; }
+| /* empty */				{ $$ = NULL ; }
+
+names:
+	BST_ENTRY				{ if (($$ = make_name(ast, $1)) == NULL) { ast -> error_number = 1 ; YYERROR; } ; }
+|	BST_ENTRY ',' names			{ if (($$ = make_name(ast, $1))) $$->next = $3; else { ast -> error_number = 1 ; YYERROR; } ; }
+
+args:
+	exprs					{ $$ = $1; }
+| /* empty */				{ $$ = NULL ; }
+
+exprs:
+	expr					{ if (($$ = make_arg(ast, $1)) == NULL) { ast -> error_number = 1 ; YYERROR; } ; }
+|	expr ',' exprs				{ if (($$ = make_arg(ast, $1))) $$->next = $3; else { ast -> error_number = 1 ; YYERROR; } ; }
 
 /* one expr is described like this :
 the final value of an expr is always a double,
 maybe after a complex recursive resolution */
 expr:
-	VALUE					{ $$ = make_value($1);							}
-|	BST_ENTRY				{ $$ = make_name($1);							}
-|	expr  '+'  expr				{ $$ = make_binop('+', $1, $3);						}
-|	expr  '-'  expr				{ $$ = make_binop('-', $1, $3);						}
-|	expr  '*'  expr				{ $$ = make_binop('*', $1, $3);						}
-|	expr  '/'  expr				{ $$ = make_binop('/', $1, $3);						}
-|	expr  '^'  expr				{ $$ = make_binop('^', $1, $3);						}
-|	'('  expr  ')'				{ $$ = make_expr_block($2);						}
-|	'-'  expr %prec UNOP			{ $$ = make_unop('-', $2);						}
-|	'+'  expr %prec UNOP			{ $$ = make_unop('+', $2);						}
-|	KW_COS		'(' expr ')'		{ $$ = make_math_func(FUNC_COS, $3);					}
-|	KW_SIN		'(' expr ')'		{ $$ = make_math_func(FUNC_SIN, $3);			 		}
-|	KW_TAN		'(' expr ')'		{ $$ = make_math_func(FUNC_TAN, $3);			 		}
-|	KW_SQRT		'(' expr ')'		{ $$ = make_math_func(FUNC_SQRT, $3);			 		}
-|	KW_RANDOM	'(' expr ',' expr ')'	{ $$ = make_random($3, $5);		 				}
+	VALUE					{ $$ = make_value(ast, $1);							}
+|	BST_ENTRY				{ $$ = make_name(ast, $1);							}
+|	expr  '+'  expr				{ $$ = make_binop(ast, '+', $1, $3);						}
+|	expr  '-'  expr				{ $$ = make_binop(ast, '-', $1, $3);						}
+|	expr  '*'  expr				{ $$ = make_binop(ast, '*', $1, $3);						}
+|	expr  '/'  expr				{ $$ = make_binop(ast, '/', $1, $3);						}
+|	expr  '^'  expr				{ $$ = make_binop(ast, '^', $1, $3);						}
+|	expr  '<'  expr				{ $$ = make_test(ast, TEST_LT, $1, $3);					}
+|	expr  CMP_LE  expr			{ $$ = make_test(ast, TEST_LE, $1, $3);					}
+|	expr  CMP_EQ  expr			{ $$ = make_test(ast, TEST_EQ, $1, $3);					}
+|	expr  CMP_NE  expr			{ $$ = make_test(ast, TEST_NE, $1, $3);					}
+|	expr  '>'  expr				{ $$ = make_test(ast, TEST_GT, $1, $3);					}
+|	expr  CMP_GE  expr			{ $$ = make_test(ast, TEST_GE, $1, $3);					}
+|	expr  KW_AND  expr			{ $$ = make_test(ast, TEST_AND, $1, $3);					}
+|	expr  KW_OR  expr			{ $$ = make_test(ast, TEST_OR, $1, $3);					}
+|	KW_NOT  expr				{ $$ = make_test(ast, TEST_NOT, $2, NULL);					}
+|	'('  expr  ')'				{ $$ = make_expr_block(ast, $2);						}
+|	'-'  expr %prec UNOP			{ $$ = make_unop(ast, '-', $2);						}
+|	'+'  expr %prec UNOP			{ $$ = make_unop(ast, '+', $2);						}
+|	KW_COS		'(' expr ')'		{ $$ = make_math_func(ast, FUNC_COS, $3);					}
+|	KW_SIN		'(' expr ')'		{ $$ = make_math_func(ast, FUNC_SIN, $3);			 		}
+|	KW_TAN		'(' expr ')'		{ $$ = make_math_func(ast, FUNC_TAN, $3);			 		}
+|	KW_SQRT		'(' expr ')'		{ $$ = make_math_func(ast, FUNC_SQRT, $3);			 		}
+|	KW_RANDOM	'(' expr ',' expr ')'	{ $$ = make_random(ast, $3, $5);		 				}
 
 %%
 
-void yyerror(struct ast *ast, const char *msg) {
-  (void) ast;
-  fprintf(stderr, "%s\n", msg);
+// The lexer already told about an unknown token.
+void yyerror(YYLTYPE *llocp, void *scanner, struct ast *ast, const char *msg) {
+  (void) llocp;
+  (void) scanner;
+  if (ast->error_number == 0)
+    fprintf(stderr, "%s\n", msg);
 }
@@ -0,0 +1,249 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "turtle-png.h"
+
+/*
+ * deflate (RFC 1951), the bits are packed from the least significant one, the Huffman codes from their first bit
+ */
+
+struct png_bits {
+	uint8_t *bytes;
+	size_t used;
+	size_t capacity;
+	uint64_t buffer; // the pending bits
+	int count;
+	bool failed; // an allocation failed, the stream is incomplete
+};
+
+static const uint16_t png_length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t png_length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t png_distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t png_distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static void png_byte(struct png_bits *const self, const uint8_t byte) {
+	if (self->used == self->capacity) {
+		const size_t capacity = self->capacity ? 2 * self->capacity : 65536;
+		uint8_t *const bytes = realloc(self->bytes, capacity);
+		if (bytes == 0) {
+			self->failed = true;
+			return;
+		}
+		self->bytes = bytes;
+		self->capacity = capacity;
+	}
+	self->bytes[self->used++] = byte;
+}
+
+static void png_put(struct png_bits *const self, const uint32_t value, const int count) {
+	self->buffer |= (uint64_t) value << self->count;
+	self->count += count;
+	for (; self->count >= 8 ; self->count -= 8, self->buffer >>= 8)
+		png_byte(self, (uint8_t) self->buffer);
+}
+
+// pad the last byte with zeros
+static void png_align(struct png_bits *const self) {
+	if (self->count)
+		png_put(self, 0, 8 - self->count);
+}
+
+static void png_code(struct png_bits *const self, const uint32_t code, const int length) {
+	uint32_t reversed = 0;
+	for (int i = 0 ; i < length ; ++i)
+		reversed |= ((code >> i) & 1) << (length - 1 - i);
+	png_put(self, reversed, length);
+}
+
+// a literal, the end of block (256) or a length (257 to 285), using the fixed Huffman codes
+static void png_symbol(struct png_bits *const self, const int symbol) {
+	if (symbol < 144)
+		png_code(self, 0x30 + symbol, 8);
+	else if (symbol < 256)
+		png_code(self, 0x190 + symbol - 144, 9);
+	else if (symbol < 280)
+		png_code(self, symbol - 256, 7);
+	else
+		png_code(self, 0xC0 + symbol - 280, 8);
+}
+
+static void png_match(struct png_bits *const self, const size_t length, const size_t distance) {
+	int i = 28;
+	while (length < png_length_base[i])
+		--i;
+	png_symbol(self, 257 + i);
+	png_put(self, (uint32_t) (length - png_length_base[i]), png_length_extra[i]);
+	i = 29;
+	while (distance < png_distance_base[i])
+		--i;
+	png_code(self, (uint32_t) i, 5);
+	png_put(self, (uint32_t) (distance - png_distance_base[i]), png_distance_extra[i]);
+}
+
+static uint32_t png_hash(const uint8_t *const bytes) {
+	const uint32_t value = (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8 | (uint32_t) bytes[2] << 16;
+	return (value * 2654435761U) >> (32 - PNG_HASH_BITS);
+}
+
+// A block using the fixed codes, the matches may start in the previous blocks (head holds positions + 1).
+static void png_compress_block(struct png_bits *const bits, const uint8_t *const data, const size_t start, const size_t end, size_t *const head, const bool last) {
+	png_put(bits, last, 1);
+	png_put(bits, 1, 2);
+	for (size_t i = start ; i < end ;) {
+		size_t length = 0;
+		size_t from = 0;
+		if (end - i >= 3) {
+			const uint32_t hash = png_hash(data + i);
+			if (head[hash] && i - (head[hash] - 1) <= PNG_WINDOW_SIZE) {
+				from = head[hash] - 1;
+				const size_t limit = end - i < 258 ? end - i : 258;
+				while (length < limit && data[from + length] == data[i + length])
+					++length;
+			}
+			head[hash] = i + 1;
+		}
+		if (length >= 3) {
+			png_match(bits, length, i - from);
+			for (size_t k = i + 1 ; k < i + length && end - k >= 3 ; ++k)
+				head[png_hash(data + k)] = k + 1;
+			i += length;
+		} else
+			png_symbol(bits, data[i++]);
+	}
+	png_symbol(bits, 256);
+}
+
+static void png_store_block(struct png_bits *const bits, const uint8_t *const data, const size_t start, const size_t end, const bool last) {
+	const size_t size = end - start;
+	png_put(bits, last, 1);
+	png_put(bits, 0, 2);
+	png_align(bits);
+	png_put(bits, (uint32_t) size, 16);
+	png_put(bits, (uint32_t) (~size & 0xFFFF), 16);
+	for (size_t i = start ; i < end ; ++i)
+		png_byte(bits, data[i]);
+}
+
+// A zlib stream (RFC 1950) of the data.
+static int png_deflate(struct png_bits *const bits, const uint8_t *const data, const size_t size) {
+	size_t *const head = calloc((size_t) 1 << PNG_HASH_BITS, sizeof(size_t));
+	if (head == 0)
+		return ENOMEM;
+	png_byte(bits, 0x78);
+	png_byte(bits, 0x01);
+	for (size_t start = 0 ; start < size ; start += PNG_BLOCK_SIZE) {
+		const size_t end = size - start < PNG_BLOCK_SIZE ? size : start + PNG_BLOCK_SIZE;
+		const size_t used = bits->used;
+		const uint64_t buffer = bits->buffer;
+		const int count = bits->count;
+		png_compress_block(bits, data, start, end, head, end == size);
+		if (bits->used - used > end - start + 5) {
+			bits->used = used;
+			bits->buffer = buffer;
+			bits->count = count;
+			png_store_block(bits, data, start, end, end == size);
+		}
+	}
+	png_align(bits);
+	uint32_t a = 1, b = 0;
+	for (size_t i = 0 ; i < size ;) {
+		for (const size_t stop = size - i < 5552 ? size : i + 5552 ; i < stop ; ++i) {
+			a += data[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	const uint32_t adler = b << 16 | a;
+	for (int shift = 24 ; shift >= 0 ; shift -= 8)
+		png_byte(bits, (uint8_t) (adler >> shift));
+	free(head);
+	return bits->failed ? ENOMEM : 0;
+}
+
+/*
+ * PNG
+ */
+
+// Choose the filter of a row (None, Sub or Up) and write the filtered row, prefixed by its type.
+static void png_filter(uint8_t *const dest, const uint8_t *const row, const uint8_t *const previous, const size_t size) {
+	unsigned long long int sums[3] = {0, 0, 0};
+	for (size_t i = 0 ; i < size ; ++i) {
+		const uint8_t left = i >= 3 ? row[i - 3] : 0, up = previous ? previous[i] : 0;
+		const uint8_t values[3] = {row[i], (uint8_t) (row[i] - left), (uint8_t) (row[i] - up)};
+		for (int f = 0 ; f < 3 ; ++f)
+			sums[f] += values[f] < 128 ? values[f] : 256 - values[f];
+	}
+	const int filter = sums[1] < sums[0] && sums[1] <= sums[2] ? 1 : sums[2] < sums[0] ? 2 : 0;
+	dest[0] = (uint8_t) filter;
+	for (size_t i = 0 ; i < size ; ++i) {
+		const uint8_t left = i >= 3 ? row[i - 3] : 0, up = previous ? previous[i] : 0;
+		dest[1 + i] = (uint8_t) (row[i] - (filter == 1 ? left : filter == 2 ? up : 0));
+	}
+}
+
+static uint32_t png_crc(const uint32_t *const table, uint32_t crc, const uint8_t *const bytes, const size_t size) {
+	for (size_t i = 0 ; i < size ; ++i)
+		crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+static void png_uint32(uint8_t *const dest, const uint32_t value) {
+	dest[0] = (uint8_t) (value >> 24);
+	dest[1] = (uint8_t) (value >> 16);
+	dest[2] = (uint8_t) (value >> 8);
+	dest[3] = (uint8_t) value;
+}
+
+static bool png_chunk(FILE *const file, const uint32_t *const table, const char *const type, const uint8_t *const data, const size_t size) {
+	uint8_t header[8], footer[4];
+	png_uint32(header, (uint32_t) size);
+	memcpy(header + 4, type, 4);
+	const uint32_t crc = png_crc(table, png_crc(table, 0xFFFFFFFF, header + 4, 4), data, size) ^ 0xFFFFFFFF;
+	png_uint32(footer, crc);
+	return fwrite(header, 1, 8, file) == 8 && (size == 0 || fwrite(data, 1, size, file) == size) && fwrite(footer, 1, 4, file) == 4;
+}
+
+int png_write(FILE *const file, const uint8_t *const pixels, const size_t width, const size_t height) {
+	uint32_t table[256];
+	for (uint32_t n = 0 ; n < 256 ; ++n) {
+		uint32_t c = n;
+		for (int k = 0 ; k < 8 ; ++k)
+			c = c & 1 ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+		table[n] = c;
+	}
+	const size_t stride = 3 * width;
+	uint8_t *const rows = malloc(height * (stride + 1));
+	struct png_bits bits = {0};
+	if (rows == 0)
+		return ENOMEM;
+	for (size_t y = 0 ; y < height ; ++y)
+		png_filter(rows + y * (stride + 1), pixels + y * stride, y ? pixels + (y - 1) * stride : 0, stride);
+	int error = png_deflate(&bits, rows, height * (stride + 1));
+	free(rows);
+	if (error == 0 && bits.used > 0x7FFFFFFF)
+		error = EFBIG; // the largest chunk
+	if (error == 0) {
+		static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+		uint8_t header[13] = {0};
+		png_uint32(header, (uint32_t) width);
+		png_uint32(header + 4, (uint32_t) height);
+		header[8] = 8; // bits per channel
+		header[9] = 2; // RGB
+		errno = 0;
+		if (fwrite(signature, 1, 8, file) != 8 || !png_chunk(file, table, "IHDR", header, 13)
+				|| !png_chunk(file, table, "IDAT", bits.bytes, bits.used) || !png_chunk(file, table, "IEND", 0, 0))
+			error = errno ? errno : EIO;
+	}
+	free(bits.bytes);
+	return error;
+}
+
+int ppm_write(FILE *const file, const uint8_t *const pixels, const size_t width, const size_t height) {
+	errno = 0;
+	if (fprintf(file, "P6\n%zu %zu\n255\n", width, height) < 0 || fwrite(pixels, 3 * width, height, file) != height)
+		return errno ? errno : EIO;
+	return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef TURTLE_PNG_H
+#define TURTLE_PNG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PNG_BLOCK_SIZE		65535 // the bytes compressed together, a block which doesn't shrink is stored
+#define PNG_WINDOW_SIZE		32768 // the farthest match of the compressor
+#define PNG_HASH_BITS		15
+
+// The images of --render are written by a small self-contained PNG encoder (8 bits RGB, not interlaced) :
+// - each row is filtered by None, Sub or Up, the one giving the smallest sum of absolute differences,
+// - the rows are compressed into a single IDAT chunk, a zlib stream of deflate blocks using the fixed Huffman codes,
+//   the matches are found by a hash table of the last position of each 3 bytes sequence (no chains),
+// - a block is stored (not compressed) when its compressed form is larger.
+// This is far from zlib's ratio, but a drawing has long runs of the background and repeated rows.
+
+// write an image, the pixels are rows of red, green and blue bytes, return 0 on success or an errno value
+int png_write(FILE *file, const uint8_t *pixels, size_t width, size_t height);
+
+// write an image in the binary PPM format (P6), return 0 on success or an errno value
+int ppm_write(FILE *file, const uint8_t *pixels, size_t width, size_t height);
+
+#endif /* TURTLE_PNG_H */
@@ -0,0 +1,34 @@
+#include "turtle-prng.h"
+
+static uint64_t prng_rotate(const uint64_t value, const int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+void prng_seed(struct prng *const self, uint64_t seed) {
+	for (int i = 0 ; i < 4 ; ++i) {
+		uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		self->state[i] = z ^ (z >> 31);
+	}
+}
+
+uint64_t prng_next(struct prng *const self) {
+	uint64_t *const s = self->state;
+	const uint64_t result = prng_rotate(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = prng_rotate(s[3], 45);
+	return result;
+}
+
+// The 53 high bits divided by 2^53 - 1 reach 0 and 1 exactly, the rounding of the scaling can't leave [lo, hi].
+double prng_double(struct prng *const self, const double lo, const double hi) {
+	const double unit = (double) (prng_next(self) >> 11) / 9007199254740991.0;
+	const double value = lo + unit * (hi - lo);
+	return value < hi ? value : hi;
+}
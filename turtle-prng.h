@@ -0,0 +1,22 @@
+#ifndef TURTLE_PRNG_H
+#define TURTLE_PRNG_H
+
+#include <stdint.h>
+
+// The generator of the function random, each context has its own : xoshiro256** (Blackman and Vigna),
+// its state is set from a 64 bits seed by splitmix64, so every seed (0 too) gives a valid state.
+// The same seed gives the same numbers on every machine, see --seed.
+struct prng {
+	uint64_t state[4];
+};
+
+// set the state of a generator from a seed
+void prng_seed(struct prng *self, uint64_t seed);
+
+// the next 64 bits of the sequence
+uint64_t prng_next(struct prng *self);
+
+// a number in the closed interval [lo, hi], each of the 2^53 evenly spaced values is equally likely (lo <= hi)
+double prng_double(struct prng *self, double lo, double hi);
+
+#endif /* TURTLE_PRNG_H */
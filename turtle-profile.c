@@ -0,0 +1,303 @@
+#include <errno.h>
+
+#include "turtle-profile.h"
+
+int profile_create(struct profile *const self, const struct ast *const ast) {
+	memset(self, 0, sizeof(struct profile));
+	self->marked = PROFILE_NO_SITE;
+	self->proc_count = ast->proc_count;
+	self->procs = calloc(ast->proc_count + 1, sizeof(struct profile_proc));
+	return self->procs == 0;
+}
+
+void profile_destroy(struct profile *const self) {
+	free(self->sites);
+	free(self->procs);
+	memset(self, 0, sizeof(struct profile));
+}
+
+// The sites grow by doubling their capacity, a call or a declaration names its procedure.
+size_t profile_site(struct profile *const self, const struct ast_node *const node) {
+	if (self->site_count == self->site_capacity) {
+		const size_t capacity = self->site_capacity ? 2 * self->site_capacity : 64;
+		struct profile_site *const sites = realloc(self->sites, capacity * sizeof(struct profile_site));
+		if (sites == 0)
+			return PROFILE_NO_SITE;
+		self->sites = sites;
+		self->site_capacity = capacity;
+	}
+	if (node->kind == KIND_CMD_CALL || node->kind == KIND_CMD_PROC)
+		self->procs[node->u.bst_entry->value.parsing.proc_slot].name = node->u.bst_entry->key;
+	struct profile_site *const site = self->sites + self->site_count;
+	memset(site, 0, sizeof(struct profile_site));
+	site->node = node;
+	return self->site_count++;
+}
+
+void profile_start(struct profile *const self) {
+	self->start = stats_clock();
+}
+
+// The output lines written since the last marker are the ones of its command.
+static void profile_unmark(struct profile *const self, const size_t output) {
+	if (self->marked != PROFILE_NO_SITE)
+		self->sites[self->marked].output += output - self->marked_output;
+	self->marked = PROFILE_NO_SITE;
+}
+
+void profile_mark(struct profile *const self, const size_t site, const size_t output) {
+	profile_unmark(self, output);
+	self->marked = site;
+	self->marked_output = output;
+	++self->sites[site].count;
+}
+
+// The clock is read once, when the site or its procedure starts its outermost run.
+void profile_enter(struct profile *const self, const size_t site, const size_t output) {
+	profile_unmark(self, output);
+	struct profile_site *const entered = self->sites + site;
+	struct profile_proc *const proc = entered->node->kind == KIND_CMD_CALL ? self->procs + entered->node->u.bst_entry->value.parsing.proc_slot : 0;
+	++entered->count;
+	if (proc)
+		++proc->calls;
+	const bool site_starts = entered->active++ == 0;
+	const bool proc_starts = proc && proc->active++ == 0;
+	if (site_starts || proc_starts) {
+		const uint64_t now = stats_clock();
+		if (site_starts) {
+			entered->start = now;
+			entered->start_output = output;
+		}
+		if (proc_starts) {
+			proc->start = now;
+			proc->start_output = output;
+		}
+	}
+}
+
+void profile_leave(struct profile *const self, const size_t site, const size_t output) {
+	profile_unmark(self, output);
+	struct profile_site *const left = self->sites + site;
+	struct profile_proc *const proc = left->node->kind == KIND_CMD_CALL ? self->procs + left->node->u.bst_entry->value.parsing.proc_slot : 0;
+	const bool site_ends = --left->active == 0;
+	const bool proc_ends = proc && --proc->active == 0;
+	if (site_ends || proc_ends) {
+		const uint64_t now = stats_clock();
+		if (site_ends) {
+			left->time += now - left->start;
+			left->output += output - left->start_output;
+		}
+		if (proc_ends) {
+			proc->time += now - proc->start;
+			proc->output += output - proc->start_output;
+		}
+	}
+}
+
+void profile_finish(struct profile *const self, const size_t output) {
+	profile_unmark(self, output);
+	const uint64_t now = stats_clock();
+	for (size_t i = 0 ; i < self->site_count ; ++i) {
+		struct profile_site *const site = self->sites + i;
+		if (site->active) {
+			site->active = 0;
+			site->time += now - site->start;
+			site->output += output - site->start_output;
+		}
+	}
+	for (size_t i = 0 ; i < self->proc_count ; ++i) {
+		struct profile_proc *const proc = self->procs + i;
+		if (proc->active) {
+			proc->active = 0;
+			proc->time += now - proc->start;
+			proc->output += output - proc->start_output;
+		}
+	}
+	self->time = now - self->start;
+	self->output = output;
+}
+
+/*
+ * report
+ */
+
+static const char *profile_command(const struct ast_node *const node) {
+	static const char *const simple[] = {
+		[CMD_UP] = "up", [CMD_DOWN] = "down", [CMD_RIGHT] = "right", [CMD_LEFT] = "left", [CMD_HEADING] = "heading",
+		[CMD_FORWARD] = "forward", [CMD_BACKWARD] = "backward", [CMD_POSITION] = "position", [CMD_HOME] = "home",
+		[CMD_COLOR] = "color", [CMD_PRINT] = "print",
+	};
+	switch (node->kind) {
+		case KIND_CMD_SIMPLE : return simple[node->u.cmd];
+		case KIND_CMD_REPEAT : return "repeat";
+		case KIND_CMD_IF : return "if";
+		case KIND_CMD_WHILE : return "while";
+		case KIND_CMD_CALL : return "call";
+		case KIND_CMD_SET :
+		case KIND_CMD_SET_LOCAL : return "set";
+		case KIND_CMD_PROC : return "proc";
+		default : return "block";
+	}
+}
+
+// the procedure of a call or a declaration, the variable of a "set"
+static const char *profile_name(const struct ast_node *const node) {
+	switch (node->kind) {
+		case KIND_CMD_CALL : case KIND_CMD_SET : case KIND_CMD_SET_LOCAL : case KIND_CMD_PROC : return node->u.bst_entry->key;
+		default : return 0;
+	}
+}
+
+static bool profile_is_timed(const struct profile_site *const site) {
+	return site->node->kind == KIND_CMD_REPEAT || site->node->kind == KIND_CMD_WHILE || site->node->kind == KIND_CMD_CALL;
+}
+
+static int profile_order(const unsigned long long int a, const unsigned long long int b) {
+	return a < b ? -1 : a > b;
+}
+
+// The comparisons of qsort, the ties are kept in the order of the compiled code.
+static int profile_compare_time(const void *const a, const void *const b) {
+	const struct profile_site *const lhs = *(const struct profile_site *const *) a, *const rhs = *(const struct profile_site *const *) b;
+	int res = profile_order(rhs->time, lhs->time);
+	if (res == 0)
+		res = profile_order(rhs->count, lhs->count);
+	return res ? res : lhs < rhs ? -1 : lhs > rhs;
+}
+
+static int profile_compare_count(const void *const a, const void *const b) {
+	const struct profile_site *const lhs = *(const struct profile_site *const *) a, *const rhs = *(const struct profile_site *const *) b;
+	const int res = profile_order(rhs->count, lhs->count);
+	return res ? res : lhs < rhs ? -1 : lhs > rhs;
+}
+
+static int profile_compare_line(const void *const a, const void *const b) {
+	const struct profile_site *const lhs = *(const struct profile_site *const *) a, *const rhs = *(const struct profile_site *const *) b;
+	const int res = profile_order(lhs->node->line, rhs->node->line);
+	return res ? res : lhs < rhs ? -1 : lhs > rhs;
+}
+
+static int profile_compare_proc(const void *const a, const void *const b) {
+	const struct profile_proc *const lhs = *(const struct profile_proc *const *) a, *const rhs = *(const struct profile_proc *const *) b;
+	int res = profile_order(rhs->time, lhs->time);
+	if (res == 0)
+		res = profile_order(rhs->calls, lhs->calls);
+	return res ? res : strcmp(lhs->name, rhs->name);
+}
+
+static double profile_percent(const struct profile *const self, const uint64_t time) {
+	return self->time ? 100.0 * (double) time / (double) self->time : 0.0;
+}
+
+static void profile_more(FILE *const file, const size_t count) {
+	if (count > PROFILE_REPORT_ROWS)
+		fprintf(file, "  ... %zu more\n", count - PROFILE_REPORT_ROWS);
+}
+
+void profile_report(const struct profile *const self, FILE *const file) {
+	const struct profile_site **const sites = malloc((self->site_count + 1) * sizeof(struct profile_site *));
+	const struct profile_proc **const procs = malloc((self->proc_count + 1) * sizeof(struct profile_proc *));
+	if (sites == 0 || procs == 0) {
+		free(sites);
+		free(procs);
+		fprintf(file, "Memory Allocation Error.\n");
+		return;
+	}
+	unsigned long long int commands = 0;
+	size_t timed = 0, counted = self->site_count, called = 0;
+	// the loops and the calls which ran are first, then the other commands which ran
+	for (size_t i = 0 ; i < self->site_count ; ++i) {
+		commands += self->sites[i].count;
+		if (self->sites[i].count == 0)
+			--counted;
+		else if (profile_is_timed(self->sites + i))
+			sites[timed++] = self->sites + i;
+	}
+	counted -= timed;
+	for (size_t i = 0, j = timed ; i < self->site_count ; ++i)
+		if (self->sites[i].count && !profile_is_timed(self->sites + i))
+			sites[j++] = self->sites + i;
+	for (size_t i = 0 ; i < self->proc_count ; ++i)
+		if (self->procs[i].calls)
+			procs[called++] = self->procs + i;
+	qsort(sites, timed, sizeof(struct profile_site *), profile_compare_time);
+	qsort(sites + timed, counted, sizeof(struct profile_site *), profile_compare_count);
+	qsort(procs, called, sizeof(struct profile_proc *), profile_compare_proc);
+	char command[64];
+	fprintf(file, "Profile : %.6f s, %llu commands, %zu output lines.\n", (double) self->time / 1e9, commands, self->output);
+	if (timed)
+		fprintf(file, "Loops and calls :\n%8s  %-24s %14s %12s %12s %7s\n", "line", "command", "count", "output", "time (s)", "%");
+	for (size_t i = 0 ; i < timed && i < PROFILE_REPORT_ROWS ; ++i) {
+		const struct profile_site *const site = sites[i];
+		const char *const name = profile_name(site->node);
+		snprintf(command, sizeof(command), "%s%s%s", profile_command(site->node), name ? " " : "", name ? name : "");
+		fprintf(file, "%8lu  %-24s %14llu %12zu %12.6f %7.2f\n", (unsigned long int) site->node->line, command, site->count, site->output, (double) site->time / 1e9, profile_percent(self, site->time));
+	}
+	profile_more(file, timed);
+	if (counted)
+		fprintf(file, "Commands :\n%8s  %-24s %14s %12s\n", "line", "command", "count", "output");
+	for (size_t i = 0 ; i < counted && i < PROFILE_REPORT_ROWS ; ++i) {
+		const struct profile_site *const site = sites[timed + i];
+		const char *const name = profile_name(site->node);
+		snprintf(command, sizeof(command), "%s%s%s", profile_command(site->node), name ? " " : "", name ? name : "");
+		fprintf(file, "%8lu  %-24s %14llu %12zu\n", (unsigned long int) site->node->line, command, site->count, site->output);
+	}
+	profile_more(file, counted);
+	if (called)
+		fprintf(file, "Procedures :\n  %-32s %14s %12s %12s %7s\n", "procedure", "calls", "output", "time (s)", "%");
+	for (size_t i = 0 ; i < called && i < PROFILE_REPORT_ROWS ; ++i)
+		fprintf(file, "  %-32s %14llu %12zu %12.6f %7.2f\n", procs[i]->name, procs[i]->calls, procs[i]->output, (double) procs[i]->time / 1e9, profile_percent(self, procs[i]->time));
+	profile_more(file, called);
+	free(sites);
+	free(procs);
+}
+
+// The names are identifiers of the language, they are written as they are.
+static bool profile_write_json(const struct profile *const self, const struct profile_site *const *const sites, FILE *const file) {
+	unsigned long long int commands = 0;
+	for (size_t i = 0 ; i < self->site_count ; ++i)
+		commands += self->sites[i].count;
+	if (fprintf(file, "{\"time\": %.9f, \"commands\": %llu, \"output\": %zu,\n\"sites\": [", (double) self->time / 1e9, commands, self->output) < 0)
+		return false;
+	for (size_t i = 0 ; i < self->site_count ; ++i) {
+		const struct profile_site *const site = sites[i];
+		const char *const name = profile_name(site->node);
+		fprintf(file, "%s\n{\"line\": %lu, \"command\": \"%s\"", i ? "," : "", (unsigned long int) site->node->line, profile_command(site->node));
+		if (name)
+			fprintf(file, ", \"name\": \"%s\"", name);
+		fprintf(file, ", \"count\": %llu, \"output\": %zu", site->count, site->output);
+		if (profile_is_timed(site))
+			fprintf(file, ", \"time\": %.9f", (double) site->time / 1e9);
+		fputc('}', file);
+	}
+	fprintf(file, "],\n\"procedures\": [");
+	for (size_t i = 0, first = 1 ; i < self->proc_count ; ++i) {
+		const struct profile_proc *const proc = self->procs + i;
+		if (proc->name == 0)
+			continue;
+		fprintf(file, "%s\n{\"name\": \"%s\", \"calls\": %llu, \"output\": %zu, \"time\": %.9f}", first ? "" : ",", proc->name, proc->calls, proc->output, (double) proc->time / 1e9);
+		first = 0;
+	}
+	return fprintf(file, "]}\n") >= 0;
+}
+
+// The sites are written in the order of the lines, the procedures in the order of their slots.
+int profile_write(const struct profile *const self, const char *const path) {
+	const struct profile_site **const sites = malloc((self->site_count + 1) * sizeof(struct profile_site *));
+	if (sites == 0)
+		return ENOMEM;
+	for (size_t i = 0 ; i < self->site_count ; ++i)
+		sites[i] = self->sites + i;
+	qsort(sites, self->site_count, sizeof(struct profile_site *), profile_compare_line);
+	FILE *const file = fopen(path, "w");
+	int error = file ? 0 : errno;
+	if (file) {
+		errno = 0;
+		if (!profile_write_json(self, sites, file) || ferror(file))
+			error = errno ? errno : EIO;
+		if (fclose(file) && error == 0)
+			error = errno;
+	}
+	free(sites);
+	return error;
+}
@@ -0,0 +1,88 @@
+#ifndef TURTLE_PROFILE_H
+#define TURTLE_PROFILE_H
+
+#include "turtle-ast.h"
+
+#define PROFILE_REPORT_ROWS	20 // the rows of each table of the report, the JSON file has them all
+#define PROFILE_NO_SITE		SIZE_MAX
+
+// The profiler is optional (see --profile), it's fed by the bytecode compiled for it (see vm_compile), so the
+// programs evaluated without it are not running a single instruction more.
+// Each command of the program is a site, known by its line (the blocks are not sites, their commands are) :
+// - a simple command, a "set" or a declaration is counted by a marker placed before it, the output lines written
+//   between two markers are the ones of the first marker,
+// - a repeat, a while loop or a call is entered before its argument and left after its last iteration (or its return), its time
+//   and its output lines are measured between both, including its nested commands,
+// - a call adds its time and its output lines to its procedure.
+// A site running within itself (a recursive procedure) is measured by its outermost run, so nothing is counted twice.
+// The output lines are the lines of the text format (see ast_eval_write_output), whatever the format.
+// The report is written to the standard error, the sites and the procedures sorted by time then by count, the
+// commands by count. The JSON file has the same fields :
+// {"time": seconds, "commands": count, "output": lines,
+//  "sites": [{"line": 3, "command": "repeat", "count": 1, "output": 400, "time": seconds}, ...],
+//  "procedures": [{"name": "STAR", "calls": 100, "output": 400, "time": seconds}, ...]}
+// the sites are in the order of the program, "time" is only given for the loops and the calls.
+
+// a command of the program
+struct profile_site {
+	const struct ast_node *node;
+	unsigned long long int count;
+	size_t output;
+	uint64_t time; // in nanoseconds, for a repeat or a call
+	size_t active; // the runs of a repeat or a call in progress, the outermost one is measured
+	uint64_t start;
+	size_t start_output;
+};
+
+// a procedure slot
+struct profile_proc {
+	const char *name;
+	unsigned long long int calls;
+	size_t output;
+	uint64_t time;
+	size_t active;
+	uint64_t start;
+	size_t start_output;
+};
+
+struct profile {
+	struct profile_site *sites;
+	size_t site_count;
+	size_t site_capacity;
+	struct profile_proc *procs;
+	size_t proc_count;
+	size_t marked;        // the site of the last marker (PROFILE_NO_SITE after a repeat or a call)
+	size_t marked_output; // the output lines written before it
+	uint64_t start;
+	uint64_t time;
+	size_t output;
+};
+
+// prepare the profile of a resolved AST, its sites are added by the compiler
+// return 0 on success or 1 on memory allocation error
+int profile_create(struct profile *self, const struct ast *ast);
+
+// release the sites and the procedures
+void profile_destroy(struct profile *self);
+
+// add a command, return its site or PROFILE_NO_SITE on memory allocation error
+size_t profile_site(struct profile *self, const struct ast_node *node);
+
+// start the clock, before the evaluation
+void profile_start(struct profile *self);
+
+// the instructions of the compiled code, given the output lines written so far (ctx->lines_printed)
+void profile_mark(struct profile *self, size_t site, size_t output);
+void profile_enter(struct profile *self, size_t site, size_t output);
+void profile_leave(struct profile *self, size_t site, size_t output);
+
+// stop the clock after the evaluation, the repeats and the calls interrupted by an error are left
+void profile_finish(struct profile *self, size_t output);
+
+// write the report to a stream (the first rows of each table)
+void profile_report(const struct profile *self, FILE *file);
+
+// write the JSON file, return 0 on success or an errno value
+int profile_write(const struct profile *self, const char *path);
+
+#endif /* TURTLE_PROFILE_H */
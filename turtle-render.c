@@ -0,0 +1,271 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "turtle-render.h"
+#include "turtle-png.h"
+
+void render_create(struct render *const self, const size_t width, const size_t height) {
+	memset(self, 0, sizeof(struct render));
+	self->width = width;
+	self->height = height;
+	self->scale = (double) (width < height ? width : height) / RENDER_UNITS;
+	self->x = (double) width / 2;
+	self->y = (double) height / 2;
+}
+
+void render_destroy(struct render *const self) {
+	free(self->segments);
+	self->segments = 0;
+	self->segment_count = self->segment_capacity = 0;
+}
+
+static uint8_t render_channel(const double value) {
+	return (uint8_t) (value * 255 + 0.5);
+}
+
+void render_color(struct render *const self, const double r, const double g, const double b) {
+	self->color = (uint32_t) render_channel(r) << 16 | (uint32_t) render_channel(g) << 8 | render_channel(b);
+}
+
+// Clip a segment to the image and its margin (Liang-Barsky), return false if nothing remains.
+static bool render_clip(const struct render *const self, double *const x0, double *const y0, double *const x1, double *const y1) {
+	const double dx = *x1 - *x0, dy = *y1 - *y0;
+	const double p[4] = {-dx, dx, -dy, dy};
+	const double q[4] = {*x0 + RENDER_MARGIN, (double) self->width + RENDER_MARGIN - *x0, *y0 + RENDER_MARGIN, (double) self->height + RENDER_MARGIN - *y0};
+	double t0 = 0, t1 = 1;
+	for (int i = 0 ; i < 4 ; ++i) {
+		if (p[i] == 0) {
+			if (q[i] < 0)
+				return false;
+		} else if (p[i] < 0)
+			t0 = fmax(t0, q[i] / p[i]);
+		else
+			t1 = fmin(t1, q[i] / p[i]);
+	}
+	if (t0 > t1)
+		return false;
+	const double x = *x0, y = *y0;
+	*x0 = x + t0 * dx;
+	*y0 = y + t0 * dy;
+	*x1 = x + t1 * dx;
+	*y1 = y + t1 * dy;
+	return true;
+}
+
+void render_move(struct render *const self, const bool up, const double x, const double y) {
+	double x0 = self->x, y0 = self->y;
+	double x1 = (double) self->width / 2 + x * self->scale, y1 = (double) self->height / 2 + y * self->scale;
+	self->x = x1;
+	self->y = y1;
+	if (up || self->error_number || !isfinite(x0) || !isfinite(y0) || !isfinite(x1) || !isfinite(y1) || !render_clip(self, &x0, &y0, &x1, &y1))
+		return;
+	if (self->segment_count == self->segment_capacity) {
+		const size_t capacity = self->segment_capacity ? 2 * self->segment_capacity : 4096;
+		struct render_segment *const segments = realloc(self->segments, capacity * sizeof(struct render_segment));
+		if (segments == 0) {
+			self->error_number = 1;
+			return;
+		}
+		self->segments = segments;
+		self->segment_capacity = capacity;
+	}
+	self->segments[self->segment_count++] = (struct render_segment) {(float) x0, (float) y0, (float) x1, (float) y1, self->color};
+}
+
+/*
+ * rasterization
+ */
+
+struct render_job {
+	const struct render *render;
+	size_t columns; // the number of tiles
+	size_t rows;
+	size_t *offsets; // the segments of the tile i are indices[offsets[i]] to indices[offsets[i + 1] - 1]
+	size_t *indices;
+	uint8_t *pixels;
+	pthread_mutex_t mutex;
+	size_t next; // the next tile to draw
+	bool failed;
+};
+
+static size_t render_index(const double value, const size_t count) {
+	return value <= 0 ? 0 : value >= (double) count ? count - 1 : (size_t) value;
+}
+
+// Visit the tiles which may be covered by a segment, row by row of tiles. The tiles are counted into counts[tile + 1],
+// or the segment is added to them using the cursors.
+static void render_bin(const struct render_job *const job, const size_t index, size_t *const counts, size_t *const cursors) {
+	const struct render_segment *const s = job->render->segments + index;
+	const double dx = (double) s->x1 - s->x0, dy = (double) s->y1 - s->y0;
+	const size_t top = render_index((fmin(s->y0, s->y1) - RENDER_MARGIN) / RENDER_TILE, job->rows);
+	const size_t bottom = render_index((fmax(s->y0, s->y1) + RENDER_MARGIN) / RENDER_TILE, job->rows);
+	for (size_t row = top ; row <= bottom ; ++row) {
+		double t0 = 0, t1 = 1;
+		if (dy != 0) {
+			t0 = ((double) row * RENDER_TILE - RENDER_MARGIN - s->y0) / dy;
+			t1 = ((double) (row + 1) * RENDER_TILE + RENDER_MARGIN - s->y0) / dy;
+			if (t0 > t1) {
+				const double t = t0;
+				t0 = t1;
+				t1 = t;
+			}
+			t0 = fmax(t0, 0);
+			t1 = fmin(t1, 1);
+		}
+		const double xa = s->x0 + t0 * dx, xb = s->x0 + t1 * dx;
+		const size_t left = render_index((fmin(xa, xb) - RENDER_MARGIN) / RENDER_TILE, job->columns);
+		const size_t right = render_index((fmax(xa, xb) + RENDER_MARGIN) / RENDER_TILE, job->columns);
+		for (size_t column = left ; column <= right ; ++column) {
+			const size_t tile = row * job->columns + column;
+			if (cursors)
+				job->indices[cursors[tile]++] = index;
+			else
+				++counts[tile + 1];
+		}
+	}
+}
+
+static void render_blend(float *const pixel, const uint32_t color, const float coverage) {
+	pixel[0] += ((float) (color >> 16) / 255 - pixel[0]) * coverage;
+	pixel[1] += ((float) (color >> 8 & 0xFF) / 255 - pixel[1]) * coverage;
+	pixel[2] += ((float) (color & 0xFF) / 255 - pixel[2]) * coverage;
+}
+
+// Draw a segment into a tile (its pixels are RGB floats), the pixels are visited along the major axis of the segment,
+// then across it (the distance along the minor axis is at most sqrt(2) times the distance to the segment), so every
+// pixel closer than RENDER_REACH to the segment is visited once.
+static void render_segment(float *const tile, const size_t left, const size_t top, const size_t width, const size_t height, const struct render_segment *const s) {
+	const double x0 = s->x0, y0 = s->y0, dx = (double) s->x1 - s->x0, dy = (double) s->y1 - s->y0;
+	const double length = dx * dx + dy * dy;
+	const bool steep = fabs(dy) > fabs(dx);
+	// the major axis is u, the minor one is v, the tile covers [u_first, u_last] x [v_first, v_last]
+	const double u0 = steep ? y0 : x0, v0 = steep ? x0 : y0, du = steep ? dy : dx, dv = steep ? dx : dy;
+	const double u_first = (double) (steep ? top : left), u_last = u_first + (double) (steep ? height : width) - 1;
+	const double v_first = (double) (steep ? left : top), v_last = v_first + (double) (steep ? width : height) - 1;
+	const double along = ceil(RENDER_REACH), across = ceil(RENDER_REACH * 1.5) + 1;
+	const double u_start = fmax(floor(fmin(u0, u0 + du)) - along, u_first), u_stop = fmin(floor(fmax(u0, u0 + du)) + along, u_last);
+	for (double u = u_start ; u <= u_stop ; ++u) {
+		const double t = du == 0 ? 0 : fmin(fmax((u + 0.5 - u0) / du, 0), 1);
+		const double v_center = floor(v0 + t * dv);
+		const double v_start = fmax(v_center - across, v_first), v_stop = fmin(v_center + across, v_last);
+		for (double v = v_start ; v <= v_stop ; ++v) {
+			const double px = (steep ? v : u) + 0.5, py = (steep ? u : v) + 0.5;
+			const double k = length == 0 ? 0 : fmin(fmax(((px - x0) * dx + (py - y0) * dy) / length, 0), 1);
+			const double ex = px - x0 - k * dx, ey = py - y0 - k * dy, distance = ex * ex + ey * ey;
+			if (distance < RENDER_REACH * RENDER_REACH) {
+				const size_t x = (size_t) (steep ? v : u) - left, y = (size_t) (steep ? u : v) - top;
+				render_blend(tile + 3 * (y * width + x), s->color, (float) fmin(RENDER_REACH - sqrt(distance), 1));
+			}
+		}
+	}
+}
+
+static void render_tile(struct render_job *const job, const size_t tile, float *const buffer) {
+	const struct render *const render = job->render;
+	const size_t left = tile % job->columns * RENDER_TILE, top = tile / job->columns * RENDER_TILE;
+	const size_t width = render->width - left < RENDER_TILE ? render->width - left : RENDER_TILE;
+	const size_t height = render->height - top < RENDER_TILE ? render->height - top : RENDER_TILE;
+	for (size_t i = 0 ; i < 3 * width * height ; ++i)
+		buffer[i] = 1;
+	for (size_t i = job->offsets[tile] ; i < job->offsets[tile + 1] ; ++i)
+		render_segment(buffer, left, top, width, height, render->segments + job->indices[i]);
+	for (size_t y = 0 ; y < height ; ++y) {
+		uint8_t *const row = job->pixels + 3 * ((top + y) * render->width + left);
+		for (size_t i = 0 ; i < 3 * width ; ++i)
+			row[i] = render_channel(buffer[3 * y * width + i]);
+	}
+}
+
+static void *render_worker(void *const argument) {
+	struct render_job *const job = argument;
+	float *const buffer = malloc(3 * RENDER_TILE * RENDER_TILE * sizeof(float));
+	for (;;) {
+		pthread_mutex_lock(&job->mutex);
+		const size_t tile = job->next++;
+		if (buffer == 0)
+			job->failed = true;
+		pthread_mutex_unlock(&job->mutex);
+		if (buffer == 0 || tile >= job->columns * job->rows)
+			break;
+		render_tile(job, tile, buffer);
+	}
+	free(buffer);
+	return 0;
+}
+
+// Bin the segments (the tiles keep the drawing order), then draw the tiles.
+static int render_draw(struct render_job *const job, size_t threads) {
+	const struct render *const render = job->render;
+	const size_t tiles = job->columns * job->rows;
+	size_t *const cursors = malloc(tiles * sizeof(size_t));
+	job->offsets = calloc(tiles + 1, sizeof(size_t));
+	if (cursors == 0 || job->offsets == 0) {
+		free(cursors);
+		return ENOMEM;
+	}
+	for (size_t i = 0 ; i < render->segment_count ; ++i)
+		render_bin(job, i, job->offsets, 0);
+	for (size_t i = 0 ; i < tiles ; ++i)
+		job->offsets[i + 1] += job->offsets[i];
+	memcpy(cursors, job->offsets, tiles * sizeof(size_t));
+	job->indices = malloc((job->offsets[tiles] ? job->offsets[tiles] : 1) * sizeof(size_t));
+	if (job->indices == 0) {
+		free(cursors);
+		return ENOMEM;
+	}
+	for (size_t i = 0 ; i < render->segment_count ; ++i)
+		render_bin(job, i, 0, cursors);
+	free(cursors);
+	if (threads == 0) {
+		const long count = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = count > 0 ? (size_t) count : 1;
+	}
+	if (threads > tiles)
+		threads = tiles;
+	if (pthread_mutex_init(&job->mutex, 0))
+		return ENOMEM;
+	pthread_t *const pool = malloc((threads - 1) * sizeof(pthread_t) + 1);
+	size_t started = 0;
+	while (pool && started + 1 < threads && pthread_create(pool + started, 0, render_worker, job) == 0)
+		++started;
+	render_worker(job); // this thread works too, the tiles are drawn even if no thread was created
+	for (size_t i = 0 ; i < started ; ++i)
+		pthread_join(pool[i], 0);
+	free(pool);
+	pthread_mutex_destroy(&job->mutex);
+	return job->failed ? ENOMEM : 0;
+}
+
+static bool render_is_ppm(const char *const path) {
+	const size_t length = strlen(path);
+	return length >= 4 && strcmp(path + length - 4, ".ppm") == 0;
+}
+
+int render_write(const struct render *const self, const char *const path, const size_t threads) {
+	if (self->error_number)
+		return ENOMEM;
+	struct render_job job = {0};
+	job.render = self;
+	job.columns = (self->width + RENDER_TILE - 1) / RENDER_TILE;
+	job.rows = (self->height + RENDER_TILE - 1) / RENDER_TILE;
+	job.pixels = malloc(3 * self->width * self->height);
+	int error = job.pixels ? render_draw(&job, threads) : ENOMEM;
+	free(job.offsets);
+	free(job.indices);
+	if (error == 0) {
+		FILE *const file = fopen(path, "wb");
+		if (file == 0)
+			error = errno;
+		else {
+			error = (render_is_ppm(path) ? ppm_write : png_write)(file, job.pixels, self->width, self->height);
+			if (fclose(file) && error == 0)
+				error = errno;
+		}
+	}
+	free(job.pixels);
+	return error;
+}
@@ -0,0 +1,63 @@
+#ifndef TURTLE_RENDER_H
+#define TURTLE_RENDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RENDER_WIDTH_DEFAULT	1000
+#define RENDER_HEIGHT_DEFAULT	1000
+#define RENDER_SIZE_MAX			16384 // the largest side of an image
+#define RENDER_UNITS			1000.0 // the units of the drawing along the shortest side of the image, like the viewer
+#define RENDER_TILE				64 // the side of a tile, in pixels
+#define RENDER_LINE_WIDTH		2.0 // the width of the lines in pixels, like the viewer's
+#define RENDER_REACH			(RENDER_LINE_WIDTH / 2 + 0.5) // the farthest pixel center covered by a line
+#define RENDER_MARGIN			(RENDER_REACH + 1) // the pixels around a segment which may be covered
+
+// The rasterizer of --render draws the segments given by the evaluators into an image, without the viewer :
+// - the origin is the center of the image, the y axis goes down like the viewer's, the background is white,
+// - a segment is a line of RENDER_LINE_WIDTH pixels with round ends, the coverage of a pixel is RENDER_REACH - d
+//   (at most 1) where d is the distance from its center to the segment, the colors are blended over the background
+//   in the drawing order,
+// - the segments are recorded (clipped to the image) during the evaluation, then binned by tiles of RENDER_TILE pixels,
+//   the tiles are drawn in parallel by a pool of threads, a pixel is drawn by a single thread so the image doesn't
+//   depend on their number,
+// - the image is written as PNG (see turtle-png.h), or as PPM when the path ends with ".ppm".
+
+// a recorded segment, in pixels, its color is packed as 0xRRGGBB
+struct render_segment {
+	float x0;
+	float y0;
+	float x1;
+	float y1;
+	uint32_t color;
+};
+
+struct render {
+	size_t width;
+	size_t height;
+	double scale; // the pixels per unit
+	double x; // the position of the turtle, in pixels
+	double y;
+	uint32_t color;
+	struct render_segment *segments;
+	size_t segment_count;
+	size_t segment_capacity;
+	int error_number; // 1 when a segment can't be recorded
+};
+
+// prepare an image of a given size (from 1 to RENDER_SIZE_MAX pixels per side), nothing is allocated
+void render_create(struct render *self, size_t width, size_t height);
+
+// release the recorded segments
+void render_destroy(struct render *self);
+
+// the instructions of the evaluators, like output_color and output_move
+void render_color(struct render *self, double r, double g, double b);
+void render_move(struct render *self, bool up, double x, double y);
+
+// draw the recorded segments using some threads (0 for one per processor), then write the image to a file
+// return 0 on success or an errno value
+int render_write(const struct render *self, const char *path, size_t threads);
+
+#endif /* TURTLE_RENDER_H */
@@ -0,0 +1,328 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "turtle-run.h"
+#include "turtle-vm.h"
+#include "turtle-tbc.h"
+#include "turtle-optimizer.h"
+#include "turtle-memo.h"
+#include "turtle-simplify.h"
+#include "turtle-render.h"
+#include "turtle-profile.h"
+
+void options_create(struct options *const self) {
+	memset(self, 0, sizeof(struct options));
+	self->engine = ENGINE_VM;
+	self->max_depth = TURTLE_DEFAULT_MAX_DEPTH;
+	self->buffer_size = TURTLE_OUTPUT_BUFFER_SIZE;
+	self->format = OUTPUT_TEXT;
+	self->svg_decimals = OUTPUT_SVG_DECIMALS_DEFAULT;
+	self->optimize = true;
+	self->segments = SIMPLIFY_SEGMENTS_DEFAULT;
+	self->width = RENDER_WIDTH_DEFAULT;
+	self->height = RENDER_HEIGHT_DEFAULT;
+}
+
+// The memory allocation error of the parser (2, like yyparse) is the error 1 of turtle, 2 is an unknown node.
+int run_parse_source(struct ast *const root, const struct options *const options, char *const source, const size_t length) {
+	const int ret = ast_parse(root, source, length) ? 1 : 0;
+	if (ret == 0) {
+		if (options->optimize)
+			ast_fold(root);
+		ast_resolve(root);
+		if (options->optimize)
+			ast_hoist(root);
+	}
+	return ret;
+}
+
+// FNV-1a (64 bits)
+uint64_t run_hash(const char *const source, const size_t length) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (size_t i = 0 ; i < length ; ++i)
+		hash = (hash ^ (unsigned char) source[i]) * 0x100000001B3ULL;
+	return hash;
+}
+
+// A source followed by two null bytes (see ast_parse), mapped from a regular file or read from a stream.
+struct run_source {
+	char *bytes;
+	size_t length;
+	size_t mapping_size; // 0 when the bytes are allocated
+};
+
+// A regular file is mapped privately (the scanner writes in it) when its last page has room for the two null
+// bytes, the end of this page is filled with zeros by the system. Return false if the file isn't mapped.
+static bool run_map(struct run_source *const source, const int fd) {
+	struct stat status;
+	const long page = sysconf(_SC_PAGESIZE);
+	if (page <= 0 || fstat(fd, &status) || !S_ISREG(status.st_mode) || status.st_size <= 0 || (uintmax_t) status.st_size > SIZE_MAX - 2)
+		return false;
+	const size_t length = (size_t) status.st_size, rest = length % (size_t) page;
+	if (rest == 0 || rest > (size_t) page - 2)
+		return false;
+	void *const mapping = mmap(0, length + 2, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED)
+		return false;
+	posix_madvise(mapping, length + 2, POSIX_MADV_SEQUENTIAL);
+	source->bytes = mapping;
+	source->length = length;
+	source->mapping_size = length + 2;
+	return true;
+}
+
+// Read a whole stream, return 0 on success or an errno value.
+static int run_read(struct run_source *const source, const int fd) {
+	size_t capacity = 65536, length = 0;
+	char *bytes = malloc(capacity);
+	while (bytes) {
+		const ssize_t count = read(fd, bytes + length, capacity - 2 - length);
+		if (count == 0)
+			break;
+		if (count < 0) {
+			const int error = errno;
+			if (error == EINTR)
+				continue;
+			free(bytes);
+			return error;
+		}
+		length += (size_t) count;
+		if (length == capacity - 2) {
+			char *const larger = realloc(bytes, capacity *= 2);
+			if (larger == 0)
+				free(bytes);
+			bytes = larger;
+		}
+	}
+	if (bytes == 0)
+		return ENOMEM;
+	bytes[length] = bytes[length + 1] = 0;
+	source->bytes = bytes;
+	source->length = length;
+	return 0;
+}
+
+static void run_source_close(struct run_source *const source) {
+	if (source->mapping_size)
+		munmap(source->bytes, source->mapping_size);
+	else
+		free(source->bytes);
+}
+
+// Open the source of a program, STDIN when the path is null (it's mapped too when it's redirected from a file).
+// A source larger than the scanner accepts is refused (see TURTLE_SOURCE_MAX).
+static int run_source_open(struct run_source *const source, const char *const path) {
+	memset(source, 0, sizeof(struct run_source));
+	const int fd = path ? open(path, O_RDONLY) : STDIN_FILENO;
+	int error = fd < 0 ? errno : 0;
+	struct stat status;
+	if (error == 0 && fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && (uintmax_t) status.st_size > TURTLE_SOURCE_MAX)
+		error = EFBIG; // a regular file isn't read, a stream is checked once it's read
+	if (error == 0 && !run_map(source, fd))
+		error = run_read(source, fd);
+	if (path && fd >= 0)
+		close(fd);
+	if (error == 0 && source->length > TURTLE_SOURCE_MAX) {
+		run_source_close(source);
+		error = EFBIG;
+	}
+	if (error == ENOMEM)
+		fprintf(stderr, "Memory Allocation Error.\n");
+	else if (error)
+		fprintf(stderr, "The program '%s' can't be read : %s.\n", path ? path : "STDIN", strerror(error));
+	return error ? 1 : 0;
+}
+
+// The memoization, the simplification, the rasterizer and the profile are owned by the run, the AST is only read.
+// A compiled program is evaluated by the VM without its AST (root is null), the memoization and the profile aren't available.
+// The profile is reported even when the program fails, after its error message, then the stats (the phases before
+// the evaluation are given by the caller).
+static int run_program(const struct ast *const root, const struct vm_program *const compiled, const struct options *const options, const int fd, struct stats_phases *phases) {
+	struct stats_phases no_phases = {0};
+	if (phases == 0)
+		phases = &no_phases;
+	int error_number = root ? root->error_number : 0;
+	struct context ctx = {0};
+	context_create(&ctx);
+	ctx.max_depth = options->max_depth;
+	ctx.replay = options->replay;
+	prng_seed(&ctx.random, options->seed);
+	output_create(&ctx.output, fd, options->buffer_size);
+	ctx.output.format = options->format;
+	ctx.output.svg.decimals = options->svg_decimals;
+	ctx.output.framed = options->framed;
+	struct memo memo = {0};
+	if (options->memoize && root && error_number == 0) {
+		if (memo_create(&memo, root))
+			error_number = 1;
+		else
+			ctx.memo = &memo;
+	}
+	struct simplify simplifier = {0};
+	if (options->simplify && error_number == 0) {
+		if (simplify_create(&simplifier, options->segments))
+			error_number = 1;
+		else
+			ctx.simplify = &simplifier;
+	}
+	struct render renderer = {0};
+	if (options->render_path && error_number == 0) {
+		render_create(&renderer, options->width, options->height);
+		ctx.render = &renderer;
+		ctx.output.format = OUTPUT_TEXT; // nothing is written
+	}
+	struct profile profiler = {0};
+	if (options->profile && root && !compiled && options->engine == ENGINE_VM && error_number == 0) {
+		if (profile_create(&profiler, root))
+			error_number = 1;
+		else
+			ctx.profile = &profiler;
+	}
+	uint64_t start = stats_clock();
+	if (error_number == 0 && compiled)
+		vm_eval(compiled, &ctx);
+	else if (error_number == 0 && options->engine == ENGINE_TREE)
+		ast_eval(root, &ctx);
+	else if (error_number == 0) {
+		struct vm_program program;
+		ctx.error_number = vm_compile(&program, root, ctx.profile);
+		const uint64_t compiled_at = stats_clock();
+		phases->compile += compiled_at - start;
+		start = compiled_at;
+		if (ctx.profile)
+			profile_start(ctx.profile);
+		vm_eval(&program, &ctx);
+		if (ctx.profile)
+			profile_finish(ctx.profile, ctx.lines_printed);
+		vm_destroy(&program);
+	}
+	const uint64_t evaluated = stats_clock();
+	phases->eval = evaluated - start;
+	int ret = context_destroy(&ctx);
+	phases->flush = stats_clock() - evaluated;
+	memo_destroy(&memo);
+	if (error_number)
+		ret = error_number;
+	if (ret == 0 && ctx.simplify)
+		fprintf(stderr, "Simplified output : %zu of %zu lines saved.\n", simplifier.lines_read - simplifier.lines_written, simplifier.lines_read);
+	simplify_destroy(&simplifier);
+	if (ret == 1)
+		fprintf(stderr, "Memory Allocation Error.\n");
+	if (ret == 0 && ctx.render) {
+		const int error = render_write(&renderer, options->render_path, options->threads);
+		if (error == ENOMEM)
+			fprintf(stderr, "Memory Allocation Error.\n");
+		else if (error)
+			fprintf(stderr, "The image can't be written to '%s' : %s.\n", options->render_path, strerror(error));
+		ret = error ? 1 : 0;
+	}
+	render_destroy(&renderer);
+	if (ctx.profile && ret != 1) {
+		if (ret)
+			fputc('\n', stderr); // the error messages of the evaluators are not ending the line
+		profile_report(&profiler, stderr);
+		const int error = options->profile_path ? profile_write(&profiler, options->profile_path) : 0;
+		if (error == ENOMEM)
+			fprintf(stderr, "Memory Allocation Error.\n");
+		else if (error)
+			fprintf(stderr, "The profile can't be written to '%s' : %s.\n", options->profile_path, strerror(error));
+		if (error && ret == 0)
+			ret = 1;
+	}
+	profile_destroy(&profiler);
+	if (options->stats && ret != 1) {
+		if (ret && !ctx.profile)
+			fputc('\n', stderr);
+		stats_report(phases, root, &ctx, stderr);
+	}
+	return ret;
+}
+
+int run_eval(const struct ast *const root, const struct options *const options, const int fd) {
+	return run_program(root, 0, options, fd, 0);
+}
+
+// Parse and compile a source, then write the compiled file (it depends on the source and on the optimizations).
+// Return the error of the parser or of the compiler, a file which can't be written is reported by *saved.
+static int run_compile_source(struct ast *const root, struct vm_program *const program, const struct options *const options, const struct run_source *const source, const char *const path, bool *const saved) {
+	*saved = false;
+	const uint64_t hash = run_hash(source->bytes, source->length);
+	int ret = run_parse_source(root, options, source->bytes, source->length);
+	if (ret == 0) {
+		ret = root->error_number ? root->error_number : vm_compile(program, root, 0);
+		if (ret == 1)
+			fprintf(stderr, "Memory Allocation Error.\n");
+	}
+	if (ret == 0) {
+		const int error = tbc_save(program, path, hash, options->optimize ? TBC_FLAG_OPTIMIZED : 0);
+		if (error)
+			fprintf(stderr, "The compiled program can't be written to '%s' : %s.\n", path, strerror(error));
+		*saved = error == 0;
+	}
+	return ret;
+}
+
+int run_compile(const struct options *const options, const char *const input, const char *const path) {
+	struct run_source source;
+	if (run_source_open(&source, input))
+		return 1;
+	struct ast root = {0};
+	struct vm_program program = {0};
+	bool saved = false;
+	int ret = run_compile_source(&root, &program, options, &source, path, &saved);
+	if (ret == 0 && !saved)
+		ret = EXIT_FAILURE;
+	vm_destroy(&program);
+	ast_destroy(&root);
+	run_source_close(&source);
+	return ret;
+}
+
+// An up to date compiled file is evaluated in place, otherwise it's rebuilt from the source (a file which can't be
+// written is only reported). The memoization needs the AST, it's never used.
+int run_load(const struct options *const options, const char *const input, const char *const path, const int fd) {
+	struct stats_phases phases = {0};
+	const uint64_t start = stats_clock();
+	struct run_source source;
+	if (run_source_open(&source, input))
+		return 1;
+	struct ast root = {0};
+	struct vm_program program = {0};
+	int ret = 0;
+	const uint64_t opened = stats_clock();
+	phases.read = opened - start;
+	if (tbc_load(&program, path, run_hash(source.bytes, source.length), options->optimize ? TBC_FLAG_OPTIMIZED : 0)) {
+		bool saved;
+		ret = run_compile_source(&root, &program, options, &source, path, &saved);
+	}
+	phases.compile = stats_clock() - opened;
+	run_source_close(&source);
+	if (ret == 0)
+		ret = run_program(0, &program, options, fd, &phases);
+	vm_destroy(&program);
+	ast_destroy(&root);
+	return ret;
+}
+
+// The names are copied by the scanner, the source is released before the evaluation.
+int run(const struct options *const options, const char *const input, const int fd) {
+	struct stats_phases phases = {0};
+	const uint64_t start = stats_clock();
+	struct run_source source;
+	if (run_source_open(&source, input))
+		return 1;
+	struct ast root = {0};
+	const uint64_t opened = stats_clock();
+	phases.read = opened - start;
+	int ret = run_parse_source(&root, options, source.bytes, source.length);
+	phases.parse = stats_clock() - opened;
+	run_source_close(&source);
+	if (ret == 0)
+		ret = run_program(&root, 0, options, fd, &phases);
+	// ast_print(&root);
+	ast_destroy(&root);
+	return ret;
+}
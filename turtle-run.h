@@ -0,0 +1,61 @@
+#ifndef TURTLE_RUN_H
+#define TURTLE_RUN_H
+
+#include "turtle-ast.h"
+
+// the evaluators, the tree walker is kept as a reference for the bytecode VM
+enum engine {
+	ENGINE_VM, ENGINE_TREE,
+};
+
+// the options of a run, given by the command line (or by a request of the server, see turtle-serve.h)
+struct options {
+	enum engine engine;
+	size_t max_depth;
+	size_t buffer_size;
+	enum output_format format;
+	unsigned int svg_decimals;
+	bool optimize;
+	bool replay;
+	bool memoize;
+	bool simplify;
+	size_t segments;
+	uint64_t seed;
+	bool framed; // the output is written by chunks prefixed with their length (see output_flush)
+	const char *render_path; // the drawing is rasterized into this image instead of being written (see turtle-render.h)
+	size_t width;
+	size_t height;
+	size_t threads; // the threads drawing the image, 0 for one per processor
+	bool profile; // the VM counts and times the commands, the report is written to STDERR (see turtle-profile.h)
+	const char *profile_path; // the JSON file of the profile, when it's written
+	bool stats; // the counters, the sizes and the phases of each program are written to STDERR (see turtle-stats.h)
+};
+
+// the default options, the seed is 0
+void options_create(struct options *self);
+
+// parse a program and prepare its AST for the evaluators (folded, resolved and hoisted when optimizing)
+// the source is followed by two null bytes and is scanned in place (see ast_parse)
+// return 0 on success or 1 when the program can't be parsed (the message is written), the AST must be destroyed anyway
+int run_parse_source(struct ast *root, const struct options *options, char *source, size_t length);
+
+// the hash of a source, it identifies the cached programs
+uint64_t run_hash(const char *source, size_t length);
+
+// evaluate a prepared AST, its drawing is written to a file descriptor, return the error number (0 on success)
+// the AST isn't modified, it can be evaluated by many threads at once
+int run_eval(const struct ast *root, const struct options *options, int fd);
+
+// the source of a program is a file mapped in memory, or STDIN when its path is null
+
+// parse and evaluate a program, every state is local to the call
+int run(const struct options *options, const char *input, int fd);
+
+// parse a program and write its compiled file (see turtle-tbc.h), nothing is evaluated
+int run_compile(const struct options *options, const char *input, const char *path);
+
+// evaluate the compiled file of a program in place with the VM, the file is rebuilt when it wasn't compiled
+// from this source (or with other optimizations), the source is only parsed in this case
+int run_load(const struct options *options, const char *input, const char *path, int fd);
+
+#endif /* TURTLE_RUN_H */
@@ -0,0 +1,333 @@
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "turtle-serve.h"
+
+/*
+ * cache of the parsed programs
+ * The entries are in a doubly linked list, the most recently used first. An entry evicted while a worker
+ * is evaluating it is only detached, the last worker releasing it destroys it.
+ */
+
+struct serve_entry {
+	uint64_t hash;
+	char *source;
+	size_t length;
+	struct ast root;
+	size_t references;
+	bool cached;
+	struct serve_entry *previous;
+	struct serve_entry *next;
+};
+
+struct serve_cache {
+	pthread_mutex_t mutex;
+	struct serve_entry *first;
+	struct serve_entry *last;
+	size_t count;
+	size_t capacity;
+};
+
+static void serve_free(struct serve_entry *const entry) {
+	ast_destroy(&entry->root);
+	free(entry->source);
+	free(entry);
+}
+
+static void serve_detach(struct serve_cache *const cache, struct serve_entry *const entry) {
+	if (entry->previous)
+		entry->previous->next = entry->next;
+	else
+		cache->first = entry->next;
+	if (entry->next)
+		entry->next->previous = entry->previous;
+	else
+		cache->last = entry->previous;
+	entry->previous = entry->next = 0;
+	--cache->count;
+}
+
+static void serve_attach(struct serve_cache *const cache, struct serve_entry *const entry) {
+	entry->next = cache->first;
+	if (cache->first)
+		cache->first->previous = entry;
+	else
+		cache->last = entry;
+	cache->first = entry;
+	++cache->count;
+}
+
+// Find a program and move it to the front of the list, the mutex is locked.
+static struct serve_entry *serve_find(struct serve_cache *const cache, const uint64_t hash, const char *const source, const size_t length) {
+	for (struct serve_entry *entry = cache->first ; entry ; entry = entry->next)
+		if (entry->hash == hash && entry->length == length && memcmp(entry->source, source, length) == 0) {
+			serve_detach(cache, entry);
+			serve_attach(cache, entry);
+			++entry->references;
+			return entry;
+		}
+	return 0;
+}
+
+static void serve_release(struct serve_cache *const cache, struct serve_entry *const entry) {
+	pthread_mutex_lock(&cache->mutex);
+	const bool unused = --entry->references == 0 && !entry->cached;
+	pthread_mutex_unlock(&cache->mutex);
+	if (unused)
+		serve_free(entry);
+}
+
+// Return the parsed program of a source (it owns the source), or null if it can't be parsed.
+// The parsing is done without the lock, when two workers are parsing the same source the first one is kept.
+static struct serve_entry *serve_acquire(struct serve_cache *const cache, const struct options *const options, char *const source, const size_t length, int *const ret) {
+	const uint64_t hash = run_hash(source, length);
+	pthread_mutex_lock(&cache->mutex);
+	struct serve_entry *entry = serve_find(cache, hash, source, length);
+	pthread_mutex_unlock(&cache->mutex);
+	if (entry) {
+		free(source);
+		*ret = 0;
+		return entry;
+	}
+	entry = calloc(1, sizeof(struct serve_entry));
+	if (entry == 0) {
+		free(source);
+		*ret = 1;
+		return 0;
+	}
+	entry->hash = hash;
+	entry->source = source;
+	entry->length = length;
+	entry->references = 1;
+	*ret = run_parse_source(&entry->root, options, source, length);
+	if (*ret) {
+		serve_free(entry);
+		return 0;
+	}
+	pthread_mutex_lock(&cache->mutex);
+	struct serve_entry *const found = serve_find(cache, hash, source, length);
+	if (found == 0) {
+		entry->cached = true;
+		++entry->references;
+		serve_attach(cache, entry);
+		while (cache->count > cache->capacity) {
+			struct serve_entry *const evicted = cache->last;
+			serve_detach(cache, evicted);
+			evicted->cached = false;
+			if (--evicted->references == 0)
+				serve_free(evicted); // not used by a worker (the new entry is used by this one)
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+	if (found) {
+		serve_free(entry);
+		return found;
+	}
+	return entry;
+}
+
+/*
+ * connections
+ * The connections accepted are given to the workers by a bounded queue.
+ */
+
+struct serve_server {
+	struct serve_cache cache;
+	struct options defaults;
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	int *queue;
+	size_t queue_first;
+	size_t queue_count;
+	size_t queue_capacity;
+};
+
+static bool serve_write(const int fd, const char *const bytes, const size_t count) {
+	size_t done = 0;
+	while (done < count) {
+		const ssize_t written = write(fd, bytes + done, count - done);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		done += (size_t) written;
+	}
+	return true;
+}
+
+// The end of a response, an empty chunk then the status.
+static bool serve_status(const int fd, const int status) {
+	const uint32_t value = (uint32_t) status;
+	const char bytes[8] = {0, 0, 0, 0, (char) value, (char) (value >> 8), (char) (value >> 16), (char) (value >> 24)};
+	return serve_write(fd, bytes, 8);
+}
+
+// Read the options of a request, the unknown keys are invalid.
+static bool serve_header(char *const line, struct options *const options, size_t *const length) {
+	char *saved, *end;
+	bool has_length = false;
+	for (char *key = strtok_r(line, " \n", &saved) ; key ; key = strtok_r(0, " \n", &saved)) {
+		char *const value = strchr(key, '=');
+		if (value == 0)
+			return false;
+		*value = 0;
+		const char *const text = value + 1;
+		errno = 0;
+		const unsigned long long int number = strtoull(text, &end, 10);
+		const bool is_number = *end == 0 && end != text && errno == 0;
+		if (strcmp(key, "length") == 0 && is_number && number <= SERVE_SOURCE_MAX) {
+			*length = (size_t) number;
+			has_length = true;
+		} else if (strcmp(key, "seed") == 0 && is_number)
+			options->seed = number;
+		else if (strcmp(key, "max-depth") == 0 && is_number) {
+			if (number < options->max_depth)
+				options->max_depth = (size_t) number;
+		} else if (strcmp(key, "engine") == 0 && strcmp(text, "vm") == 0)
+			options->engine = ENGINE_VM;
+		else if (strcmp(key, "engine") == 0 && strcmp(text, "tree") == 0)
+			options->engine = ENGINE_TREE;
+		else if (strcmp(key, "format") == 0 && strcmp(text, "text") == 0)
+			options->format = OUTPUT_TEXT;
+		else if (strcmp(key, "format") == 0 && strcmp(text, "binary") == 0)
+			options->format = OUTPUT_BINARY;
+		else
+			return false;
+	}
+	return has_length;
+}
+
+// Answer the requests of a connection until it's closed or a request is invalid.
+static void serve_connection(struct serve_server *const server, const int fd) {
+	const int input_fd = dup(fd);
+	FILE *const input = input_fd < 0 ? 0 : fdopen(input_fd, "r");
+	if (input == 0) {
+		if (input_fd >= 0)
+			close(input_fd);
+		return;
+	}
+	char line[SERVE_HEADER_MAX + 1];
+	while (fgets(line, sizeof(line), input)) {
+		struct options options = server->defaults;
+		options.seed = (uint64_t) time(NULL);
+		size_t length = 0;
+		if (strchr(line, '\n') == 0 || !serve_header(line, &options, &length)) {
+			serve_status(fd, EXIT_FAILURE);
+			break;
+		}
+		char *const source = malloc(length + 2); // scanned in place (see ast_parse)
+		if (source == 0) {
+			serve_status(fd, 1);
+			break;
+		}
+		if (fread(source, 1, length, input) != length) {
+			free(source);
+			serve_status(fd, EXIT_FAILURE);
+			break;
+		}
+		source[length] = source[length + 1] = 0;
+		int ret;
+		struct serve_entry *const entry = serve_acquire(&server->cache, &options, source, length, &ret);
+		if (entry) {
+			ret = run_eval(&entry->root, &options, fd);
+			serve_release(&server->cache, entry);
+		}
+		if (!serve_status(fd, ret))
+			break;
+	}
+	fclose(input);
+}
+
+static void *serve_worker(void *const argument) {
+	struct serve_server *const server = argument;
+	for (;;) {
+		pthread_mutex_lock(&server->mutex);
+		while (server->queue_count == 0)
+			pthread_cond_wait(&server->not_empty, &server->mutex);
+		const int fd = server->queue[server->queue_first];
+		server->queue_first = (server->queue_first + 1) % server->queue_capacity;
+		--server->queue_count;
+		pthread_cond_signal(&server->not_full);
+		pthread_mutex_unlock(&server->mutex);
+		serve_connection(server, fd);
+		close(fd);
+	}
+	return 0;
+}
+
+// Bind the socket, an existing socket file at this path is replaced.
+static int serve_listen(const char *const path) {
+	struct sockaddr_un address = {0};
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "The path of the socket '%s' is too long.\n", path);
+		return -1;
+	}
+	strcpy(address.sun_path, path);
+	struct stat status;
+	if (lstat(path, &status) == 0 && S_ISSOCK(status.st_mode))
+		unlink(path);
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *) &address, sizeof(address)) || listen(fd, SOMAXCONN)) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int serve(const char *const path, const struct options *const defaults, size_t workers, const size_t cache_size) {
+	if (workers == 0) {
+		const long count = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = count > 0 ? (size_t) count : 1;
+	}
+	signal(SIGPIPE, SIG_IGN); // a closed connection is a failed write
+	const int fd = serve_listen(path);
+	if (fd < 0)
+		return EXIT_FAILURE;
+	static struct serve_server server; // shared by the workers until the end of the process
+	server.defaults = *defaults;
+	server.defaults.framed = true;
+	if (server.defaults.buffer_size > UINT32_MAX)
+		server.defaults.buffer_size = UINT32_MAX; // the length of a chunk
+	server.cache.capacity = cache_size;
+	server.queue_capacity = 4 * workers;
+	server.queue = malloc(server.queue_capacity * sizeof(int));
+	if (server.queue == 0 || pthread_mutex_init(&server.mutex, 0) || pthread_mutex_init(&server.cache.mutex, 0)
+			|| pthread_cond_init(&server.not_empty, 0) || pthread_cond_init(&server.not_full, 0)) {
+		fprintf(stderr, "Memory Allocation Error.\n");
+		return 1;
+	}
+	for (size_t i = 0 ; i < workers ; ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread, 0, serve_worker, &server)) {
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+		pthread_detach(thread);
+	}
+	for (;;) {
+		const int connection = accept(fd, 0, 0);
+		if (connection < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("accept");
+			return EXIT_FAILURE;
+		}
+		pthread_mutex_lock(&server.mutex);
+		while (server.queue_count == server.queue_capacity)
+			pthread_cond_wait(&server.not_full, &server.mutex);
+		server.queue[(server.queue_first + server.queue_count++) % server.queue_capacity] = connection;
+		pthread_cond_signal(&server.not_empty);
+		pthread_mutex_unlock(&server.mutex);
+	}
+}
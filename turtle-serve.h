@@ -0,0 +1,30 @@
+#ifndef TURTLE_SERVE_H
+#define TURTLE_SERVE_H
+
+#include "turtle-run.h"
+
+#define SERVE_CACHE_DEFAULT		64			// the parsed programs kept by the cache
+#define SERVE_SOURCE_MAX		67108864	// the largest program accepted (64 MiB)
+#define SERVE_HEADER_MAX		1024		// the longest header line of a request
+
+/*
+ * The server (turtle --serve PATH) listens on a Unix socket, the connections are served by a fixed pool of workers.
+ * A connection sends its requests one after another, each request is answered before the next one is read :
+ * - the request is a header line of space separated key=value pairs, then the source of the program.
+ *   length=N is the size of the source in bytes (required, at most SERVE_SOURCE_MAX),
+ *   seed=N is the seed of random (the current time by default),
+ *   max-depth=N limits the nesting of the program (at most the limit of the server),
+ *   engine=vm|tree and format=text|binary are choosing the evaluator and the output format.
+ * - the response is the output of the program by chunks, each one prefixed by its little-endian 32 bits length,
+ *   then an empty chunk followed by the status as a little-endian 32 bits integer (the exit code of turtle).
+ *   An invalid request is answered by a status of EXIT_FAILURE without any chunk, then the connection is closed.
+ * The error messages of the programs are written to the standard error of the server.
+ * A connection closed before the end of its response stops the evaluation of its program (its output can't be written).
+ * The parsed programs are kept in a LRU cache keyed by a hash of their source, they are shared by the workers.
+ * The options given to the server (like --memoize) are the defaults of every request.
+ */
+
+// serve forever, return EXIT_FAILURE if the server can't start
+int serve(const char *path, const struct options *defaults, size_t workers, size_t cache_size);
+
+#endif /* TURTLE_SERVE_H */
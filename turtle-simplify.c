@@ -0,0 +1,169 @@
+#include <string.h>
+
+#include "turtle-simplify.h"
+
+int simplify_create(struct simplify *const self, const size_t segments) {
+	memset(self, 0, sizeof(struct simplify));
+	self->turtle.exact = self->viewer.exact = true; // both are starting at 0, 0 with the color 0, 0, 0
+	self->generation = 1;
+	if (segments) {
+		self->segment_capacity = 16;
+		while (self->segment_capacity / 2 < segments)
+			self->segment_capacity *= 2;
+		self->segment_limit = segments;
+		self->segments = calloc(self->segment_capacity, sizeof(struct simplify_segment));
+		if (self->segments == 0)
+			return 1;
+	}
+	return 0;
+}
+
+void simplify_destroy(struct simplify *const self) {
+	free(self->segments);
+	memset(self, 0, sizeof(struct simplify));
+}
+
+static struct simplify_point simplify_point(const double x, const double y) {
+	struct simplify_point point = {.x = x, .y = y};
+	point.exact = output_fixed_point(x, &point.fx) && output_fixed_point(y, &point.fy);
+	return point;
+}
+
+// Two points are written the same when they have the same fixed-point values.
+static bool simplify_same(const struct simplify_point *const a, const struct simplify_point *const b) {
+	if (a->exact && b->exact)
+		return a->fx == b->fx && a->fy == b->fy;
+	return a->x == b->x && a->y == b->y;
+}
+
+/*
+ * hash set of the drawn segments
+ */
+
+// Forget every segment at once, the slots of the previous generations are free.
+static void simplify_clear(struct simplify *const self) {
+	self->segment_count = 0;
+	if (++self->generation == 0) {
+		memset(self->segments, 0, self->segment_capacity * sizeof(struct simplify_segment));
+		self->generation = 1;
+	}
+}
+
+static uint64_t simplify_mix(uint64_t h) {
+	h ^= h >> 30;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 27;
+	h *= 0x94D049BB133111EBULL;
+	return h ^ (h >> 31);
+}
+
+// Insert the segment a b (the turtle went from a to b, or from b to a), return false if it was already drawn.
+static bool simplify_insert(struct simplify *const self, const struct simplify_point *a, const struct simplify_point *b) {
+	if (a->fx > b->fx || (a->fx == b->fx && a->fy > b->fy)) {
+		const struct simplify_point *const swap = a;
+		a = b;
+		b = swap;
+	}
+	uint64_t h = simplify_mix((uint64_t) a->fx);
+	h = simplify_mix(h ^ (uint64_t) a->fy);
+	h = simplify_mix(h ^ (uint64_t) b->fx);
+	h = simplify_mix(h ^ (uint64_t) b->fy);
+	const size_t mask = self->segment_capacity - 1;
+	for (size_t i = (size_t) h & mask ; ; i = (i + 1) & mask) {
+		struct simplify_segment *const segment = self->segments + i;
+		if (segment->generation != self->generation) {
+			if (self->segment_count == self->segment_limit) {
+				simplify_clear(self);
+				return simplify_insert(self, a, b);
+			}
+			*segment = (struct simplify_segment) {a->fx, a->fy, b->fx, b->fy, self->generation};
+			++self->segment_count;
+			return true;
+		}
+		if (segment->x0 == a->fx && segment->y0 == a->fy && segment->x1 == b->fx && segment->y1 == b->fy)
+			return false;
+	}
+}
+
+/*
+ * lookahead window
+ */
+
+// The pending LineTo is extended by the segment from its end to the point when they have the same direction.
+// The differences are small enough for the products to be exact.
+static bool simplify_extends(const struct simplify *const self, const struct simplify_point *const point) {
+	const struct simplify_point *const from = &self->from, *const to = &self->to;
+	if (!from->exact || !to->exact || !point->exact)
+		return false;
+	const int64_t dx1 = to->fx - from->fx, dy1 = to->fy - from->fy;
+	const int64_t dx2 = point->fx - to->fx, dy2 = point->fy - to->fy;
+	if (llabs(dx1) > SIMPLIFY_DELTA_MAX || llabs(dy1) > SIMPLIFY_DELTA_MAX || llabs(dx2) > SIMPLIFY_DELTA_MAX || llabs(dy2) > SIMPLIFY_DELTA_MAX)
+		return false;
+	return dx1 * dy2 == dy1 * dx2 && dx1 * dx2 + dy1 * dy2 > 0;
+}
+
+// Write the pending LineTo, preceded by its color and its start when the viewer needs them.
+static void simplify_flush(struct simplify *const self, struct output *const output) {
+	if (!self->pending)
+		return;
+	self->pending = false;
+	if (self->viewer_r != self->pending_r || self->viewer_g != self->pending_g || self->viewer_b != self->pending_b) {
+		self->viewer_r = self->pending_r;
+		self->viewer_g = self->pending_g;
+		self->viewer_b = self->pending_b;
+		++self->lines_written;
+		output_color(output, self->viewer_r, self->viewer_g, self->viewer_b);
+	}
+	if (!simplify_same(&self->viewer, &self->from)) {
+		++self->lines_written;
+		output_move(output, true, self->from.x, self->from.y);
+	}
+	self->viewer = self->to;
+	++self->lines_written;
+	output_move(output, false, self->to.x, self->to.y);
+}
+
+// The color is written with the next LineTo.
+void simplify_color(struct simplify *const self, struct output *const output, const double r, const double g, const double b) {
+	(void) output;
+	++self->lines_read;
+	self->r = r;
+	self->g = g;
+	self->b = b;
+}
+
+// A MoveTo only moves the turtle, a LineTo is dropped, merged into the pending one or becomes the pending one.
+void simplify_move(struct simplify *const self, struct output *const output, const bool up, const double x, const double y) {
+	++self->lines_read;
+	const struct simplify_point point = simplify_point(x, y);
+	const struct simplify_point start = self->turtle;
+	self->turtle = point;
+	if (up)
+		return;
+	if (self->segments && start.exact && point.exact) {
+		if (self->segment_r != self->r || self->segment_g != self->g || self->segment_b != self->b) {
+			simplify_clear(self); // the segments of the new color are drawn over the previous ones
+			self->segment_r = self->r;
+			self->segment_g = self->g;
+			self->segment_b = self->b;
+		}
+		if (!simplify_insert(self, &start, &point))
+			return;
+	}
+	if (self->pending && self->pending_r == self->r && self->pending_g == self->g && self->pending_b == self->b
+			&& simplify_same(&self->to, &start) && simplify_extends(self, &point)) {
+		self->to = point;
+		return;
+	}
+	simplify_flush(self, output);
+	self->pending = true;
+	self->from = start;
+	self->to = point;
+	self->pending_r = self->r;
+	self->pending_g = self->g;
+	self->pending_b = self->b;
+}
+
+void simplify_finish(struct simplify *const self, struct output *const output) {
+	simplify_flush(self, output);
+}
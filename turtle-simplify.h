@@ -0,0 +1,78 @@
+#ifndef TURTLE_SIMPLIFY_H
+#define TURTLE_SIMPLIFY_H
+
+#include "turtle-output.h"
+
+#define SIMPLIFY_SEGMENTS_DEFAULT	65536 // the drawn segments remembered at once, see --simplify=SEGMENTS
+#define SIMPLIFY_DELTA_MAX			2147483647LL // the longest fixed-point difference tested for collinearity
+
+// The simplification of the output is optional (see --simplify), it's a stage between the evaluators and the writer.
+// The viewer draws opaque lines between the written points, so the image is kept when :
+// - a LineTo continuing the previous one in the same direction and the same color is merged into it,
+// - the MoveTo of a chain are replaced by the last one, written before the next LineTo only if it's needed,
+// - a Color is written before the next LineTo only if it's not the color of the viewer,
+// - a LineTo drawing a segment already drawn since the last change of color is dropped.
+// The points are compared after their rounding to 4 decimals (see output_fixed_point), the tests are exact.
+// The lookahead window is a single pending LineTo, the drawn segments are kept in a hash set of bounded size
+// (it's cleared when it's full or when the color changes).
+
+// a point given by the evaluator, exact is set when it has a fixed-point value
+struct simplify_point {
+	double x;
+	double y;
+	int64_t fx;
+	int64_t fy;
+	bool exact;
+};
+
+// a drawn segment, its ends are sorted, generation tells whether the slot is used
+struct simplify_segment {
+	int64_t x0;
+	int64_t y0;
+	int64_t x1;
+	int64_t y1;
+	uint32_t generation;
+};
+
+struct simplify {
+	struct simplify_point turtle; // the position given by the evaluator
+	double r;                     // the color given by the evaluator
+	double g;
+	double b;
+	struct simplify_point viewer; // the position written
+	double viewer_r;              // the color written
+	double viewer_g;
+	double viewer_b;
+	bool pending;                 // a LineTo is not written yet, it may be extended
+	struct simplify_point from;
+	struct simplify_point to;
+	double pending_r;
+	double pending_g;
+	double pending_b;
+	struct simplify_segment *segments; // the hash set of the drawn segments, when enabled
+	size_t segment_capacity;           // a power of two
+	size_t segment_limit;
+	size_t segment_count;
+	uint32_t generation;
+	double segment_r;                  // the color of the drawn segments
+	double segment_g;
+	double segment_b;
+	size_t lines_read;
+	size_t lines_written;
+};
+
+// prepare a simplification remembering at most `segments` drawn segments (0 disables the hash set)
+// return 0 on success or 1 on memory allocation error
+int simplify_create(struct simplify *self, size_t segments);
+
+// release the hash set
+void simplify_destroy(struct simplify *self);
+
+// the lines given by the evaluator, they are written to the output when they change the image
+void simplify_color(struct simplify *self, struct output *output, double r, double g, double b);
+void simplify_move(struct simplify *self, struct output *output, bool up, double x, double y);
+
+// write the pending LineTo, the trailing MoveTo and Color are not changing the image
+void simplify_finish(struct simplify *self, struct output *output);
+
+#endif /* TURTLE_SIMPLIFY_H */
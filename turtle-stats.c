@@ -0,0 +1,35 @@
+#include <time.h>
+
+#include "turtle-stats.h"
+#include "turtle-ast.h"
+
+uint64_t stats_clock(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000U + (uint64_t) now.tv_nsec;
+}
+
+static double stats_ms(const uint64_t time) {
+	return (double) time / 1e6;
+}
+
+void stats_report(const struct stats_phases *const phases, const struct ast *const ast, const struct context *const ctx, FILE *const file) {
+	const struct stats *const self = &ctx->stats;
+	const uint64_t total = phases->read + phases->parse + phases->compile + phases->eval + phases->flush;
+	size_t chunks = 0, ast_bytes = 0;
+	for (const struct ast_chunk *chunk = ast ? ast->chunks : 0 ; chunk ; chunk = chunk->next, ++chunks)
+		ast_bytes += sizeof(struct ast_chunk) + chunk->capacity * sizeof(struct ast_node);
+	const size_t names = ast ? ast->parsing.count : 0;
+	fprintf(file, "Stats : %.3f ms (read %.3f, parse %.3f, compile %.3f, eval %.3f, flush %.3f).\n", stats_ms(total),
+		stats_ms(phases->read), stats_ms(phases->parse), stats_ms(phases->compile), stats_ms(phases->eval), stats_ms(phases->flush));
+	if (ast)
+		fprintf(file, "AST : %zu nodes, %zu bytes in %zu chunks, %zu names.\n", ast->node_count, ast_bytes, chunks, names);
+	else
+		fprintf(file, "AST : none, the bytecode was loaded from its compiled file.\n");
+	fprintf(file, "Variables : %zu slots, %zu bytes. Procedures : %zu declared.\n", ctx->variable_count,
+		ctx->variable_count * (sizeof(double) + sizeof(bool)), self->procedures);
+	fprintf(file, "Allocations : %zu (AST %zu, evaluation %zu).\n", chunks + names + self->allocations, chunks + names, self->allocations);
+	fprintf(file, "Deepest : %zu nested calls, %zu nested repeats.\n", self->deepest_calls, self->deepest_repeats);
+	fprintf(file, "Evaluated : %llu commands, %llu expressions.\n", self->commands, self->expressions);
+	fprintf(file, "Output : %zu lines (%zu Color, %zu MoveTo, %zu LineTo).\n", ctx->lines_printed, self->colors, self->moves, self->lines);
+}
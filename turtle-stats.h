@@ -0,0 +1,52 @@
+#ifndef TURTLE_STATS_H
+#define TURTLE_STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The counters of an evaluation are always kept by the context, each one is an addition made by an event which is
+// already doing some work (a command, an output line, a frame, an allocation), the VM keeps its counts in locals.
+// --stats writes them to STDERR after each program, with the sizes of the AST and the time of each phase :
+// - the commands are the ones evaluated (a block isn't a command), the iterations replayed by --replay are
+//   counted, the bodies of the calls replayed by --memoize are not,
+// - the expressions are the operations computed for them, a value, a variable, an operator or a function each
+//   (the parentheses and the unary plus are not operations), a hoisted expression is read after its first value,
+// - the output lines are the ones given to the writer, before their simplification (see ast_eval_write_output),
+// - the allocations are the blocks allocated by the evaluation (the variables, the stacks and the procedure table
+//   of the tree walker), the blocks of the AST are counted from its chunks and its names,
+// - the deepest calls are the peak of nested_call_count, the deepest repeats the most loops (repeat or while) being
+//   evaluated at once.
+
+struct ast;
+struct context;
+
+struct stats {
+	unsigned long long int commands;
+	unsigned long long int expressions;
+	size_t colors; // the output lines : Color,
+	size_t moves; // MoveTo
+	size_t lines; // and LineTo
+	size_t allocations;
+	size_t procedures; // the procedures declared
+	size_t deepest_calls;
+	size_t deepest_repeats;
+};
+
+// the time of the phases of a program, in nanoseconds
+struct stats_phases {
+	uint64_t read; // the source is mapped or read
+	uint64_t parse; // parsed, folded, resolved and hoisted
+	uint64_t compile; // the bytecode is compiled (or loaded, see run_load)
+	uint64_t eval; // the evaluation, its output is written through its buffer
+	uint64_t flush; // the end of the output, when the context is destroyed
+};
+
+// a monotonic clock, in nanoseconds, shared by the stats, the profile and turtle-bench
+uint64_t stats_clock(void);
+
+// write the report of a program, its AST is null when its bytecode was loaded (see run_load)
+// the context is destroyed, only its counters and its sizes are read
+void stats_report(const struct stats_phases *phases, const struct ast *ast, const struct context *ctx, FILE *file);
+
+#endif /* TURTLE_STATS_H */
@@ -0,0 +1,192 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "turtle-tbc.h"
+
+// the offsets of the sections, computed from the counts of the header
+struct tbc_layout {
+	size_t values;
+	size_t steps;
+	size_t code;
+	size_t names;
+	size_t strings;
+	size_t size;
+};
+
+static size_t tbc_align(const size_t offset) {
+	return (offset + 7) & ~(size_t) 7;
+}
+
+static void tbc_layout(const struct tbc_header *const header, struct tbc_layout *const layout) {
+	layout->values = sizeof(struct tbc_header);
+	layout->steps = layout->values + header->value_count * sizeof(double);
+	layout->code = layout->steps + header->step_count * sizeof(struct motion_step);
+	layout->names = tbc_align(layout->code + header->code_count * sizeof(int32_t));
+	layout->strings = layout->names + (header->variable_count + header->proc_count) * sizeof(uint64_t);
+	layout->size = layout->strings + header->string_size;
+}
+
+/*
+ * writer
+ */
+
+static bool tbc_write(FILE *const file, const void *const bytes, const size_t count) {
+	return count == 0 || fwrite(bytes, 1, count, file) == count;
+}
+
+static bool tbc_write_names(FILE *const file, const char *const *const names, const size_t count, uint64_t *const offset) {
+	for (size_t i = 0 ; i < count ; ++i) {
+		const uint64_t value = names[i] ? *offset : TBC_NO_NAME;
+		if (names[i])
+			*offset += strlen(names[i]) + 1;
+		if (!tbc_write(file, &value, sizeof(value)))
+			return false;
+	}
+	return true;
+}
+
+static bool tbc_write_strings(FILE *const file, const char *const *const names, const size_t count) {
+	for (size_t i = 0 ; i < count ; ++i)
+		if (names[i] && !tbc_write(file, names[i], strlen(names[i]) + 1))
+			return false;
+	return true;
+}
+
+// The motion steps are copied member by member, so the padding bytes of the file are zeros.
+static bool tbc_write_program(FILE *const file, const struct vm_program *const program, const struct tbc_header *const header, const struct tbc_layout *const layout) {
+	static const char zeros[8] = {0};
+	if (!tbc_write(file, header, sizeof(struct tbc_header)) || !tbc_write(file, program->values, program->value_count * sizeof(double)))
+		return false;
+	for (size_t i = 0 ; i < program->step_count ; ++i) {
+		struct motion_step step;
+		memset(&step, 0, sizeof(step));
+		step.cmd = program->steps[i].cmd;
+		memcpy(step.value, program->steps[i].value, sizeof(step.value));
+		if (!tbc_write(file, &step, sizeof(step)))
+			return false;
+	}
+	uint64_t offset = 0;
+	return tbc_write(file, program->code, program->code_count * sizeof(int32_t))
+		&& tbc_write(file, zeros, layout->names - (layout->code + program->code_count * sizeof(int32_t)))
+		&& tbc_write_names(file, program->variable_names, program->variable_count, &offset)
+		&& tbc_write_names(file, program->proc_names, program->proc_count, &offset)
+		&& tbc_write_strings(file, program->variable_names, program->variable_count)
+		&& tbc_write_strings(file, program->proc_names, program->proc_count);
+}
+
+// The program is written to a temporary file renamed at the end, a reader never sees a partial file.
+int tbc_save(const struct vm_program *const program, const char *const path, const uint64_t source_hash, const uint32_t flags) {
+	struct tbc_header header = {
+		.magic = {'T', 'R', 'T', 'C'},
+		.version = TBC_VERSION,
+		.byte_order = TBC_BYTE_ORDER,
+		.flags = flags,
+		.step_size = sizeof(struct motion_step),
+		.source_hash = source_hash,
+		.code_count = program->code_count,
+		.value_count = program->value_count,
+		.step_count = program->step_count,
+		.variable_count = program->variable_count,
+		.proc_count = program->proc_count,
+		.stack_size = program->stack_size,
+	};
+	for (size_t i = 0 ; i < program->variable_count ; ++i)
+		header.string_size += program->variable_names[i] ? strlen(program->variable_names[i]) + 1 : 0;
+	for (size_t i = 0 ; i < program->proc_count ; ++i)
+		header.string_size += program->proc_names[i] ? strlen(program->proc_names[i]) + 1 : 0;
+	struct tbc_layout layout;
+	tbc_layout(&header, &layout);
+	char *const temporary = malloc(strlen(path) + 8);
+	if (temporary == 0)
+		return ENOMEM;
+	sprintf(temporary, "%s.XXXXXX", path);
+	const int fd = mkstemp(temporary);
+	if (fd >= 0)
+		fchmod(fd, 0644); // mkstemp creates a private file
+	FILE *const file = fd < 0 ? 0 : fdopen(fd, "wb");
+	int error = file ? 0 : errno;
+	if (file) {
+		errno = 0;
+		if (!tbc_write_program(file, program, &header, &layout))
+			error = errno ? errno : EIO;
+		if (fclose(file) && error == 0)
+			error = errno;
+		if (error == 0 && rename(temporary, path))
+			error = errno;
+		if (error)
+			unlink(temporary);
+	} else if (fd >= 0) {
+		close(fd);
+		unlink(temporary);
+	}
+	free(temporary);
+	return error;
+}
+
+/*
+ * loader
+ */
+
+// The names are pointers into the mapping, the table of strings ends with a null byte.
+static bool tbc_names(const char **const names, const uint64_t *const offsets, const size_t count, const char *const strings, const uint64_t string_size) {
+	for (size_t i = 0 ; i < count ; ++i) {
+		if (offsets[i] == TBC_NO_NAME)
+			continue;
+		if (offsets[i] >= string_size)
+			return false;
+		names[i] = strings + offsets[i];
+	}
+	return true;
+}
+
+int tbc_load(struct vm_program *const program, const char *const path, const uint64_t source_hash, const uint32_t flags) {
+	memset(program, 0, sizeof(struct vm_program));
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 1;
+	struct stat status;
+	void *mapping = MAP_FAILED;
+	if (fstat(fd, &status) == 0 && (size_t) status.st_size >= sizeof(struct tbc_header))
+		mapping = mmap(0, (size_t) status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+		return 1;
+	program->mapping = mapping;
+	program->mapping_size = (size_t) status.st_size;
+	const char *const base = mapping;
+	const struct tbc_header *const header = mapping;
+	struct tbc_layout layout;
+	tbc_layout(header, &layout);
+	const uint64_t limit = (uint64_t) status.st_size; // no count can be larger, the layout can't overflow
+	bool valid = memcmp(header->magic, "TRTC", 4) == 0 && header->version == TBC_VERSION
+		&& header->byte_order == TBC_BYTE_ORDER && header->step_size == sizeof(struct motion_step)
+		&& header->flags == flags && header->source_hash == source_hash
+		&& header->code_count <= limit && header->value_count <= limit && header->step_count <= limit
+		&& header->variable_count <= limit && header->proc_count <= limit && header->string_size <= limit
+		&& layout.size == (size_t) status.st_size && (header->string_size == 0 || base[layout.size - 1] == 0);
+	if (valid) {
+		program->code = (int32_t *) (base + layout.code);
+		program->code_count = header->code_count;
+		program->values = (double *) (base + layout.values);
+		program->value_count = header->value_count;
+		program->steps = (struct motion_step *) (base + layout.steps);
+		program->step_count = header->step_count;
+		program->variable_count = header->variable_count;
+		program->proc_count = header->proc_count;
+		program->stack_size = header->stack_size;
+		program->variable_names = calloc(program->variable_count + 1, sizeof(const char *));
+		program->proc_names = calloc(program->proc_count + 1, sizeof(const char *));
+		const uint64_t *const offsets = (const uint64_t *) (base + layout.names);
+		valid = program->variable_names && program->proc_names
+			&& tbc_names(program->variable_names, offsets, program->variable_count, base + layout.strings, header->string_size)
+			&& tbc_names(program->proc_names, offsets + program->variable_count, program->proc_count, base + layout.strings, header->string_size);
+	}
+	if (!valid) {
+		vm_destroy(program);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef TURTLE_TBC_H
+#define TURTLE_TBC_H
+
+#include "turtle-vm.h"
+
+#define TBC_VERSION			3
+#define TBC_BYTE_ORDER		0x01020304
+#define TBC_FLAG_OPTIMIZED	0x1 // the AST was folded and hoisted before the compilation
+#define TBC_NO_NAME			UINT64_MAX
+
+/*
+ * A .tbc file (see --compile-to and --load) is a compiled program, it's mapped in memory and evaluated in place :
+ * the sections are arrays at aligned offsets, the names are offsets into a table of strings.
+ * It's written in the byte order of the machine, a file written by another kind of machine is rebuilt.
+ * - the header (struct tbc_header), with the hash of the source (see run_hash) and the counts,
+ * - the literals (double values), the motion templates (struct motion_step), the bytecode (int32_t words),
+ *   padded to 8 bytes,
+ * - the offsets of the variable names then of the procedure names (uint64_t, TBC_NO_NAME for a hidden slot),
+ * - the names, null-terminated strings.
+ * The file is trusted like the executable, only its header and its sizes are checked.
+ */
+struct tbc_header {
+	char magic[4]; // "TRTC"
+	uint32_t version;
+	uint32_t byte_order; // TBC_BYTE_ORDER
+	uint32_t flags;
+	uint32_t step_size; // sizeof(struct motion_step)
+	uint32_t reserved;
+	uint64_t source_hash;
+	uint64_t code_count;
+	uint64_t value_count;
+	uint64_t step_count;
+	uint64_t variable_count;
+	uint64_t proc_count;
+	uint64_t stack_size;
+	uint64_t string_size;
+};
+
+// write a compiled program (atomically, the file is replaced), return 0 on success or an errno value
+int tbc_save(const struct vm_program *program, const char *path, uint64_t source_hash, uint32_t flags);
+
+// map a compiled program, it's released by vm_destroy
+// return 0 on success, or 1 if the file is missing, invalid, or compiled from another source or with other flags
+int tbc_load(struct vm_program *program, const char *path, uint64_t source_hash, uint32_t flags);
+
+#endif /* TURTLE_TBC_H */
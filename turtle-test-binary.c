@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <float.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "turtle-output.h"
+
+// This test checks that the binary format (--format=binary) turned back by turtle-decode is the text format, byte for byte :
+// - every sample program is evaluated by turtle in both formats with a fixed seed,
+// - so are the programs of binary_programs, drawing the numbers which aren't fixed-point in the binary format
+//   (a negative zero, huge coordinates, infinities),
+// - a program can't draw a NaN, the values of binary_colors and binary_moves are written by the writers of turtle-output.h.
+// Example : ./turtle-test-binary ./turtle ./turtle-decode
+
+#ifndef TURTLE_TEST_DIR
+#define TURTLE_TEST_DIR "." // the directory of the sample programs, given by CMake
+#endif
+
+#define BINARY_SEED		42
+#define BINARY_COMMAND_MAX	4096
+
+// the programs drawing the numbers the binary format writes with flags or as doubles
+static const char *const binary_programs[][2] = {
+	{"(negative zeros)", "pos -0.00001, -0.00003\nfw 0.00002\nup\npos 0.00004, -0.00005\ndown\nfw 1\n"},
+	{"(huge coordinates)", "fw 1e200\nrt 45\nfw 1e300\npos 99999999999.99995, -1e11\nfw 0.0001\nhome\nfw 1\n"},
+	{"(infinities)", "fw 1e308\nfw 1e308\nrt 45\nfw 1e308\nfw 1e308\nfw 1e308\n"},
+};
+
+static const double binary_colors[][3] = {
+	{0, 0, 0}, {-0.0, 0.5, 1}, {0.00005, 0.99995, -0.00004}, {NAN, -NAN, INFINITY}, {1e300, -1, 2}, {0.25, 0.5, 0.75},
+};
+
+static const double binary_moves[][2] = {
+	{-0.0, -0.00001}, {NAN, 0}, {-NAN, 1}, {12.34565, -0.00005}, {INFINITY, -INFINITY}, {1e300, -1e300}, {DBL_MAX, -DBL_MIN},
+	{99999999999.99994, -1e11}, {1e11, 1e11 + 0.5}, {0.00005, -0.00004999}, {-NAN, NAN}, {3, 4},
+};
+
+struct binary_output {
+	char *bytes;
+	size_t length;
+	int status;
+};
+
+static int usage(const char *name) {
+	fprintf(stderr, "Usage: %s TURTLE TURTLE-DECODE\n", name);
+	return EXIT_FAILURE;
+}
+
+// Read a stream until its end, return false on error.
+static bool binary_read(FILE *const stream, struct binary_output *const output) {
+	size_t capacity = 0;
+	for (;;) {
+		if (capacity == output->length) {
+			char *const bytes = realloc(output->bytes, capacity += 65536);
+			if (bytes == 0)
+				return false;
+			output->bytes = bytes;
+		}
+		const size_t count = fread(output->bytes + output->length, 1, capacity - output->length, stream);
+		output->length += count;
+		if (count == 0)
+			return !ferror(stream);
+	}
+}
+
+// Run a shell command and keep its output, return false when it can't be run or read (the message is written).
+static bool binary_run(const char *const command, struct binary_output *const output) {
+	memset(output, 0, sizeof(struct binary_output));
+	FILE *const stream = popen(command, "r");
+	bool ok = stream && binary_read(stream, output);
+	if (stream)
+		output->status = pclose(stream);
+	if (!ok)
+		fprintf(stderr, "The command %s can't be run : %s.\n", command, strerror(errno));
+	return ok;
+}
+
+// Create a temporary file holding some bytes, its path is written into path, return false on error.
+static bool binary_temporary(char path[static 32], const char *const bytes, const size_t length) {
+	strcpy(path, "/tmp/turtle-test-binary-XXXXXX");
+	const int fd = mkstemp(path);
+	if (fd < 0)
+		return false;
+	const bool ok = write(fd, bytes, length) == (ssize_t) length;
+	close(fd);
+	if (!ok)
+		unlink(path);
+	return ok;
+}
+
+// Compare the text output of a command with the output of turtle-decode reading the binary one, return false if they differ.
+static bool binary_compare(const char *const name, const char *const text_command, const char *const binary_command) {
+	struct binary_output text, binary;
+	bool ok = binary_run(text_command, &text) && binary_run(binary_command, &binary);
+	if (ok && (text.status || binary.status)) {
+		fprintf(stderr, "%s : the text output ends with the status %d, the decoded binary output with the status %d.\n", name, text.status, binary.status);
+		ok = false;
+	} else if (ok && (text.length != binary.length || (text.length && memcmp(text.bytes, binary.bytes, text.length)))) {
+		size_t line = 1;
+		for (size_t i = 0 ; i < text.length && i < binary.length && text.bytes[i] == binary.bytes[i] ; ++i)
+			line += text.bytes[i] == '\n';
+		fprintf(stderr, "%s : the %zu bytes of the decoded binary output are not the %zu bytes of the text output, from the line %zu.\n", name, binary.length, text.length, line);
+		ok = false;
+	}
+	free(text.bytes);
+	free(binary.bytes);
+	return ok;
+}
+
+// Evaluate a program in both formats, return false if the outputs differ.
+static bool binary_program(const char *const name, const char *const path, const char *const turtle, const char *const decode) {
+	char text_command[BINARY_COMMAND_MAX], binary_command[BINARY_COMMAND_MAX];
+	snprintf(text_command, sizeof(text_command), "'%s' --seed=%d '%s'", turtle, BINARY_SEED, path);
+	snprintf(binary_command, sizeof(binary_command), "'%s' --seed=%d --format=binary '%s' | '%s'", turtle, BINARY_SEED, path, decode);
+	return binary_compare(name, text_command, binary_command);
+}
+
+// Evaluate the samples of the directory, return the number of failures.
+static size_t binary_samples(const char *const dir, const char *const turtle, const char *const decode, size_t *const count) {
+	DIR *const stream = opendir(dir);
+	if (stream == 0) {
+		fprintf(stderr, "The directory '%s' can't be read : %s.\n", dir, strerror(errno));
+		return 1;
+	}
+	size_t failures = 0;
+	for (const struct dirent *entry ; (entry = readdir(stream)) ; ) {
+		const size_t length = strlen(entry->d_name);
+		if (length > 7 && strcmp(entry->d_name + length - 7, ".turtle") == 0) {
+			char path[BINARY_COMMAND_MAX / 4];
+			snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+			failures += !binary_program(path, path, turtle, decode);
+			++*count;
+		}
+	}
+	closedir(stream);
+	return failures;
+}
+
+// Write binary_colors and binary_moves in both formats, return false if the decoded binary output isn't the text output.
+static bool binary_values(const char *const decode) {
+	char paths[2][32];
+	if (!binary_temporary(paths[0], "", 0)) {
+		fprintf(stderr, "(values) : a temporary file can't be created.\n");
+		return false;
+	}
+	if (!binary_temporary(paths[1], "", 0)) {
+		fprintf(stderr, "(values) : a temporary file can't be created.\n");
+		unlink(paths[0]);
+		return false;
+	}
+	bool ok = true;
+	for (size_t i = 0 ; ok && i < 2 ; ++i) {
+		FILE *const file = fopen(paths[i], "wb");
+		if (file == 0) {
+			ok = false;
+			break;
+		}
+		struct output output;
+		output_create(&output, fileno(file), TURTLE_OUTPUT_BUFFER_SIZE);
+		output.format = i ? OUTPUT_BINARY : OUTPUT_TEXT;
+		for (size_t j = 0 ; j < sizeof(binary_moves) / sizeof(*binary_moves) ; ++j) {
+			const double *const color = binary_colors[j % (sizeof(binary_colors) / sizeof(*binary_colors))];
+			output_color(&output, color[0], color[1], color[2]);
+			output_move(&output, j % 3 == 0, binary_moves[j][0], binary_moves[j][1]);
+		}
+		output_destroy(&output);
+		ok = fclose(file) == 0 && output.error_number == 0;
+	}
+	if (!ok)
+		fprintf(stderr, "(values) : the outputs can't be written to temporary files.\n");
+	else {
+		char text_command[BINARY_COMMAND_MAX], binary_command[BINARY_COMMAND_MAX];
+		snprintf(text_command, sizeof(text_command), "cat '%s'", paths[0]);
+		snprintf(binary_command, sizeof(binary_command), "'%s' < '%s'", decode, paths[1]);
+		ok = binary_compare("(values)", text_command, binary_command);
+	}
+	unlink(paths[0]);
+	unlink(paths[1]);
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3)
+		return usage(argv[0]);
+	size_t count = 0, failures = binary_samples(TURTLE_TEST_DIR, argv[1], argv[2], &count);
+	for (size_t i = 0 ; i < sizeof(binary_programs) / sizeof(*binary_programs) ; ++i, ++count) {
+		char path[32];
+		if (!binary_temporary(path, binary_programs[i][1], strlen(binary_programs[i][1]))) {
+			fprintf(stderr, "%s : a temporary file can't be created.\n", binary_programs[i][0]);
+			++failures;
+			continue;
+		}
+		failures += !binary_program(binary_programs[i][0], path, argv[1], argv[2]);
+		unlink(path);
+	}
+	failures += !binary_values(argv[2]);
+	++count;
+	printf("%zu programs decoded, %zu failures.\n", count, failures);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "turtle-prng.h"
+
+// This test checks the generator of the function random (see turtle-prng.h) :
+// - a seed gives the numbers of the reference xoshiro256** seeded by splitmix64, the same seed gives the same numbers,
+// - prng_double stays in its closed interval, a degenerate interval included,
+// - a uniform sample of [0, 1] has the expected mean and passes a chi-square test.
+
+#define PRNG_TEST_SEED		20240601
+#define PRNG_TEST_DRAWS		1000000
+#define PRNG_TEST_BINS		100
+#define PRNG_TEST_MEAN_ERROR	0.002 // about 7 standard deviations of the mean of PRNG_TEST_DRAWS draws
+#define PRNG_TEST_CHI_SQUARE	160.0 // the 99.99% quantile of the chi-square distribution with 99 degrees of freedom
+
+static int failures;
+
+static void check(const bool ok, const char *const what) {
+	if (!ok) {
+		fprintf(stderr, "FAILED : %s.\n", what);
+		++failures;
+	}
+}
+
+// The first numbers of the seeds 0 and 42, computed by the reference algorithms.
+static void check_sequence(void) {
+	static const struct {
+		uint64_t seed;
+		uint64_t numbers[4];
+	} expected[] = {
+		{0, {0x99EC5F36CB75F2B4ULL, 0xBF6E1F784956452AULL, 0x1A5F849D4933E6E0ULL, 0x6AA594F1262D2D2CULL}},
+		{42, {0x15780B2E0C2EC716ULL, 0x6104D9866D113A7EULL, 0xAE17533239E499A1ULL, 0xECB8AD4703B360A1ULL}},
+	};
+	for (size_t i = 0 ; i < sizeof(expected) / sizeof(*expected) ; ++i) {
+		struct prng random;
+		prng_seed(&random, expected[i].seed);
+		bool ok = true;
+		for (int j = 0 ; j < 4 ; ++j)
+			ok = ok && prng_next(&random) == expected[i].numbers[j];
+		check(ok, "a seed gives the sequence of xoshiro256** seeded by splitmix64");
+	}
+}
+
+// Two generators of the same seed give the same numbers, another seed gives other numbers.
+static void check_determinism(void) {
+	struct prng a, b, c;
+	prng_seed(&a, PRNG_TEST_SEED);
+	prng_seed(&b, PRNG_TEST_SEED);
+	prng_seed(&c, PRNG_TEST_SEED + 1);
+	bool same = true, different = false;
+	for (int i = 0 ; i < 1000 ; ++i) {
+		const double x = prng_double(&a, -1, 1);
+		same = same && x == prng_double(&b, -1, 1);
+		different = different || x != prng_double(&c, -1, 1);
+	}
+	check(same, "the same seed gives the same numbers");
+	check(different, "another seed gives other numbers");
+}
+
+static void check_bounds(void) {
+	static const double intervals[][2] = {
+		{0, 1}, {-3, 7}, {2.5, 2.5}, {-0.0, 0.0}, {1, 1 + 2.220446049250313e-16}, {0, 1e-16}, {-1e300, 1e300}, {1e15, 1e15 + 3},
+	};
+	struct prng random;
+	prng_seed(&random, PRNG_TEST_SEED);
+	for (size_t i = 0 ; i < sizeof(intervals) / sizeof(*intervals) ; ++i) {
+		const double lo = intervals[i][0], hi = intervals[i][1];
+		bool inside = true;
+		for (int j = 0 ; j < 100000 ; ++j) {
+			const double x = prng_double(&random, lo, hi);
+			inside = inside && x >= lo && x <= hi;
+		}
+		check(inside, "prng_double stays in [lo, hi]");
+	}
+	check(prng_double(&random, 2.5, 2.5) == 2.5, "a degenerate interval gives its bound");
+}
+
+static void check_distribution(void) {
+	struct prng random;
+	prng_seed(&random, PRNG_TEST_SEED);
+	size_t bins[PRNG_TEST_BINS] = {0};
+	double sum = 0;
+	for (int i = 0 ; i < PRNG_TEST_DRAWS ; ++i) {
+		const double x = prng_double(&random, 0, 1);
+		sum += x;
+		++bins[x < 1 ? (size_t) (x * PRNG_TEST_BINS) : PRNG_TEST_BINS - 1];
+	}
+	const double mean = sum / PRNG_TEST_DRAWS, expected = (double) PRNG_TEST_DRAWS / PRNG_TEST_BINS;
+	double chi_square = 0;
+	for (size_t i = 0 ; i < PRNG_TEST_BINS ; ++i)
+		chi_square += ((double) bins[i] - expected) * ((double) bins[i] - expected) / expected;
+	printf("%d draws in [0, 1] : mean %.5f, chi-square %.1f (%d bins).\n", PRNG_TEST_DRAWS, mean, chi_square, PRNG_TEST_BINS);
+	check(fabs(mean - 0.5) < PRNG_TEST_MEAN_ERROR, "the mean of a uniform sample of [0, 1] is 0.5");
+	check(chi_square < PRNG_TEST_CHI_SQUARE, "a uniform sample of [0, 1] passes the chi-square test");
+}
+
+int main(void) {
+	check_sequence();
+	check_determinism();
+	check_bounds();
+	check_distribution();
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
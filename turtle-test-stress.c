@@ -0,0 +1,319 @@
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "turtle-run.h"
+
+// This test runs the sample programs on many threads at once and compares their outputs with sequential runs :
+// - each sample is parsed, then evaluated by both engines with a fixed seed, one run after another, their outputs
+//   and their statuses are the references,
+// - the programs drawing nothing (an empty source, a comment) are added, they must succeed without any output,
+// - then every thread evaluates every sample with both engines (starting from its own one) for a few rounds,
+//   parsing its own copy of the source or evaluating the AST of the references, shared like the server does.
+// The outputs are written to temporary files. Example : ./turtle-test-stress --threads=32 --rounds=8
+
+#ifndef TURTLE_TEST_DIR
+#define TURTLE_TEST_DIR "." // the directory of the sample programs, given by CMake
+#endif
+
+#define STRESS_SEED				42
+#define STRESS_ROUNDS_DEFAULT	2
+#define STRESS_THREADS_MIN		4 // the default is one thread per processor, at least this number
+
+static const enum engine stress_engines[] = {ENGINE_VM, ENGINE_TREE};
+static const char *const stress_engine_names[] = {"vm", "tree"};
+#define STRESS_ENGINES (sizeof(stress_engines) / sizeof(*stress_engines))
+
+// the programs without any command, their AST has no unit
+static const char *const stress_empty[][2] = {
+	{"(empty program)", ""}, {"(only a comment)", "# only a comment\n"},
+};
+
+struct stress_output {
+	char *bytes;
+	size_t length;
+	int status;
+};
+
+struct stress_sample {
+	char *path;
+	char *source; // followed by two null bytes (see ast_parse)
+	size_t length;
+	struct ast root;
+	int parsed; // the status of the parser
+	bool empty; // one of stress_empty, it must succeed without any output
+	struct stress_output references[STRESS_ENGINES];
+};
+
+struct stress_test {
+	struct stress_sample *samples;
+	size_t sample_count;
+	size_t sample_capacity;
+	size_t rounds;
+};
+
+struct stress_thread {
+	pthread_t thread;
+	const struct stress_test *test;
+	size_t index;
+	size_t runs;
+	size_t failures;
+};
+
+static int usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--threads=N] [--rounds=N]\n", name);
+	return EXIT_FAILURE;
+}
+
+// Read a sample, return false when it can't be read (the message is written).
+static bool stress_read(struct stress_sample *const sample) {
+	FILE *const file = fopen(sample->path, "rb");
+	int error = file ? 0 : errno;
+	size_t capacity = 0;
+	while (error == 0) {
+		if (capacity - sample->length < 65536 + 2) {
+			char *const bytes = realloc(sample->source, capacity += 65536 + 2);
+			if (bytes == 0) {
+				error = ENOMEM;
+				break;
+			}
+			sample->source = bytes;
+		}
+		const size_t count = fread(sample->source + sample->length, 1, capacity - sample->length - 2, file);
+		sample->length += count;
+		if (count == 0 && ferror(file))
+			error = EIO;
+		else if (count == 0)
+			break;
+	}
+	if (file)
+		fclose(file);
+	if (error) {
+		fprintf(stderr, "The program '%s' can't be read : %s.\n", sample->path, strerror(error));
+		return false;
+	}
+	sample->source[sample->length] = sample->source[sample->length + 1] = 0;
+	return true;
+}
+
+// Parse a copy of a sample like turtle does, the copy is scanned in place, the names are copied by the scanner
+// so the copy is released before the evaluation. Return false when the copy can't be allocated.
+static bool stress_parse(const struct stress_sample *const sample, struct ast *const root, int *const parsed) {
+	struct options options;
+	options_create(&options);
+	memset(root, 0, sizeof(struct ast));
+	char *const copy = malloc(sample->length + 2);
+	if (copy == 0)
+		return false;
+	memcpy(copy, sample->source, sample->length + 2);
+	*parsed = run_parse_source(root, &options, copy, sample->length);
+	free(copy);
+	return true;
+}
+
+// Evaluate an AST into a temporary file, then read the file back, return false when the file fails.
+static bool stress_eval(const struct ast *const root, const enum engine engine, struct stress_output *const output) {
+	memset(output, 0, sizeof(struct stress_output));
+	struct options options;
+	options_create(&options);
+	options.engine = engine;
+	options.seed = STRESS_SEED;
+	FILE *const file = tmpfile();
+	if (file == 0)
+		return false;
+	const int fd = fileno(file);
+	output->status = run_eval(root, &options, fd);
+	const off_t size = lseek(fd, 0, SEEK_END);
+	bool ok = size >= 0 && (output->bytes = malloc((size_t) size + 1)) != 0;
+	while (ok && output->length < (size_t) size) {
+		const ssize_t count = pread(fd, output->bytes + output->length, (size_t) size - output->length, (off_t) output->length);
+		if (count < 0 && errno == EINTR)
+			continue;
+		ok = count > 0;
+		if (ok)
+			output->length += (size_t) count;
+	}
+	fclose(file);
+	return ok;
+}
+
+// Evaluate a sample with an engine, parsing its own copy or using the shared AST, then compare it with its reference.
+static bool stress_run(const struct stress_sample *const sample, const size_t engine, const bool shared) {
+	const struct stress_output *const reference = sample->references + engine;
+	struct stress_output output = {0};
+	struct ast root = {0};
+	int parsed = sample->parsed;
+	bool ok = shared || stress_parse(sample, &root, &parsed);
+	if (ok) {
+		if (parsed)
+			output.status = parsed;
+		else
+			ok = stress_eval(shared ? &sample->root : &root, stress_engines[engine], &output);
+	}
+	if (!ok)
+		fprintf(stderr, "%s (%s) : the output can't be kept in memory or in a temporary file.\n", sample->path, stress_engine_names[engine]);
+	else if (output.status != reference->status || output.length != reference->length || (output.length && memcmp(output.bytes, reference->bytes, output.length))) {
+		fprintf(stderr, "%s (%s, %s AST) : the status %d and the %zu bytes of the output are not the status %d and the %zu bytes of the sequential run.\n",
+				sample->path, stress_engine_names[engine], shared ? "shared" : "own", output.status, output.length, reference->status, reference->length);
+		ok = false;
+	}
+	if (!shared)
+		ast_destroy(&root);
+	free(output.bytes);
+	return ok;
+}
+
+static void *stress_thread(void *const argument) {
+	struct stress_thread *const self = argument;
+	const struct stress_test *const test = self->test;
+	const size_t jobs = test->sample_count * STRESS_ENGINES;
+	for (size_t round = 0 ; round < test->rounds ; ++round)
+		for (size_t i = 0 ; i < jobs ; ++i) {
+			const size_t job = (self->index + i) % jobs;
+			if (!stress_run(test->samples + job / STRESS_ENGINES, job % STRESS_ENGINES, (self->index + round) % 2))
+				++self->failures;
+			++self->runs;
+		}
+	return 0;
+}
+
+static int stress_compare_path(const void *const a, const void *const b) {
+	return strcmp(((const struct stress_sample *) a)->path, ((const struct stress_sample *) b)->path);
+}
+
+// Add a sample named by a path (or by a name when the directory is null), return null on memory allocation error.
+static struct stress_sample *stress_add(struct stress_test *const test, const char *const dir, const char *const name) {
+	if (test->sample_count == test->sample_capacity) {
+		const size_t capacity = test->sample_capacity ? 2 * test->sample_capacity : 16;
+		struct stress_sample *const samples = realloc(test->samples, capacity * sizeof(struct stress_sample));
+		if (samples == 0)
+			return 0;
+		test->samples = samples;
+		test->sample_capacity = capacity;
+	}
+	struct stress_sample *const sample = test->samples + test->sample_count;
+	memset(sample, 0, sizeof(struct stress_sample));
+	if ((sample->path = malloc((dir ? strlen(dir) + 1 : 0) + strlen(name) + 1)) == 0)
+		return 0;
+	if (dir)
+		sprintf(sample->path, "%s/%s", dir, name);
+	else
+		strcpy(sample->path, name);
+	++test->sample_count;
+	return sample;
+}
+
+// Find the samples of the directory, return false when it can't be read (the message is written).
+static bool stress_find(struct stress_test *const test, const char *const dir) {
+	DIR *const stream = opendir(dir);
+	if (stream == 0) {
+		fprintf(stderr, "The directory '%s' can't be read : %s.\n", dir, strerror(errno));
+		return false;
+	}
+	bool ok = true;
+	for (const struct dirent *entry ; ok && (entry = readdir(stream)) ; ) {
+		const size_t length = strlen(entry->d_name);
+		if (length > 7 && strcmp(entry->d_name + length - 7, ".turtle") == 0 && stress_add(test, dir, entry->d_name) == 0) {
+			fprintf(stderr, "Memory Allocation Error.\n");
+			ok = false;
+		}
+	}
+	closedir(stream);
+	if (test->sample_count)
+		qsort(test->samples, test->sample_count, sizeof(struct stress_sample), stress_compare_path);
+	return ok;
+}
+
+// Add the programs of stress_empty after the samples, their sources are copied.
+static bool stress_add_empty(struct stress_test *const test) {
+	for (size_t i = 0 ; i < sizeof(stress_empty) / sizeof(*stress_empty) ; ++i) {
+		struct stress_sample *const sample = stress_add(test, 0, stress_empty[i][0]);
+		const size_t length = strlen(stress_empty[i][1]);
+		if (sample == 0 || (sample->source = malloc(length + 2)) == 0) {
+			fprintf(stderr, "Memory Allocation Error.\n");
+			return false;
+		}
+		memcpy(sample->source, stress_empty[i][1], length + 1);
+		sample->source[length + 1] = 0;
+		sample->length = length;
+		sample->empty = true;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t thread_count = processors > STRESS_THREADS_MIN ? (size_t) processors : STRESS_THREADS_MIN;
+	struct stress_test test = {.rounds = STRESS_ROUNDS_DEFAULT};
+	char *end;
+	for (int i = 1 ; i < argc ; ++i) {
+		if (strncmp(argv[i], "--threads=", 10) == 0) {
+			thread_count = strtoull(argv[i] + 10, &end, 10);
+			if (*end || end == argv[i] + 10 || thread_count == 0)
+				return usage(argv[0]);
+		} else if (strncmp(argv[i], "--rounds=", 9) == 0) {
+			test.rounds = strtoull(argv[i] + 9, &end, 10);
+			if (*end || end == argv[i] + 9 || test.rounds == 0)
+				return usage(argv[0]);
+		} else
+			return usage(argv[0]);
+	}
+	bool ok = stress_find(&test, TURTLE_TEST_DIR);
+	if (ok && test.sample_count == 0) {
+		fprintf(stderr, "No sample program in '%s'.\n", TURTLE_TEST_DIR);
+		ok = false;
+	}
+	ok = ok && stress_add_empty(&test);
+	// the references, one run after another
+	for (size_t i = 0 ; ok && i < test.sample_count ; ++i) {
+		struct stress_sample *const sample = test.samples + i;
+		ok = sample->source || stress_read(sample);
+		if (ok && !stress_parse(sample, &sample->root, &sample->parsed)) {
+			fprintf(stderr, "Memory Allocation Error.\n");
+			ok = false;
+		}
+		if (ok && sample->parsed)
+			for (size_t engine = 0 ; engine < STRESS_ENGINES ; ++engine)
+				sample->references[engine].status = sample->parsed;
+		for (size_t engine = 0 ; ok && sample->parsed == 0 && engine < STRESS_ENGINES ; ++engine)
+			if (!(ok = stress_eval(&sample->root, stress_engines[engine], sample->references + engine)))
+				fprintf(stderr, "%s (%s) : the output can't be kept in memory or in a temporary file.\n", sample->path, stress_engine_names[engine]);
+		for (size_t engine = 0 ; ok && sample->empty && engine < STRESS_ENGINES ; ++engine)
+			if (sample->references[engine].status || sample->references[engine].length) {
+				fprintf(stderr, "%s (%s) : the status %d and the %zu bytes of the output are not a success without output.\n", sample->path, stress_engine_names[engine], sample->references[engine].status, sample->references[engine].length);
+				ok = false;
+			}
+	}
+	// then all of them at once
+	struct stress_thread *const threads = ok ? calloc(thread_count, sizeof(struct stress_thread)) : 0;
+	size_t started = 0, runs = 0, failures = 0;
+	ok = threads != 0;
+	for (; ok && started < thread_count ; ++started) {
+		threads[started].test = &test;
+		threads[started].index = started;
+		if (pthread_create(&threads[started].thread, 0, stress_thread, threads + started)) {
+			perror("pthread_create");
+			ok = false;
+			break;
+		}
+	}
+	for (size_t i = 0 ; i < started ; ++i) {
+		pthread_join(threads[i].thread, 0);
+		runs += threads[i].runs;
+		failures += threads[i].failures;
+	}
+	if (ok)
+		printf("%zu samples, %zu threads, %zu rounds : %zu runs, %zu different from the sequential runs.\n", test.sample_count, thread_count, test.rounds, runs, failures);
+	free(threads);
+	for (size_t i = 0 ; i < test.sample_count ; ++i) {
+		struct stress_sample *const sample = test.samples + i;
+		ast_destroy(&sample->root);
+		for (size_t engine = 0 ; engine < STRESS_ENGINES ; ++engine)
+			free(sample->references[engine].bytes);
+		free(sample->source);
+		free(sample->path);
+	}
+	free(test.samples);
+	return ok && failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,859 @@
+#include <sys/mman.h>
+
+#include "turtle-vm.h"
+#include "turtle-memo.h"
+
+/*
+ * compiler
+ * The AST is compiled in one pass, the procedure bodies are appended after the main program.
+ */
+
+struct vm_compiler {
+	struct vm_program *program;
+	struct ast_node **procs; // the pending procedure declarations
+	size_t *patches; // where to write the address of each pending procedure body
+	size_t proc_count;
+	size_t proc_capacity;
+	size_t depth; // the current expression stack depth
+	struct profile *profile; // the sites of a profiled program, null otherwise
+	int error_number;
+};
+
+// Append a word to the code, the program grows by doubling its capacity.
+static void emit(struct vm_compiler *const compiler, const int32_t word) {
+	struct vm_program *const program = compiler->program;
+	if (program->code_count == program->code_capacity) {
+		const size_t capacity = program->code_capacity ? 2 * program->code_capacity : 256;
+		int32_t *const code = realloc(program->code, capacity * sizeof(int32_t));
+		if (code == 0) {
+			compiler->error_number = 1;
+			return;
+		}
+		program->code = code;
+		program->code_capacity = capacity;
+	}
+	program->code[program->code_count++] = word;
+}
+
+// Track the expression stack depth, so the evaluator can allocate its stack once.
+static void emit_push(struct vm_compiler *const compiler, const int32_t opcode, const int32_t operand) {
+	emit(compiler, opcode);
+	emit(compiler, operand);
+	if (++compiler->depth > compiler->program->stack_size)
+		compiler->program->stack_size = compiler->depth;
+}
+
+// An opcode consuming "pop" values and pushing "push" values.
+static void emit_op(struct vm_compiler *const compiler, const int32_t opcode, const size_t pop, const size_t push) {
+	emit(compiler, opcode);
+	compiler->depth = compiler->depth - pop + push;
+}
+
+static void emit_value(struct vm_compiler *const compiler, const double value) {
+	struct vm_program *const program = compiler->program;
+	if (program->value_count == program->value_capacity) {
+		const size_t capacity = program->value_capacity ? 2 * program->value_capacity : 64;
+		double *const values = realloc(program->values, capacity * sizeof(double));
+		if (values == 0) {
+			compiler->error_number = 1;
+			return;
+		}
+		program->values = values;
+		program->value_capacity = capacity;
+	}
+	program->values[program->value_count] = value;
+	emit_push(compiler, OP_VALUE, (int32_t) program->value_count++);
+}
+
+// Append the motion template of a geometry only loop, OP_MOTION will replay it.
+static void emit_motion(struct vm_compiler *const compiler, const struct motion_step *const steps, const size_t count) {
+	struct vm_program *const program = compiler->program;
+	if (program->step_count + count > program->step_capacity) {
+		size_t capacity = program->step_capacity ? 2 * program->step_capacity : 64;
+		while (capacity < program->step_count + count)
+			capacity *= 2;
+		struct motion_step *const copy = realloc(program->steps, capacity * sizeof(struct motion_step));
+		if (copy == 0) {
+			compiler->error_number = 1;
+			return;
+		}
+		program->steps = copy;
+		program->step_capacity = capacity;
+	}
+	memcpy(program->steps + program->step_count, steps, count * sizeof(struct motion_step));
+	emit(compiler, OP_MOTION);
+	emit(compiler, (int32_t) program->step_count);
+	emit(compiler, (int32_t) count);
+	program->step_count += count;
+}
+
+// Add a command to the profile, the opcode reports its site.
+static size_t emit_site(struct vm_compiler *const compiler, const int32_t opcode, const struct ast_node *const node) {
+	const size_t site = profile_site(compiler->profile, node);
+	if (site == PROFILE_NO_SITE || site > INT32_MAX) {
+		compiler->error_number = 1;
+		return 0;
+	}
+	emit(compiler, opcode);
+	emit(compiler, (int32_t) site);
+	return site;
+}
+
+// Remember a procedure body to compile after the current code, its address will be patched.
+static void defer_proc(struct vm_compiler *const compiler, struct ast_node *const node, const size_t patch) {
+	if (compiler->proc_count == compiler->proc_capacity) {
+		const size_t capacity = compiler->proc_capacity ? 2 * compiler->proc_capacity : 16;
+		struct ast_node **const procs = realloc(compiler->procs, capacity * sizeof(struct ast_node *));
+		if (procs)
+			compiler->procs = procs;
+		size_t *const patches = realloc(compiler->patches, capacity * sizeof(size_t));
+		if (patches)
+			compiler->patches = patches;
+		if (procs == 0 || patches == 0) {
+			compiler->error_number = 1;
+			return;
+		}
+		compiler->proc_capacity = capacity;
+	}
+	compiler->procs[compiler->proc_count] = node;
+	compiler->patches[compiler->proc_count++] = patch;
+}
+
+// Tell if an expression reads a given variable.
+static bool reads_slot(const struct ast_node *const node, const size_t slot) {
+	if (node == 0)
+		return false;
+	if (node->kind == KIND_EXPR_NAME)
+		return node->slot == slot;
+	for (size_t i = 0 ; i < node->children_count ; ++i)
+		if (reads_slot(node->children[i], slot))
+			return true;
+	return false;
+}
+
+static void compile_expr(struct vm_compiler *const compiler, const struct ast_node *const node) {
+	if (node == 0 || compiler->error_number)
+		return;
+	switch (node->kind) {
+		case KIND_EXPR_VALUE : emit_value(compiler, node->u.value); break;
+		case KIND_EXPR_NAME :
+			compiler->program->variable_names[node->slot] = node->u.bst_entry->key;
+			emit_push(compiler, OP_LOAD, (int32_t) node->slot);
+			break;
+		case KIND_EXPR_BINOP :
+			compile_expr(compiler, node->children[0]);
+			compile_expr(compiler, node->children[1]);
+			switch (node->u.op) {
+				case '+' : emit_op(compiler, OP_ADD, 2, 1); break;
+				case '-' : emit_op(compiler, OP_SUB, 2, 1); break;
+				case '*' : emit_op(compiler, OP_MUL, 2, 1); break;
+				case '/' : emit_op(compiler, OP_DIV, 2, 1); break;
+				case '^' :
+				default : emit_op(compiler, OP_POW, 2, 1); break;
+			}
+			break;
+		case KIND_EXPR_LOCAL : emit_push(compiler, OP_LOCAL, (int32_t) node->slot); break;
+		case KIND_EXPR_TEST : {
+			compile_expr(compiler, node->children[0]);
+			if (node->u.test == TEST_NOT) {
+				emit_op(compiler, OP_NOT, 1, 1);
+				break;
+			}
+			if (node->u.test == TEST_AND || node->u.test == TEST_OR) {
+				// the right operand is skipped when the left one gives the result.
+				emit_op(compiler, node->u.test == TEST_AND ? OP_AND : OP_OR, 1, 0);
+				const size_t patch = compiler->program->code_count;
+				emit(compiler, 0);
+				compile_expr(compiler, node->children[1]);
+				emit_op(compiler, OP_TRUTH, 1, 1);
+				if (compiler->error_number == 0)
+					compiler->program->code[patch] = (int32_t) compiler->program->code_count;
+				break;
+			}
+			compile_expr(compiler, node->children[1]);
+			switch (node->u.test) {
+				case TEST_LT : emit_op(compiler, OP_LT, 2, 1); break;
+				case TEST_LE : emit_op(compiler, OP_LE, 2, 1); break;
+				case TEST_EQ : emit_op(compiler, OP_EQ, 2, 1); break;
+				case TEST_NE : emit_op(compiler, OP_NE, 2, 1); break;
+				case TEST_GT : emit_op(compiler, OP_GT, 2, 1); break;
+				case TEST_GE :
+				default : emit_op(compiler, OP_GE, 2, 1); break;
+			}
+			break;
+		}
+		case KIND_EXPR_BLOCK : compile_expr(compiler, node->children[0]); break;
+		case KIND_EXPR_HOISTED : {
+			emit(compiler, OP_HOISTED);
+			emit(compiler, (int32_t) node->slot);
+			const size_t patch = compiler->program->code_count;
+			emit(compiler, 0);
+			compile_expr(compiler, node->children[0]);
+			emit(compiler, OP_SAVE);
+			emit(compiler, (int32_t) node->slot);
+			if (compiler->error_number == 0)
+				compiler->program->code[patch] = (int32_t) compiler->program->code_count;
+			break;
+		}
+		case KIND_EXPR_UNOP :
+			compile_expr(compiler, node->children[0]);
+			if (node->u.op == '-')
+				emit_op(compiler, OP_NEG, 1, 1);
+			break;
+		case KIND_EXPR_FUNC :
+			compile_expr(compiler, node->children[0]);
+			switch (node->u.func) {
+				case FUNC_RANDOM :
+					compile_expr(compiler, node->children[1]);
+					emit_op(compiler, OP_RANDOM, 2, 1);
+					break;
+				case FUNC_COS : emit_op(compiler, OP_COS, 1, 1); break;
+				case FUNC_SIN : emit_op(compiler, OP_SIN, 1, 1); break;
+				case FUNC_TAN : emit_op(compiler, OP_TAN, 1, 1); break;
+				case FUNC_SQUARE : emit_op(compiler, OP_SQUARE, 1, 1); break;
+				case FUNC_SQRT :
+				default : emit_op(compiler, OP_SQRT, 1, 1); break;
+			}
+			break;
+		default :
+			compiler->error_number = 2;
+			fprintf(stderr, "Unknown node to compile.");
+	}
+}
+
+// A profiled program marks its commands, its loops and its calls are entered and left (a block is not a site).
+// A while loop tests its condition before its body, then again after each iteration (the condition is compiled twice).
+static void compile_node(struct vm_compiler *const compiler, const struct ast_node *node) {
+	for (; node && compiler->error_number == 0 ; node = node->next) {
+		size_t site = 0;
+		if (compiler->profile && node->kind != KIND_CMD_BLOCK)
+			site = emit_site(compiler, node->kind == KIND_CMD_REPEAT || node->kind == KIND_CMD_WHILE || node->kind == KIND_CMD_CALL ? OP_ENTER : OP_MARK, node);
+		switch (node->kind) {
+			case KIND_CMD_SIMPLE :
+				for (size_t i = 0 ; i < node->children_count ; ++i)
+					compile_expr(compiler, node->children[i]);
+				switch (node->u.cmd) {
+					case CMD_FORWARD : emit_op(compiler, OP_FORWARD, 1, 0); break;
+					case CMD_BACKWARD : emit_op(compiler, OP_BACKWARD, 1, 0); break;
+					case CMD_UP : emit_op(compiler, OP_UP, 0, 0); break;
+					case CMD_DOWN : emit_op(compiler, OP_DOWN, 0, 0); break;
+					case CMD_COLOR : emit_op(compiler, OP_COLOR, 3, 0); break;
+					case CMD_LEFT : emit_op(compiler, OP_LEFT, 1, 0); break;
+					case CMD_RIGHT : emit_op(compiler, OP_RIGHT, 1, 0); break;
+					case CMD_HEADING : emit_op(compiler, OP_HEADING, 1, 0); break;
+					case CMD_POSITION : emit_op(compiler, OP_POSITION, 2, 0); break;
+					case CMD_HOME : emit_op(compiler, OP_HOME, 0, 0); break;
+					case CMD_PRINT : emit_op(compiler, OP_PRINT, 1, 0); break;
+				}
+				break;
+			case KIND_CMD_REPEAT : {
+				compile_expr(compiler, node->children[0]);
+				if (node->u.hoisted.count) {
+					emit(compiler, OP_FORGET);
+					emit(compiler, (int32_t) node->u.hoisted.first);
+					emit(compiler, (int32_t) node->u.hoisted.count);
+				}
+				struct motion_step steps[MOTION_STEPS_MAX];
+				const size_t step_count = compiler->profile ? 0 : motion_flatten(node->children[1], steps);
+				size_t motion = 0;
+				if (step_count) {
+					emit_motion(compiler, steps, step_count);
+					motion = compiler->program->code_count;
+					emit(compiler, 0);
+				}
+				emit_op(compiler, OP_REPEAT, 1, 0);
+				const size_t patch = compiler->program->code_count;
+				emit(compiler, 0);
+				const size_t body = compiler->program->code_count;
+				compile_node(compiler, node->children[1]);
+				emit(compiler, OP_LOOP);
+				emit(compiler, (int32_t) body);
+				if (compiler->error_number == 0) {
+					compiler->program->code[patch] = (int32_t) compiler->program->code_count;
+					if (motion)
+						compiler->program->code[motion] = (int32_t) compiler->program->code_count;
+				}
+				if (compiler->profile) {
+					emit(compiler, OP_LEAVE);
+					emit(compiler, (int32_t) site);
+				}
+				break;
+			}
+			case KIND_CMD_IF : {
+				compile_expr(compiler, node->children[0]);
+				emit_op(compiler, OP_BRANCH, 1, 0);
+				size_t patch = compiler->program->code_count;
+				emit(compiler, 0);
+				compile_node(compiler, node->children[1]);
+				if (node->children[2]) {
+					emit(compiler, OP_JUMP);
+					const size_t jump = compiler->program->code_count;
+					emit(compiler, 0);
+					if (compiler->error_number == 0)
+						compiler->program->code[patch] = (int32_t) compiler->program->code_count;
+					compile_node(compiler, node->children[2]);
+					patch = jump;
+				}
+				if (compiler->error_number == 0)
+					compiler->program->code[patch] = (int32_t) compiler->program->code_count;
+				break;
+			}
+			case KIND_CMD_WHILE : {
+				compile_expr(compiler, node->children[0]);
+				emit_op(compiler, OP_WHILE, 1, 0);
+				const size_t patch = compiler->program->code_count;
+				emit(compiler, 0);
+				const size_t body = compiler->program->code_count;
+				compile_node(compiler, node->children[1]);
+				compile_expr(compiler, node->children[0]);
+				emit_op(compiler, OP_AGAIN, 1, 0);
+				emit(compiler, (int32_t) body);
+				if (compiler->error_number == 0)
+					compiler->program->code[patch] = (int32_t) compiler->program->code_count;
+				if (compiler->profile) {
+					emit(compiler, OP_LEAVE);
+					emit(compiler, (int32_t) site);
+				}
+				break;
+			}
+			case KIND_CMD_BLOCK : compile_node(compiler, node->children[0]); break;
+			case KIND_CMD_CALL :
+				compiler->program->proc_names[node->u.bst_entry->value.parsing.proc_slot] = node->u.bst_entry->key;
+				for (const struct ast_node *arg = node->children[0] ; arg ; arg = arg->next)
+					compile_expr(compiler, arg->children[0]);
+				emit_op(compiler, OP_CALL, node->arity, 0);
+				emit(compiler, (int32_t) node->u.bst_entry->value.parsing.proc_slot);
+				emit(compiler, (int32_t) node->arity);
+				if (compiler->profile) {
+					emit(compiler, OP_LEAVE);
+					emit(compiler, (int32_t) site);
+				}
+				break;
+			case KIND_CMD_SET : {
+				const size_t slot = node->slot;
+				compiler->program->variable_names[slot] = node->u.bst_entry->key;
+				// like the tree walker, a variable is defined before its value is computed.
+				if (reads_slot(node->children[0], slot)) {
+					emit(compiler, OP_DEFINE);
+					emit(compiler, (int32_t) slot);
+				}
+				compile_expr(compiler, node->children[0]);
+				emit_op(compiler, OP_STORE, 1, 0);
+				emit(compiler, (int32_t) slot);
+				break;
+			}
+			case KIND_CMD_SET_LOCAL :
+				compile_expr(compiler, node->children[0]);
+				emit_op(compiler, OP_STORE_LOCAL, 1, 0);
+				emit(compiler, (int32_t) node->slot);
+				break;
+			case KIND_CMD_PROC :
+				compiler->program->proc_names[node->u.bst_entry->value.parsing.proc_slot] = node->u.bst_entry->key;
+				emit(compiler, OP_PROC);
+				emit(compiler, (int32_t) node->u.bst_entry->value.parsing.proc_slot);
+				emit(compiler, (int32_t) node->arity);
+				defer_proc(compiler, node->children[0], compiler->program->code_count);
+				emit(compiler, 0);
+				break;
+			default:
+				compiler->error_number = 2;
+				fprintf(stderr, "Unknown node to compile.");
+		}
+	}
+}
+
+// The main program ends with OP_HALT, then each procedure body ends with OP_RETURN.
+// Procedure declarations found in procedure bodies are compiled too, they fail at runtime (nested procedure).
+int vm_compile(struct vm_program *const self, const struct ast *const ast, struct profile *const profile) {
+	memset(self, 0, sizeof(struct vm_program));
+	struct vm_compiler compiler = {.program = self, .profile = profile};
+	self->variable_count = ast->slot_count;
+	self->proc_count = ast->proc_count;
+	self->variable_names = calloc(ast->slot_count + 1, sizeof(const char *));
+	self->proc_names = calloc(ast->proc_count + 1, sizeof(const char *));
+	if (self->variable_names == 0 || self->proc_names == 0)
+		compiler.error_number = 1;
+	compile_node(&compiler, ast->unit);
+	emit(&compiler, OP_HALT);
+	for (size_t i = 0 ; i < compiler.proc_count && compiler.error_number == 0 ; ++i) {
+		self->code[compiler.patches[i]] = (int32_t) self->code_count;
+		compile_node(&compiler, compiler.procs[i]);
+		emit(&compiler, OP_RETURN);
+	}
+	free(compiler.procs);
+	free(compiler.patches);
+	return compiler.error_number;
+}
+
+void vm_destroy(struct vm_program *const self) {
+	if (self->mapping)
+		munmap(self->mapping, self->mapping_size);
+	else {
+		free(self->code);
+		free(self->values);
+		free(self->steps);
+	}
+	free(self->variable_names);
+	free(self->proc_names);
+	memset(self, 0, sizeof(struct vm_program));
+}
+
+/*
+ * evaluator
+ * The dispatch uses computed goto when the compiler supports it, otherwise a switch in a loop.
+ * The execution stops at the first error, the messages and error numbers are the ones of the tree walker.
+ */
+
+// a frame is a loop counter or a return address with the locals of the caller
+union vm_frame {
+	long long int count;
+	struct {
+		const int32_t *ret;
+		size_t base; // see context_enter_locals
+	} call;
+};
+
+// a declared procedure
+struct vm_proc {
+	const int32_t *body;
+	size_t params;
+};
+
+struct vm_frames {
+	union vm_frame *base;
+	size_t count;
+	size_t capacity;
+};
+
+// Return a new frame on top of the stack, it grows by doubling its capacity.
+// Every frame is a repeat or a call, they are limited by the maximum depth of the context.
+static union vm_frame *push_frame(struct vm_frames *const frames, struct context *const ctx) {
+	if (frames->count >= ctx->max_depth) {
+		context_max_depth_failure(ctx);
+		return 0;
+	}
+	if (frames->count == frames->capacity) {
+		const size_t capacity = frames->capacity ? 2 * frames->capacity : 64;
+		union vm_frame *const base = realloc(frames->base, capacity * sizeof(union vm_frame));
+		if (base == 0) {
+			ctx->error_number = 1;
+			return 0;
+		}
+		frames->base = base;
+		frames->capacity = capacity;
+		++ctx->stats.allocations;
+	}
+	if (frames->count >= ctx->deepest)
+		ctx->deepest = frames->count + 1;
+	return frames->base + frames->count++;
+}
+
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO
+#endif
+
+#ifdef VM_COMPUTED_GOTO
+#define VM_CASE(opcode)	label_##opcode
+#define VM_NEXT()		goto *labels[*pc++]
+#else
+#define VM_CASE(opcode)	case opcode
+#define VM_NEXT()		continue
+#endif
+
+void vm_eval(const struct vm_program *const self, struct context *const ctx) {
+	if (self == 0 || ctx->error_number)
+		return;
+	context_create_variables(ctx, self->variable_count);
+	struct vm_proc *const procs = calloc(self->proc_count + 1, sizeof(struct vm_proc));
+	double *const stack = malloc((self->stack_size + 1) * sizeof(double));
+	struct vm_frames frames = {0};
+	ctx->stats.allocations += 2;
+	if (procs == 0 || stack == 0)
+		ctx->error_number = 1;
+	if (ctx->error_number) {
+		free(procs);
+		free(stack);
+		return;
+	}
+	const int32_t *const code = self->code;
+	const int32_t *pc = code;
+	double *sp = stack; // points to the next free cell
+	double *const variables = ctx->variables;
+	bool *const defined = ctx->defined;
+	double *locals = ctx->locals; // the frame of the current call, it moves when the locals grow
+	union vm_frame *frame;
+	double lhs, rhs, res;
+	long long int count; // the iterations of a repeat, checked before its frame like the tree walker does
+	unsigned long long int commands = 0, expressions = 0; // added to the counters of the context when halting
+#ifdef VM_COMPUTED_GOTO
+	static void *const labels[OP_COUNT] = {
+		[OP_HALT] = &&label_OP_HALT, [OP_VALUE] = &&label_OP_VALUE, [OP_LOAD] = &&label_OP_LOAD,
+		[OP_DEFINE] = &&label_OP_DEFINE, [OP_STORE] = &&label_OP_STORE,
+		[OP_HOISTED] = &&label_OP_HOISTED, [OP_SAVE] = &&label_OP_SAVE, [OP_FORGET] = &&label_OP_FORGET,
+		[OP_ADD] = &&label_OP_ADD, [OP_SUB] = &&label_OP_SUB, [OP_MUL] = &&label_OP_MUL,
+		[OP_DIV] = &&label_OP_DIV, [OP_POW] = &&label_OP_POW, [OP_NEG] = &&label_OP_NEG,
+		[OP_COS] = &&label_OP_COS, [OP_SIN] = &&label_OP_SIN, [OP_TAN] = &&label_OP_TAN,
+		[OP_SQRT] = &&label_OP_SQRT, [OP_SQUARE] = &&label_OP_SQUARE, [OP_RANDOM] = &&label_OP_RANDOM,
+		[OP_FORWARD] = &&label_OP_FORWARD, [OP_BACKWARD] = &&label_OP_BACKWARD, [OP_UP] = &&label_OP_UP,
+		[OP_DOWN] = &&label_OP_DOWN, [OP_COLOR] = &&label_OP_COLOR, [OP_LEFT] = &&label_OP_LEFT,
+		[OP_RIGHT] = &&label_OP_RIGHT, [OP_HEADING] = &&label_OP_HEADING, [OP_POSITION] = &&label_OP_POSITION,
+		[OP_HOME] = &&label_OP_HOME, [OP_PRINT] = &&label_OP_PRINT,
+		[OP_MOTION] = &&label_OP_MOTION, [OP_REPEAT] = &&label_OP_REPEAT, [OP_LOOP] = &&label_OP_LOOP, [OP_CALL] = &&label_OP_CALL,
+		[OP_RETURN] = &&label_OP_RETURN, [OP_PROC] = &&label_OP_PROC,
+		[OP_MARK] = &&label_OP_MARK, [OP_ENTER] = &&label_OP_ENTER, [OP_LEAVE] = &&label_OP_LEAVE,
+		[OP_LOCAL] = &&label_OP_LOCAL, [OP_STORE_LOCAL] = &&label_OP_STORE_LOCAL,
+		[OP_LT] = &&label_OP_LT, [OP_LE] = &&label_OP_LE, [OP_EQ] = &&label_OP_EQ, [OP_NE] = &&label_OP_NE,
+		[OP_GT] = &&label_OP_GT, [OP_GE] = &&label_OP_GE, [OP_NOT] = &&label_OP_NOT,
+		[OP_AND] = &&label_OP_AND, [OP_OR] = &&label_OP_OR, [OP_TRUTH] = &&label_OP_TRUTH,
+		[OP_JUMP] = &&label_OP_JUMP, [OP_BRANCH] = &&label_OP_BRANCH, [OP_WHILE] = &&label_OP_WHILE, [OP_AGAIN] = &&label_OP_AGAIN,
+	};
+	VM_NEXT();
+#else
+	for (;;) switch (*pc++) {
+#endif
+	VM_CASE(OP_VALUE):
+		++expressions;
+		*sp++ = self->values[*pc++];
+		VM_NEXT();
+	VM_CASE(OP_LOAD):
+		++expressions;
+		if (!defined[*pc]) {
+			ctx->error_number = 3;
+			fprintf(stderr, "Unknown variable '%s'.", self->variable_names[*pc]);
+			goto halt;
+		}
+		*sp++ = variables[*pc++];
+		VM_NEXT();
+	VM_CASE(OP_DEFINE):
+		defined[*pc++] = true;
+		VM_NEXT();
+	VM_CASE(OP_STORE):
+		++commands;
+		defined[*pc] = true;
+		variables[*pc++] = *--sp;
+		VM_NEXT();
+	VM_CASE(OP_HOISTED):
+		++expressions;
+		if (defined[*pc]) {
+			*sp++ = variables[*pc];
+			pc = code + pc[1];
+		} else
+			pc += 2;
+		VM_NEXT();
+	VM_CASE(OP_SAVE):
+		defined[*pc] = true;
+		variables[*pc++] = sp[-1];
+		VM_NEXT();
+	VM_CASE(OP_FORGET):
+		memset(defined + pc[0], 0, (size_t) pc[1] * sizeof(bool));
+		pc += 2;
+		VM_NEXT();
+#define VM_BINOP(opcode, op, expression) \
+	VM_CASE(opcode): \
+		++expressions; \
+		rhs = *--sp; \
+		lhs = sp[-1]; \
+		res = expression; \
+		if (!isfinite(res)) { \
+			context_binop_failure(ctx, op, lhs, rhs, res); \
+			goto halt; \
+		} \
+		sp[-1] = res; \
+		VM_NEXT();
+	VM_BINOP(OP_ADD, '+', lhs + rhs)
+	VM_BINOP(OP_SUB, '-', lhs - rhs)
+	VM_BINOP(OP_MUL, '*', lhs * rhs)
+	VM_BINOP(OP_DIV, '/', lhs / rhs)
+	VM_BINOP(OP_POW, '^', pow(lhs, rhs))
+#undef VM_BINOP
+	VM_CASE(OP_NEG):
+		++expressions;
+		if (sp[-1])
+			sp[-1] = -sp[-1];
+		VM_NEXT();
+	VM_CASE(OP_COS):
+		++expressions;
+		sp[-1] = cos(sp[-1] * TURTLE_DEG_TO_RAD);
+		VM_NEXT();
+	VM_CASE(OP_SIN):
+		++expressions;
+		sp[-1] = sin(sp[-1] * TURTLE_DEG_TO_RAD);
+		VM_NEXT();
+	VM_CASE(OP_TAN):
+		++expressions;
+		sp[-1] = tan(sp[-1] * TURTLE_DEG_TO_RAD);
+		VM_NEXT();
+	VM_CASE(OP_SQRT):
+		++expressions;
+		sp[-1] = context_sqrt(ctx, sp[-1]);
+		if (ctx->error_number)
+			goto halt;
+		VM_NEXT();
+	VM_CASE(OP_SQUARE):
+		++expressions;
+		lhs = sp[-1];
+		if (!isfinite(sp[-1] = lhs * lhs)) {
+			context_binop_failure(ctx, '^', lhs, 2.0, sp[-1]);
+			goto halt;
+		}
+		VM_NEXT();
+	VM_CASE(OP_RANDOM):
+		++expressions;
+		--sp;
+		sp[-1] = context_random(ctx, sp[-1], sp[0]);
+		if (ctx->error_number)
+			goto halt;
+		VM_NEXT();
+	VM_CASE(OP_FORWARD):
+		++commands;
+		context_forward(ctx, *--sp);
+		if (ctx->error_number)
+			goto halt;
+		VM_NEXT();
+	VM_CASE(OP_BACKWARD):
+		++commands;
+		context_backward(ctx, *--sp);
+		if (ctx->error_number)
+			goto halt;
+		VM_NEXT();
+	VM_CASE(OP_UP):
+		++commands;
+		ctx->up = true;
+		VM_NEXT();
+	VM_CASE(OP_DOWN):
+		++commands;
+		ctx->up = false;
+		VM_NEXT();
+	VM_CASE(OP_COLOR):
+		++commands;
+		sp -= 3;
+		context_color(ctx, sp[0], sp[1], sp[2]);
+		if (ctx->error_number)
+			goto halt;
+		VM_NEXT();
+	VM_CASE(OP_LEFT):
+		++commands;
+		context_left(ctx, *--sp);
+		VM_NEXT();
+	VM_CASE(OP_RIGHT):
+		++commands;
+		context_right(ctx, *--sp);
+		VM_NEXT();
+	VM_CASE(OP_HEADING):
+		++commands;
+		context_heading(ctx, *--sp);
+		VM_NEXT();
+	VM_CASE(OP_POSITION):
+		++commands;
+		sp -= 2;
+		context_position(ctx, sp[0], sp[1]);
+		if (ctx->error_number)
+			goto halt;
+		VM_NEXT();
+	VM_CASE(OP_HOME):
+		++commands;
+		context_home(ctx);
+		if (ctx->error_number)
+			goto halt;
+		VM_NEXT();
+	VM_CASE(OP_PRINT):
+		++commands;
+		context_print(ctx, *--sp);
+		VM_NEXT();
+	VM_CASE(OP_MOTION):
+		if (!ctx->replay || !(sp[-1] >= 2)) {
+			pc += 3;
+			VM_NEXT();
+		}
+		++commands;
+		res = *--sp;
+		if ((count = context_repeat_count(ctx, res)) == 0 || (frame = push_frame(&frames, ctx)) == 0)
+			goto halt;
+		frame->count = count;
+		if (frames.count - ctx->nested_call_count > ctx->stats.deepest_repeats)
+			ctx->stats.deepest_repeats = frames.count - ctx->nested_call_count;
+		// the frame only checked the depth, the iterations are replayed at once.
+		motion_replay(ctx, self->steps + pc[0], (size_t) pc[1], frame->count);
+		--frames.count;
+		if (ctx->error_number)
+			goto halt;
+		pc = code + pc[2];
+		VM_NEXT();
+	VM_CASE(OP_REPEAT):
+		++commands;
+		res = *--sp;
+		if (!(res >= 1)) { // fast path for the loops doing nothing, NaN included
+			pc = code + *pc;
+			VM_NEXT();
+		}
+		if ((count = context_repeat_count(ctx, res)) == 0 || (frame = push_frame(&frames, ctx)) == 0)
+			goto halt;
+		frame->count = count;
+		if (frames.count - ctx->nested_call_count > ctx->stats.deepest_repeats)
+			ctx->stats.deepest_repeats = frames.count - ctx->nested_call_count;
+		++pc;
+		VM_NEXT();
+	VM_CASE(OP_LOOP):
+		if (--frames.base[frames.count - 1].count > 0)
+			pc = code + *pc;
+		else {
+			--frames.count;
+			++pc;
+		}
+		VM_NEXT();
+	VM_CASE(OP_CALL):
+		++commands;
+		if (procs[*pc].body == 0) {
+			ctx->error_number = 9;
+			fprintf(stderr, "Procedure '%s' does not exists.", self->proc_names[*pc]);
+			goto halt;
+		}
+		if (procs[*pc].params != (size_t) pc[1]) {
+			context_arity_failure(ctx, self->proc_names[*pc], procs[*pc].params, (size_t) pc[1]);
+			goto halt;
+		}
+		sp -= pc[1]; // the arguments
+		if (ctx->memo && memo_call(ctx->memo, ctx, (size_t) *pc, frames.count)) {
+			if (ctx->error_number)
+				goto halt;
+			pc += 2; // the outputs of a previous call were replayed
+			VM_NEXT();
+		}
+		if (!context_reserve_locals(ctx, (size_t) pc[1]) || (frame = push_frame(&frames, ctx)) == 0)
+			goto halt;
+		memcpy(ctx->locals + ctx->local_count, sp, (size_t) pc[1] * sizeof(double));
+		frame->call.ret = pc + 2;
+		frame->call.base = context_enter_locals(ctx, (size_t) pc[1]);
+		locals = ctx->locals + ctx->local_base;
+		pc = procs[*pc].body;
+		if (++ctx->nested_call_count > ctx->stats.deepest_calls)
+			ctx->stats.deepest_calls = ctx->nested_call_count;
+		VM_NEXT();
+	VM_CASE(OP_RETURN):
+		frame = frames.base + --frames.count;
+		pc = frame->call.ret;
+		context_leave_locals(ctx, frame->call.base);
+		locals = ctx->locals + ctx->local_base;
+		--ctx->nested_call_count;
+		if (ctx->memo)
+			memo_return(ctx->memo, ctx, frames.count);
+		VM_NEXT();
+	VM_CASE(OP_PROC):
+		++commands;
+		if (ctx->nested_call_count) {
+			ctx->error_number = 11;
+			fprintf(stderr, "Procedure '%s' declaration failed : nested procedure are not allowed.", self->proc_names[*pc]);
+			goto halt;
+		}
+		if (procs[*pc].body == 0) {
+			procs[*pc].body = code + pc[2];
+			procs[*pc].params = (size_t) pc[1];
+			++ctx->stats.procedures;
+		} else
+			fprintf(stderr, "Procedure '%s' declaration failed : the procedure already exists.", self->proc_names[*pc]);
+		pc += 3;
+		VM_NEXT();
+	VM_CASE(OP_MARK):
+		profile_mark(ctx->profile, (size_t) *pc++, ctx->lines_printed);
+		VM_NEXT();
+	VM_CASE(OP_ENTER):
+		profile_enter(ctx->profile, (size_t) *pc++, ctx->lines_printed);
+		VM_NEXT();
+	VM_CASE(OP_LEAVE):
+		profile_leave(ctx->profile, (size_t) *pc++, ctx->lines_printed);
+		VM_NEXT();
+	VM_CASE(OP_LOCAL):
+		++expressions;
+		*sp++ = locals[*pc++];
+		VM_NEXT();
+	VM_CASE(OP_STORE_LOCAL):
+		++commands;
+		locals[*pc++] = *--sp;
+		VM_NEXT();
+#define VM_TEST(opcode, op) \
+	VM_CASE(opcode): \
+		++expressions; \
+		--sp; \
+		sp[-1] = sp[-1] op sp[0]; \
+		VM_NEXT();
+	VM_TEST(OP_LT, <)
+	VM_TEST(OP_LE, <=)
+	VM_TEST(OP_EQ, ==)
+	VM_TEST(OP_NE, !=)
+	VM_TEST(OP_GT, >)
+	VM_TEST(OP_GE, >=)
+#undef VM_TEST
+	VM_CASE(OP_NOT):
+		++expressions;
+		sp[-1] = sp[-1] == 0.0;
+		VM_NEXT();
+	VM_CASE(OP_AND):
+		++expressions;
+		if (sp[-1] == 0.0) {
+			sp[-1] = 0.0; // not -0
+			pc = code + *pc;
+		} else {
+			--sp;
+			++pc;
+		}
+		VM_NEXT();
+	VM_CASE(OP_OR):
+		++expressions;
+		if (sp[-1] != 0.0) {
+			sp[-1] = 1.0;
+			pc = code + *pc;
+		} else {
+			--sp;
+			++pc;
+		}
+		VM_NEXT();
+	VM_CASE(OP_TRUTH):
+		sp[-1] = sp[-1] != 0.0;
+		VM_NEXT();
+	VM_CASE(OP_JUMP):
+		pc = code + *pc;
+		VM_NEXT();
+	VM_CASE(OP_BRANCH):
+		++commands;
+		if (*--sp == 0.0)
+			pc = code + *pc;
+		else
+			++pc;
+		VM_NEXT();
+	VM_CASE(OP_WHILE):
+		++commands;
+		if (*--sp == 0.0) {
+			pc = code + *pc;
+			VM_NEXT();
+		}
+		if ((frame = push_frame(&frames, ctx)) == 0)
+			goto halt;
+		frame->count = TURTLE_REPEAT_MAX_ITERATIONS;
+		if (frames.count - ctx->nested_call_count > ctx->stats.deepest_repeats)
+			ctx->stats.deepest_repeats = frames.count - ctx->nested_call_count;
+		++pc;
+		VM_NEXT();
+	VM_CASE(OP_AGAIN):
+		if (*--sp == 0.0) {
+			--frames.count;
+			++pc;
+		} else if (--frames.base[frames.count - 1].count == 0) {
+			context_while_failure(ctx);
+			goto halt;
+		} else
+			pc = code + *pc;
+		VM_NEXT();
+	VM_CASE(OP_HALT):
+		goto halt;
+#ifndef VM_COMPUTED_GOTO
+	}
+#endif
+halt:
+	ctx->nested_call_count = 0;
+	ctx->local_count = ctx->local_base = 0;
+	ctx->stats.commands += commands;
+	ctx->stats.expressions += expressions;
+	free(frames.base);
+	free(stack);
+	free(procs);
+}
@@ -0,0 +1,79 @@
+#ifndef TURTLE_VM_H
+#define TURTLE_VM_H
+
+#include <stdint.h>
+
+#include "turtle-ast.h"
+#include "turtle-motion.h"
+#include "turtle-profile.h"
+
+// The bytecode is a flat stream of 32 bits words, an opcode is followed by its operands (if any).
+// Expressions are evaluated on a stack of doubles, the loop counters and the return addresses are kept on a frame stack.
+// The parameters of the calls are the locals of the context (see context_enter_locals), shared with the tree walker.
+enum vm_opcode {
+	OP_HALT,     // stop the execution
+	OP_VALUE,    // [index] push a literal from the values of the program
+	OP_LOAD,     // [slot] push a variable, fail if the variable is not defined
+	OP_DEFINE,   // [slot] mark a variable as defined before its "set" expression reads it
+	OP_STORE,    // [slot] pop a value into a variable
+	OP_HOISTED,  // [slot, end] push a hoisted value and jump to end if it's already computed
+	OP_SAVE,     // [slot] keep the value on the top of the stack into a hidden slot
+	OP_FORGET,   // [first, count] forget the hidden slots of a loop
+	OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW, OP_NEG,
+	OP_COS, OP_SIN, OP_TAN, OP_SQRT, OP_SQUARE, OP_RANDOM,
+	OP_FORWARD, OP_BACKWARD, OP_UP, OP_DOWN, OP_COLOR, OP_LEFT, OP_RIGHT, OP_HEADING, OP_POSITION, OP_HOME, OP_PRINT,
+	OP_MOTION,   // [first, count, end] replay a geometry only loop when the context allows it, otherwise continue to OP_REPEAT
+	OP_REPEAT,   // [end] pop the count, jump to end if there is no iteration, otherwise push a loop counter
+	OP_LOOP,     // [body] decrement the loop counter, jump back to the body while it's positive
+	OP_CALL,     // [proc, count] pop the arguments into a new frame of locals and call a declared procedure,
+	             // fail if it's not declared or if it has another number of parameters
+	OP_RETURN,   // return from a procedure, its locals are released
+	OP_PROC,     // [proc, params, body] declare a procedure
+	OP_MARK,     // [site] count a command of a profiled program (see turtle-profile.h)
+	OP_ENTER,    // [site] start a repeat or a call of a profiled program
+	OP_LEAVE,    // [site] end a repeat or a call of a profiled program
+	OP_LOCAL,    // [index] push a parameter of the current call
+	OP_STORE_LOCAL, // [index] pop a value into a parameter of the current call
+	OP_LT, OP_LE, OP_EQ, OP_NE, OP_GT, OP_GE, OP_NOT, // the comparisons, their result is 1 or 0
+	OP_AND,      // [end] jump to end with 0 if the value on the top of the stack is 0, otherwise pop it
+	OP_OR,       // [end] jump to end with 1 if the value on the top of the stack is not 0, otherwise pop it
+	OP_TRUTH,    // turn the right operand of "and" or "or" into 1 or 0
+	OP_JUMP,     // [target] jump to target
+	OP_BRANCH,   // [else] pop a condition, jump to else if it's 0
+	OP_WHILE,    // [end] pop a condition, jump to end if it's 0, otherwise push a loop counter
+	OP_AGAIN,    // [body] pop a condition, jump back to the body while it's not 0 (failing after too many iterations)
+	OP_COUNT,
+};
+
+// a compiled program, built from a resolved AST
+struct vm_program {
+	int32_t *code;
+	size_t code_count;
+	size_t code_capacity;
+	double *values;  // the literals used by OP_VALUE
+	size_t value_count;
+	size_t value_capacity;
+	struct motion_step *steps; // the motion templates used by OP_MOTION
+	size_t step_count;
+	size_t step_capacity;
+	const char **variable_names; // indexed by slot, for error messages
+	size_t variable_count;
+	const char **proc_names; // indexed by procedure slot, for error messages
+	size_t proc_count;
+	size_t stack_size; // the deepest expression stack needed by the code
+	void *mapping; // a program loaded from a file (see turtle-tbc.h), the code, the values and the steps are in it
+	size_t mapping_size;
+};
+
+// compile the resolved AST into bytecode, return 0 on success or 1 on memory allocation error
+// with a profile (null otherwise), its sites are added and the code reports to it, without replaying the loops
+int vm_compile(struct vm_program *self, const struct ast *ast, struct profile *profile);
+
+// release the program, it's using the heap (and the mapping of a loaded program)
+void vm_destroy(struct vm_program *self);
+
+// evaluate the program with a given context, the results are the same as ast_eval
+// a program compiled with a profile is evaluated with this profile as ctx->profile
+void vm_eval(const struct vm_program *self, struct context *ctx);
+
+#endif /* TURTLE_VM_H */
@@ -1,29 +1,163 @@
 #include <time.h>
-#include <assert.h>
+#include <unistd.h>
 
-#include "turtle-ast.h"
-#include "turtle-lexer.h"
-#include "turtle-parser.h"
+#include "turtle-run.h"
+#include "turtle-serve.h"
+#include "turtle-render.h"
 
 // I used the following link to draw my programs :
 // https://en.wikipedia.org/wiki/T-square_(fractal)
 
-int main() {
+static int usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--engine=vm|tree] [--max-depth=N] [--buffer-size=BYTES] [--format=text|binary|svg] [--svg-decimals=N] [--no-optimize] [--replay] [--memoize] [--simplify[=SEGMENTS]] [--seed=N] [--profile[=FILE.json]] [--stats] [program.turtle ...]\n", name);
+	fprintf(stderr, "       %s --render IMAGE.png|IMAGE.ppm [--size WIDTHxHEIGHT] [--workers=N] [options] [program.turtle]\n", name);
+	fprintf(stderr, "       %s --compile-to FILE.tbc [--no-optimize] [program.turtle]\n", name);
+	fprintf(stderr, "       %s --load FILE.tbc [options] [program.turtle]\n", name);
+	fprintf(stderr, "       %s --serve SOCKET [--workers=N] [--cache=PROGRAMS] [options]\n", name);
+	return EXIT_FAILURE;
+}
+
+// The size of the image of --render, like 1000x1000.
+static bool parse_size(const char *text, struct options *const options) {
+	char *end;
+	options->width = strtoull(text, &end, 10);
+	if (*end != 'x' || end == text)
+		return false;
+	text = end + 1;
+	options->height = strtoull(text, &end, 10);
+	return *end == 0 && end != text && options->width && options->height && options->width <= RENDER_SIZE_MAX && options->height <= RENDER_SIZE_MAX;
+}
+
+int main(int argc, char *argv[]) {
+	struct options options;
+	options_create(&options);
+	const char *socket_path = 0, *compile_path = 0, *load_path = 0;
+	size_t workers = 0, cache_size = SERVE_CACHE_DEFAULT;
+	char *end;
+	int first_program = argc;
+	bool seeded = false, threaded = false;
+	for (int i = 1 ; i < argc && first_program == argc ; ++i) {
+		if (strcmp(argv[i], "--engine=vm") == 0)
+			options.engine = ENGINE_VM;
+		else if (strcmp(argv[i], "--engine=tree") == 0)
+			options.engine = ENGINE_TREE;
+		else if (strncmp(argv[i], "--max-depth=", 12) == 0) {
+			options.max_depth = strtoull(argv[i] + 12, &end, 10);
+			if (*end || end == argv[i] + 12)
+				return usage(argv[0]);
+		} else if (strncmp(argv[i], "--buffer-size=", 14) == 0) {
+			options.buffer_size = strtoull(argv[i] + 14, &end, 10);
+			if (*end || end == argv[i] + 14 || options.buffer_size > TURTLE_OUTPUT_BUFFER_MAX)
+				return usage(argv[0]);
+		} else if (strcmp(argv[i], "--format=text") == 0)
+			options.format = OUTPUT_TEXT;
+		else if (strcmp(argv[i], "--format=binary") == 0)
+			options.format = OUTPUT_BINARY;
+		else if (strcmp(argv[i], "--format=svg") == 0)
+			options.format = OUTPUT_SVG;
+		else if (strncmp(argv[i], "--svg-decimals=", 15) == 0) {
+			const unsigned long long int decimals = strtoull(argv[i] + 15, &end, 10);
+			if (*end || end == argv[i] + 15 || decimals > OUTPUT_SVG_DECIMALS_MAX)
+				return usage(argv[0]);
+			options.svg_decimals = (unsigned int) decimals;
+		}
+		else if (strcmp(argv[i], "--no-optimize") == 0)
+			options.optimize = false;
+		else if (strcmp(argv[i], "--replay") == 0)
+			options.replay = true;
+		else if (strcmp(argv[i], "--memoize") == 0)
+			options.memoize = true;
+		else if (strcmp(argv[i], "--simplify") == 0)
+			options.simplify = true;
+		else if (strncmp(argv[i], "--simplify=", 11) == 0) {
+			options.simplify = true;
+			options.segments = strtoull(argv[i] + 11, &end, 10);
+			if (*end || end == argv[i] + 11)
+				return usage(argv[0]);
+		} else if (strncmp(argv[i], "--seed=", 7) == 0) {
+			options.seed = strtoull(argv[i] + 7, &end, 10);
+			seeded = true;
+			if (*end || end == argv[i] + 7)
+				return usage(argv[0]);
+		} else if (strcmp(argv[i], "--profile") == 0)
+			options.profile = true;
+		else if (strncmp(argv[i], "--profile=", 10) == 0 && argv[i][10]) {
+			options.profile = true;
+			options.profile_path = argv[i] + 10;
+		} else if (strcmp(argv[i], "--stats") == 0)
+			options.stats = true;
+		else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+			socket_path = argv[++i];
+		else if (strcmp(argv[i], "--compile-to") == 0 && i + 1 < argc)
+			compile_path = argv[++i];
+		else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+			load_path = argv[++i];
+		else if (strcmp(argv[i], "--render") == 0 && i + 1 < argc)
+			options.render_path = argv[++i];
+		else if (strncmp(argv[i], "--size=", 7) == 0) {
+			if (!parse_size(argv[i] + 7, &options))
+				return usage(argv[0]);
+		} else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+			if (!parse_size(argv[++i], &options))
+				return usage(argv[0]);
+		}
+		else if (strncmp(argv[i], "--workers=", 10) == 0) {
+			workers = strtoull(argv[i] + 10, &end, 10);
+			if (*end || end == argv[i] + 10)
+				return usage(argv[0]);
+			threaded = true;
+		} else if (strncmp(argv[i], "--cache=", 8) == 0) {
+			cache_size = strtoull(argv[i] + 8, &end, 10);
+			if (*end || end == argv[i] + 8)
+				return usage(argv[0]);
+		} else if (strncmp(argv[i], "--", 2) == 0)
+			return usage(argv[0]);
+		else
+			first_program = i;
+	}
+	// the options come before the programs, a program named like an option is given as ./--name
+	for (int i = first_program ; i < argc ; ++i)
+		if (strncmp(argv[i], "--", 2) == 0)
+			return usage(argv[0]);
+	// a compiled program is evaluated by the VM, without its AST
+	if ((compile_path != 0) + (load_path != 0) + (socket_path != 0) > 1 || (load_path && (options.engine == ENGINE_TREE || options.memoize)))
+		return usage(argv[0]);
+	// the programs are read from STDIN when no path is given, the server reads them (and their seeds) from its connections
+	const int count = argc - first_program;
+	if ((socket_path && (count || seeded)) || ((compile_path || load_path) && count > 1))
+		return usage(argv[0]);
+	// the image of a single program is drawn by the threads of --workers, it replaces the output and its simplification
+	if (options.render_path && (socket_path || compile_path || count > 1 || options.simplify))
+		return usage(argv[0]);
+	// the workers are the threads of the image or of the server
+	if (threaded && !options.render_path && !socket_path)
+		return usage(argv[0]);
+	options.threads = workers;
+	// an SVG document is a single drawing
+	if (options.format == OUTPUT_SVG && (socket_path || count > 1))
+		return usage(argv[0]);
+	// the profile of a single program is taken by the VM compiling it, every command is evaluated
+	if (options.profile && (socket_path || compile_path || load_path || count > 1 || options.engine == ENGINE_TREE || options.replay || options.memoize))
+		return usage(argv[0]);
+	// the stats are written after each program evaluated by this process
+	if (options.stats && (socket_path || compile_path))
+		return usage(argv[0]);
+	const char *const input = count ? argv[first_program] : 0;
 	// yydebug = 1 ;
-	srand(time(NULL));
-	struct ast root = {0};
-	int ret = yyparse(&root);
-	yylex_destroy();
-	if (ret == 0) {
-		assert(root.unit);
-		struct context ctx = {0};
-		context_create(&ctx);
-		ast_eval(&root, &ctx);
-		ret = context_destroy(&ctx);
-		// ast_print(&root);
-		if (ret == 1)
-			fprintf(stderr, "Memory Allocation Error.\n");
+	if (socket_path)
+		return serve(socket_path, &options, workers, cache_size);
+	if (compile_path)
+		return run_compile(&options, input, compile_path);
+	if (!seeded)
+		options.seed = (uint64_t) time(NULL);
+	if (load_path)
+		return run_load(&options, input, load_path, STDOUT_FILENO);
+	// the drawings of the programs are written one after the other, the exit code is the first error
+	int ret = count ? 0 : run(&options, 0, STDOUT_FILENO);
+	for (int i = first_program ; i < argc ; ++i) {
+		const int error = run(&options, argv[i], STDOUT_FILENO);
+		if (ret == 0)
+			ret = error;
 	}
-	ast_destroy(&root);
 	return ret;
 }